@@ -0,0 +1,587 @@
+/*
+end-to-end benchmark of the streaming pipeline, headless and without a camera.
+frames of KSyntheticSource go through MyFFMPEGStreamer to an RTP receiver on the loopback,
+for every codec, resolution and source format of the matrix. per stage it reports the mean
+and 99th percentile cost, then the throughput and the capture-to-packet latency.
+
+  kstream_bench [--frames n] [--fps n] [--port n] [--codecs mpeg4,h264,h264ll]
+                [--sizes 640x480,1280x720] [--formats bgr,i420] [--slices n] [--no-overlay] [--csv]
+
+--fps 0 runs every frame as fast as the pipeline can, which measures throughput.
+--slices 1 converts on one core, 0 (default) splits large frames across the cores.
+the latency is measured up to the last RTP packet of a frame arriving at the receiver,
+so it covers capture, conversion, encoding, packetization and the loopback, not decoding.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET bench_socket;
+#define close_socket closesocket
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+typedef int bench_socket;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "KSyntheticSource.h"
+#include "KFramePool.h"
+#include "MyFFMPEGStreamer.h"
+
+#define BENCH_FRAMES		300
+#define BENCH_FPS			30
+#define BENCH_PORT			9554
+#define BENCH_BIT_RATE		4000000
+// RTP clock of video payloads
+#define RTP_CLOCK			90000
+#define RTP_HEADER_SIZE		12
+#define RECV_BUFFER_SIZE	(4 * 1024 * 1024)
+#define RECV_TIMEOUT_MS		100
+// time left to the receiver for the packets still in flight after the last frame
+#define DRAIN_WAIT_MS		300
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct BenchCase{
+	std::string codec;
+	int width;
+	int height;
+	enum AVPixelFormat pix_fmt;
+};
+
+struct BenchOptions{
+	int frames;
+	int fps;
+	int port;
+	int slices;
+	bool overlay;
+	bool csv;
+	std::vector<std::string> codecs;
+	std::vector<cv::Size> sizes;
+	std::vector<enum AVPixelFormat> formats;
+};
+
+// distribution of one stage over the run, in microseconds
+struct BenchStat{
+	double mean;
+	int64_t p50;
+	int64_t p90;
+	int64_t p99;
+	int64_t max;
+};
+
+static BenchStat make_stat(std::vector<int64_t> values)
+{
+	BenchStat stat;
+	memset(&stat, 0, sizeof(stat));
+	if (values.empty())
+		return stat;
+
+	std::sort(values.begin(), values.end());
+	int64_t sum = 0;
+	for (size_t i = 0; i < values.size(); i++)
+		sum += values[i];
+
+	stat.mean = (double)sum / values.size();
+	stat.p50 = values[values.size() * 50 / 100];
+	stat.p90 = values[values.size() * 90 / 100];
+	stat.p99 = values[values.size() * 99 / 100];
+	stat.max = values.back();
+	return stat;
+}
+
+/*
+RTP receiver on the loopback. the last packet of each frame carries the marker bit,
+its arrival time is kept by RTP timestamp. the RTCP port next to it is drained too,
+so the sender never sees ICMP port unreachable.
+*/
+class BenchReceiver
+{
+public:
+	BenchReceiver() : is_running(false), bytes(0), packets(0)
+	{
+		sockets[0] = sockets[1] = INVALID_SOCKET;
+	}
+	~BenchReceiver()
+	{
+		Stop();
+	}
+
+private:
+	bench_socket sockets[2];
+	std::vector<std::thread> threads;
+	std::atomic<bool> is_running;
+	std::mutex arrival_lock;
+	std::vector<std::pair<uint32_t, bench_clock::time_point> > arrivals;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> packets;
+
+	static bench_socket open_socket(int port)
+	{
+		bench_socket s = socket(AF_INET, SOCK_DGRAM, 0);
+		if (s == INVALID_SOCKET)
+			return s;
+
+		int buffer_size = RECV_BUFFER_SIZE;
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&buffer_size, sizeof(buffer_size));
+#ifdef _WIN32
+		DWORD timeout = RECV_TIMEOUT_MS;
+#else
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = RECV_TIMEOUT_MS * 1000;
+#endif
+		setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((unsigned short)port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			close_socket(s);
+			return INVALID_SOCKET;
+		}
+		return s;
+	}
+
+	void receive(int index)
+	{
+		std::vector<unsigned char> buffer(65536);
+		while (this->is_running)
+		{
+			int size = (int)recv(this->sockets[index], (char*)buffer.data(), (int)buffer.size(), 0);
+			bench_clock::time_point now = bench_clock::now();
+			// RTCP, or a timeout to look at is_running again
+			if (index != 0 || size < RTP_HEADER_SIZE)
+				continue;
+
+			this->packets++;
+			this->bytes += size;
+			if ((buffer[0] >> 6) != 2 || !(buffer[1] & 0x80))
+				continue;
+
+			uint32_t ts = ((uint32_t)buffer[4] << 24) | ((uint32_t)buffer[5] << 16) |
+				((uint32_t)buffer[6] << 8) | buffer[7];
+			std::lock_guard<std::mutex> lock(this->arrival_lock);
+			this->arrivals.push_back(std::make_pair(ts, now));
+		}
+	}
+
+public:
+	bool Start(int port)
+	{
+		this->sockets[0] = open_socket(port);
+		this->sockets[1] = open_socket(port + 1);
+		if (this->sockets[0] == INVALID_SOCKET || this->sockets[1] == INVALID_SOCKET)
+		{
+			Stop();
+			return false;
+		}
+
+		this->is_running = true;
+		for (int i = 0; i < 2; i++)
+			this->threads.push_back(std::thread(&BenchReceiver::receive, this, i));
+		return true;
+	}
+
+	void Stop()
+	{
+		this->is_running = false;
+		for (size_t i = 0; i < this->threads.size(); i++)
+			this->threads[i].join();
+		this->threads.clear();
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (this->sockets[i] != INVALID_SOCKET)
+				close_socket(this->sockets[i]);
+			this->sockets[i] = INVALID_SOCKET;
+		}
+	}
+
+	/*
+	arrival time of the last packet of every frame, by frame index.
+	the first frame is a keyframe at pts 0, the others are fps / RTP_CLOCK apart.
+	*/
+	std::vector<bench_clock::time_point> GetFrameArrivals(int frames, int fps)
+	{
+		std::vector<bench_clock::time_point> frame_arrivals(frames);
+		std::lock_guard<std::mutex> lock(this->arrival_lock);
+		if (this->arrivals.empty())
+			return frame_arrivals;
+
+		uint32_t ts0 = this->arrivals[0].first;
+		for (size_t i = 0; i < this->arrivals.size(); i++)
+		{
+			int64_t delta = (int32_t)(this->arrivals[i].first - ts0);
+			int64_t index = (delta * fps + RTP_CLOCK / 2) / RTP_CLOCK;
+			if (index >= 0 && index < frames && frame_arrivals[index] == bench_clock::time_point())
+				frame_arrivals[index] = this->arrivals[i].second;
+		}
+		return frame_arrivals;
+	}
+
+	uint64_t GetBytes() { return this->bytes; }
+	uint64_t GetPackets() { return this->packets; }
+};
+
+struct BenchResult{
+	int frames;
+	int encoded;
+	int received;
+	double fps;
+	double kbps;
+	BenchStat capture;
+	BenchStat convert;
+	BenchStat overlay;
+	BenchStat encode;
+	BenchStat write;
+	BenchStat total;
+	BenchStat latency;
+	uint64_t frame_allocations;
+};
+
+static bool make_config(const std::string& codec, int width, int height, int fps, MyFFMPEGEncoderConfig& config)
+{
+	if (codec == "h264ll")
+		config = MyFFMPEGEncoderConfig::LowLatencyH264(width, height, BENCH_BIT_RATE, fps);
+	else
+	{
+		config = MyFFMPEGEncoderConfig();
+		config.codec_id = codec == "h264" ? AV_CODEC_ID_H264 : AV_CODEC_ID_MPEG4;
+		config.width = width;
+		config.height = height;
+		config.fps = fps;
+		config.bit_rate = BENCH_BIT_RATE;
+	}
+
+	if (codec != "mpeg4" && codec != "h264" && codec != "h264ll")
+		return false;
+	return avcodec_find_encoder(config.codec_id) != NULL;
+}
+
+static bool run_case(const BenchCase& bench_case, const BenchOptions& options, BenchResult& result)
+{
+	// the encoder time base follows the stream rate even when the run is not paced
+	int stream_fps = options.fps > 0 ? options.fps : BENCH_FPS;
+	MyFFMPEGEncoderConfig config;
+	if (!make_config(bench_case.codec, bench_case.width, bench_case.height, stream_fps, config))
+		return false;
+
+	BenchReceiver receiver;
+	if (!receiver.Start(options.port))
+	{
+		fprintf(stderr, "can't bind the receiver to port %d\n", options.port);
+		return false;
+	}
+
+	MyFFMPEGStreamer streamer;
+	if (!streamer.Initialize(config, "127.0.0.1", options.port))
+	{
+		fprintf(stderr, "can't open the %s encoder, error %d\n", bench_case.codec.c_str(), streamer.GetLastError());
+		return false;
+	}
+	streamer.SetOverlay(options.overlay);
+	streamer.SetConvertSlices(options.slices);
+
+	KSyntheticSource source(bench_case.width, bench_case.height, bench_case.pix_fmt);
+	KFramePool pool;
+	if (!source.Open())
+	{
+		streamer.Deinitialize();
+		return false;
+	}
+
+	int frames = options.frames;
+	std::vector<int64_t> capture_us, convert_us, overlay_us, encode_us, write_us, total_us;
+	std::vector<bench_clock::time_point> capture_times(frames);
+	cv::Mat img;
+	int encoded = 0;
+
+	bench_clock::time_point start = bench_clock::now();
+	bench_clock::time_point next_frame = start;
+	for (int i = 0; i < frames; i++)
+	{
+		if (options.fps > 0)
+		{
+			std::this_thread::sleep_until(next_frame);
+			next_frame += std::chrono::microseconds(1000000 / options.fps);
+		}
+
+		capture_times[i] = bench_clock::now();
+		if (source.Grab() != KGrabResult::GRAB_FRAME || !source.Retrieve(img, pool))
+			break;
+		int64_t capture = std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - capture_times[i]).count();
+
+		bench_clock::time_point stream_start = bench_clock::now();
+		streamer.StreamImage(img, false, source.GetPixelFormat());
+		int64_t stream = std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - stream_start).count();
+
+		struct MyFFMPEGFrameTiming timing = streamer.GetLastFrameTiming();
+		if (!timing.is_encoded)
+			continue;
+		encoded++;
+		capture_us.push_back(capture);
+		convert_us.push_back(timing.convert_us);
+		overlay_us.push_back(timing.overlay_us);
+		encode_us.push_back(timing.encode_us);
+		write_us.push_back(timing.write_us);
+		total_us.push_back(capture + stream);
+	}
+	double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+	// the delayed frames of the encoder, then the packets still on their way
+	streamer.StreamImage(img, true);
+	std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_WAIT_MS));
+
+	result.frame_allocations = pool.GetAllocationCount();
+	streamer.Deinitialize();
+	source.Close();
+	receiver.Stop();
+
+	std::vector<bench_clock::time_point> arrivals = receiver.GetFrameArrivals(frames, stream_fps);
+	std::vector<int64_t> latency_us;
+	for (int i = 0; i < frames; i++)
+	{
+		if (arrivals[i] == bench_clock::time_point())
+			continue;
+		latency_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(arrivals[i] - capture_times[i]).count());
+	}
+
+	result.frames = frames;
+	result.encoded = encoded;
+	result.received = (int)latency_us.size();
+	result.fps = seconds > 0 ? encoded / seconds : 0;
+	result.kbps = seconds > 0 ? receiver.GetBytes() * 8 / seconds / 1000 : 0;
+	result.capture = make_stat(capture_us);
+	result.convert = make_stat(convert_us);
+	result.overlay = make_stat(overlay_us);
+	result.encode = make_stat(encode_us);
+	result.write = make_stat(write_us);
+	result.total = make_stat(total_us);
+	result.latency = make_stat(latency_us);
+	return true;
+}
+
+static const char* format_name(enum AVPixelFormat pix_fmt)
+{
+	return pix_fmt == AV_PIX_FMT_YUV420P ? "i420" : "bgr";
+}
+
+static void print_header(bool csv)
+{
+	if (csv)
+	{
+		printf("codec,width,height,format,frames,encoded,received,fps,kbps,"
+			"capture_mean_us,capture_p99_us,convert_mean_us,convert_p99_us,overlay_mean_us,overlay_p99_us,"
+			"encode_mean_us,encode_p99_us,write_mean_us,write_p99_us,total_mean_us,total_p99_us,"
+			"latency_p50_us,latency_p90_us,latency_p99_us,latency_max_us,frame_allocations\n");
+		return;
+	}
+
+	printf("%-7s %-10s %-5s %7s %8s | %-13s %-13s %-13s %-13s %-13s %-13s | %-27s\n",
+		"codec", "size", "fmt", "fps", "kbit/s",
+		"capture", "convert", "overlay", "encode", "write", "total",
+		"latency p50/p90/p99/max ms");
+	printf("%-7s %-10s %-5s %7s %8s | %-13s %-13s %-13s %-13s %-13s %-13s |\n",
+		"", "", "", "", "",
+		"mean/p99 us", "mean/p99 us", "mean/p99 us", "mean/p99 us", "mean/p99 us", "mean/p99 us");
+}
+
+static void print_result(const BenchCase& bench_case, const BenchResult& result, bool csv)
+{
+	const BenchStat* stages[] = { &result.capture, &result.convert, &result.overlay,
+		&result.encode, &result.write, &result.total };
+
+	if (csv)
+	{
+		printf("%s,%d,%d,%s,%d,%d,%d,%.2f,%.1f", bench_case.codec.c_str(), bench_case.width, bench_case.height,
+			format_name(bench_case.pix_fmt), result.frames, result.encoded, result.received, result.fps, result.kbps);
+		for (int i = 0; i < 6; i++)
+			printf(",%.1f,%lld", stages[i]->mean, (long long)stages[i]->p99);
+		printf(",%lld,%lld,%lld,%lld,%llu\n", (long long)result.latency.p50, (long long)result.latency.p90,
+			(long long)result.latency.p99, (long long)result.latency.max, (unsigned long long)result.frame_allocations);
+		return;
+	}
+
+	char size[32];
+	snprintf(size, sizeof(size), "%dx%d", bench_case.width, bench_case.height);
+	printf("%-7s %-10s %-5s %7.1f %8.0f |", bench_case.codec.c_str(), size, format_name(bench_case.pix_fmt),
+		result.fps, result.kbps);
+	for (int i = 0; i < 6; i++)
+	{
+		char stage[32];
+		snprintf(stage, sizeof(stage), "%.0f/%lld", stages[i]->mean, (long long)stages[i]->p99);
+		printf(" %-13s", stage);
+	}
+	printf(" | %.1f/%.1f/%.1f/%.1f", result.latency.p50 / 1000.0, result.latency.p90 / 1000.0,
+		result.latency.p99 / 1000.0, result.latency.max / 1000.0);
+	if (result.received < result.encoded)
+		printf(" (%d of %d frames received)", result.received, result.encoded);
+	printf("\n");
+}
+
+static std::vector<std::string> split(const std::string& list)
+{
+	std::vector<std::string> items;
+	size_t begin = 0;
+	while (begin <= list.size())
+	{
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos)
+			end = list.size();
+		if (end > begin)
+			items.push_back(list.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	return items;
+}
+
+static void print_usage()
+{
+	fprintf(stderr, "usage: kstream_bench [--frames n] [--fps n] [--port n] [--codecs mpeg4,h264,h264ll]\n"
+		"                     [--sizes 640x480,1280x720,1920x1080] [--formats bgr,i420] [--slices n]\n"
+		"                     [--no-overlay] [--csv]\n");
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& options)
+{
+	options.frames = BENCH_FRAMES;
+	options.fps = BENCH_FPS;
+	options.port = BENCH_PORT;
+	options.slices = 0;
+	options.overlay = true;
+	options.csv = false;
+	std::string codecs = "mpeg4,h264ll";
+	std::string sizes = "640x480,1280x720,1920x1080";
+	std::string formats = "bgr,i420";
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--frames" && has_value)
+			options.frames = atoi(argv[++i]);
+		else if (arg == "--fps" && has_value)
+			options.fps = atoi(argv[++i]);
+		else if (arg == "--port" && has_value)
+			options.port = atoi(argv[++i]);
+		else if (arg == "--codecs" && has_value)
+			codecs = argv[++i];
+		else if (arg == "--sizes" && has_value)
+			sizes = argv[++i];
+		else if (arg == "--formats" && has_value)
+			formats = argv[++i];
+		else if (arg == "--slices" && has_value)
+			options.slices = atoi(argv[++i]);
+		else if (arg == "--no-overlay")
+			options.overlay = false;
+		else if (arg == "--csv")
+			options.csv = true;
+		else
+			return false;
+	}
+	if (options.frames <= 0 || options.fps < 0 || options.port <= 0 || options.slices < 0)
+		return false;
+
+	options.codecs = split(codecs);
+
+	std::vector<std::string> items = split(sizes);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		int width = 0, height = 0;
+		if (sscanf(items[i].c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0 ||
+			width % 2 != 0 || height % 2 != 0)
+			return false;
+		options.sizes.push_back(cv::Size(width, height));
+	}
+
+	items = split(formats);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		if (items[i] == "bgr")
+			options.formats.push_back(AV_PIX_FMT_BGR24);
+		else if (items[i] == "i420")
+			options.formats.push_back(AV_PIX_FMT_YUV420P);
+		else
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	if (!parse_options(argc, argv, options))
+	{
+		print_usage();
+		return 2;
+	}
+
+#ifdef _WIN32
+	WSADATA wsa_data;
+	WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+	av_register_all();
+#endif
+	av_log_set_level(AV_LOG_ERROR);
+
+	print_header(options.csv);
+	int failed = 0;
+	for (size_t c = 0; c < options.codecs.size(); c++)
+	{
+		for (size_t s = 0; s < options.sizes.size(); s++)
+		{
+			for (size_t f = 0; f < options.formats.size(); f++)
+			{
+				BenchCase bench_case;
+				bench_case.codec = options.codecs[c];
+				bench_case.width = options.sizes[s].width;
+				bench_case.height = options.sizes[s].height;
+				bench_case.pix_fmt = options.formats[f];
+
+				BenchResult result;
+				if (!run_case(bench_case, options, result))
+				{
+					fprintf(stderr, "%s %dx%d %s: skipped\n", bench_case.codec.c_str(),
+						bench_case.width, bench_case.height, format_name(bench_case.pix_fmt));
+					failed++;
+					continue;
+				}
+				print_result(bench_case, result, options.csv);
+				fflush(stdout);
+			}
+		}
+	}
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+	return failed > 0 ? 1 : 0;
+}
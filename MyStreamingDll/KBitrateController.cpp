@@ -0,0 +1,99 @@
+#include <algorithm>
+#include "KBitrateController.h"
+
+// smoothing of the measurements, 1/8 weight for the newest frame
+#define BITRATE_SMOOTHING		0.125
+// multiplicative decrease and additive increase (fraction of max_bit_rate)
+#define BITRATE_DECREASE		0.75
+#define BITRATE_INCREASE		0.05
+
+KBitrateController::KBitrateController()
+	: min_bit_rate(0), max_bit_rate(0), max_decimation(1), frame_period_us(0), queue_limit(1),
+	avg_write_us(0.0), avg_encode_us(0.0), good_frames(0), cooldown(0),
+	bit_rate(0), decimation(1), decrease_count(0)
+{}
+
+KBitrateController::~KBitrateController()
+{}
+
+void KBitrateController::Reset(int64_t bit_rate, int64_t min_bit_rate, int64_t max_bit_rate,
+							int fps, int queue_limit, int max_decimation)
+{
+	if (fps < 1)
+		fps = 1;
+
+	this->min_bit_rate = std::min(min_bit_rate, max_bit_rate);
+	this->max_bit_rate = std::max(min_bit_rate, max_bit_rate);
+	this->max_decimation = std::max(1, max_decimation);
+	this->frame_period_us = 1000000 / fps;
+	this->queue_limit = std::max(1, queue_limit);
+
+	this->avg_write_us = 0.0;
+	this->avg_encode_us = 0.0;
+	this->good_frames = 0;
+	this->cooldown = 0;
+	this->bit_rate = std::max(this->min_bit_rate, std::min(bit_rate, this->max_bit_rate));
+	this->decimation = 1;
+	this->decrease_count = 0;
+}
+
+bool KBitrateController::Update(int64_t encode_us, int64_t write_us, int queue_depth)
+{
+	this->avg_write_us += (write_us - this->avg_write_us) * BITRATE_SMOOTHING;
+	this->avg_encode_us += (encode_us - this->avg_encode_us) * BITRATE_SMOOTHING;
+
+	// the send path may use half a frame period, encode and send together a whole one
+	bool congested = this->avg_write_us > this->frame_period_us / 2 ||
+					this->avg_write_us + this->avg_encode_us > this->frame_period_us ||
+					queue_depth >= this->queue_limit;
+
+	// give the encoder a few frames to react before judging again
+	if (this->cooldown > 0)
+	{
+		this->cooldown--;
+		return false;
+	}
+
+	int64_t old_bit_rate = this->bit_rate;
+	int old_decimation = this->decimation;
+
+	if (congested)
+	{
+		this->good_frames = 0;
+		if (old_bit_rate > this->min_bit_rate)
+			this->bit_rate = std::max(this->min_bit_rate, (int64_t)(old_bit_rate * BITRATE_DECREASE));
+		else if (old_decimation < this->max_decimation)
+			this->decimation = old_decimation + 1;
+
+		this->decrease_count++;
+		// wait about half a second
+		this->cooldown = (int)(500000 / this->frame_period_us) / this->decimation;
+	}
+	else if (++this->good_frames >= (int)(2000000 / this->frame_period_us) / this->decimation)
+	{
+		// two clean seconds, probe upwards
+		this->good_frames = 0;
+		if (old_decimation > 1)
+			this->decimation = old_decimation - 1;
+		else
+			this->bit_rate = std::min(this->max_bit_rate,
+							old_bit_rate + (int64_t)(this->max_bit_rate * BITRATE_INCREASE));
+	}
+
+	return this->bit_rate != old_bit_rate || this->decimation != old_decimation;
+}
+
+int64_t KBitrateController::GetBitRate()
+{
+	return this->bit_rate;
+}
+
+int KBitrateController::GetDecimation()
+{
+	return this->decimation;
+}
+
+uint64_t KBitrateController::GetDecreaseCount()
+{
+	return this->decrease_count;
+}
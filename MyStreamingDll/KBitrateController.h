@@ -0,0 +1,49 @@
+#ifndef _K_BITRATE_CONTROLLER_H_
+#define _K_BITRATE_CONTROLLER_H_
+
+#include <cstdint>
+#include <atomic>
+
+/*
+adapts the encoder bit rate to send backpressure.
+every encoded frame reports its write time, encode time and the number of frames waiting to be encoded.
+congestion cuts the bit rate multiplicatively, and below the minimum bit rate the frame rate is stepped down.
+a clean run of frames first restores the frame rate, then raises the bit rate additively.
+*/
+class KBitrateController
+{
+public:
+	KBitrateController();
+	~KBitrateController();
+
+private:
+	int64_t min_bit_rate;
+	int64_t max_bit_rate;
+	int max_decimation;
+	int64_t frame_period_us;
+	int queue_limit;
+	// smoothed measurements
+	double avg_write_us;
+	double avg_encode_us;
+	// state
+	int good_frames;
+	int cooldown;
+	std::atomic<int64_t> bit_rate;
+	std::atomic<int> decimation;
+	std::atomic<uint64_t> decrease_count;
+
+public:
+	/*
+	start from bit_rate within [min_bit_rate, max_bit_rate].
+	queue_limit is the number of waiting frames considered congested.
+	*/
+	void Reset(int64_t bit_rate, int64_t min_bit_rate, int64_t max_bit_rate,
+				int fps, int queue_limit, int max_decimation = 4);
+	// returns true if the bit rate or the decimation changed
+	bool Update(int64_t encode_us, int64_t write_us, int queue_depth);
+	int64_t GetBitRate();
+	int GetDecimation();
+	uint64_t GetDecreaseCount();
+};
+
+#endif
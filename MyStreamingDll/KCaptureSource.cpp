@@ -0,0 +1,63 @@
+#include "KCaptureSource.h"
+
+KCaptureSource::KCaptureSource(int device_id)
+	: device_id(device_id), path(), loop(false), video_cap(), frame_size(0, 0), frame_type(CV_8UC3)
+{}
+
+KCaptureSource::KCaptureSource(const std::string& path, bool loop)
+	: device_id(-1), path(path), loop(loop), video_cap(), frame_size(0, 0), frame_type(CV_8UC3)
+{}
+
+KCaptureSource::~KCaptureSource()
+{
+	Close();
+}
+
+bool KCaptureSource::Open()
+{
+	Close();
+
+	if (this->path.empty())
+		this->video_cap.open(this->device_id);
+	else
+		this->video_cap.open(this->path);
+
+	return this->video_cap.isOpened();
+}
+
+void KCaptureSource::Close()
+{
+	if (this->video_cap.isOpened())
+		this->video_cap.release();
+}
+
+enum KGrabResult KCaptureSource::Grab()
+{
+	if (this->video_cap.grab())
+		return KGrabResult::GRAB_FRAME;
+
+	// end of the file, start over
+	if (this->loop && !this->path.empty())
+	{
+		this->video_cap.release();
+		if (this->video_cap.open(this->path) && this->video_cap.grab())
+			return KGrabResult::GRAB_FRAME;
+	}
+
+	return KGrabResult::GRAB_END;
+}
+
+bool KCaptureSource::Retrieve(cv::Mat& cv_img, KFramePool& pool)
+{
+	if (this->frame_size.width > 0)
+		pool.Prepare(cv_img, this->frame_size.height, this->frame_size.width, this->frame_type);
+	this->video_cap.retrieve(cv_img);
+
+	// end of video stream
+	if (cv_img.empty())
+		return false;
+
+	this->frame_size = cv_img.size();
+	this->frame_type = cv_img.type();
+	return true;
+}
@@ -0,0 +1,38 @@
+#ifndef _K_CAPTURE_SOURCE_H_
+#define _K_CAPTURE_SOURCE_H_
+
+#include <string>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+#include <opencv2/highgui/highgui.hpp>
+
+#include "KFrameSource.h"
+
+/*
+frames from cv::VideoCapture: a camera index (V4L2 /dev/videoN on Linux, DirectShow on Windows),
+a video file or a stream url. a file can loop to run a benchmark for as long as needed.
+*/
+class K_STREAMING_API KCaptureSource : public KFrameSource
+{
+public:
+	KCaptureSource(int device_id);
+	KCaptureSource(const std::string& path, bool loop = false);
+	~KCaptureSource();
+
+private:
+	int device_id;
+	std::string path;
+	bool loop;
+	cv::VideoCapture video_cap;
+	// size of the previous frame, the next one is retrieved into a pooled buffer of that size
+	cv::Size frame_size;
+	int frame_type;
+
+public:
+	bool Open();
+	void Close();
+	enum KGrabResult Grab();
+	bool Retrieve(cv::Mat& cv_img, KFramePool& pool);
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include <cstdlib>
+#include "KChangeDetector.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DETECT_SSE2
+#include <emmintrin.h>
+#endif
+
+KChangeDetector::KChangeDetector()
+	: small_img(), luma(), reference(), block_threshold(6)
+{}
+
+KChangeDetector::~KChangeDetector()
+{}
+
+void KChangeDetector::SetThreshold(int block_threshold)
+{
+	this->block_threshold = block_threshold > 0 ? block_threshold : 0;
+}
+
+void KChangeDetector::Reset()
+{
+	this->reference.release();
+}
+
+double KChangeDetector::Compare(const cv::Mat& img, enum AVPixelFormat pix_fmt)
+{
+	make_luma(img, pix_fmt);
+	if (this->luma.empty())
+		return 1;
+	if (this->reference.size() != this->luma.size())
+		return 1;
+
+	int blocks = (this->luma.rows / DETECT_BLOCK) * (this->luma.cols / DETECT_BLOCK);
+	int sad_threshold = this->block_threshold * DETECT_BLOCK * DETECT_BLOCK;
+	return (double)count_changed_blocks(this->luma, this->reference, sad_threshold) / blocks;
+}
+
+void KChangeDetector::Accept()
+{
+	// the buffers trade places, neither is reallocated
+	cv::swap(this->reference, this->luma);
+}
+
+void KChangeDetector::make_luma(const cv::Mat& img, enum AVPixelFormat pix_fmt)
+{
+	bool is_i420 = pix_fmt == AV_PIX_FMT_YUV420P;
+	int height = is_i420 ? img.rows * 2 / 3 : img.rows;
+
+	// whole blocks only, the box filter still reads every pixel of the frame
+	cv::Size size((img.cols / DETECT_SCALE) & ~(DETECT_BLOCK - 1), (height / DETECT_SCALE) & ~(DETECT_BLOCK - 1));
+	if (size.width <= 0 || size.height <= 0)
+	{
+		this->luma.release();
+		return;
+	}
+
+	if (is_i420 || img.type() == CV_8UC1)
+	{
+		// the Y plane is the first rows of an I420 Mat
+		cv::resize(img.rowRange(0, height), this->luma, size, 0, 0, cv::INTER_AREA);
+		return;
+	}
+
+	// shrink first, the colour conversion then only touches the small image
+	cv::resize(img, this->small_img, size, 0, 0, cv::INTER_AREA);
+	cv::cvtColor(this->small_img, this->luma, img.type() == CV_8UC4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+}
+
+int KChangeDetector::count_changed_blocks(const cv::Mat& a, const cv::Mat& b, int sad_threshold)
+{
+	int changed = 0;
+	int block_cols = a.cols / DETECT_BLOCK;
+
+	for (int y = 0; y + DETECT_BLOCK <= a.rows; y += DETECT_BLOCK)
+	{
+		int bx = 0;
+#ifdef DETECT_SSE2
+		// psadbw sums each 8 byte half on its own: two neighbouring blocks per row load
+		for (; bx + 2 <= block_cols; bx += 2)
+		{
+			__m128i sum = _mm_setzero_si128();
+			for (int row = 0; row < DETECT_BLOCK; row++)
+			{
+				__m128i pa = _mm_loadu_si128((const __m128i*)(a.ptr(y + row) + bx * DETECT_BLOCK));
+				__m128i pb = _mm_loadu_si128((const __m128i*)(b.ptr(y + row) + bx * DETECT_BLOCK));
+				sum = _mm_add_epi64(sum, _mm_sad_epu8(pa, pb));
+			}
+			if (_mm_cvtsi128_si32(sum) > sad_threshold)
+				changed++;
+			if (_mm_cvtsi128_si32(_mm_srli_si128(sum, 8)) > sad_threshold)
+				changed++;
+		}
+#endif
+		for (; bx < block_cols; bx++)
+		{
+			int sad = 0;
+			for (int row = 0; row < DETECT_BLOCK; row++)
+			{
+				const uint8_t *pa = a.ptr(y + row) + bx * DETECT_BLOCK;
+				const uint8_t *pb = b.ptr(y + row) + bx * DETECT_BLOCK;
+				for (int x = 0; x < DETECT_BLOCK; x++)
+					sad += abs(pa[x] - pb[x]);
+			}
+			if (sad > sad_threshold)
+				changed++;
+		}
+	}
+
+	return changed;
+}
@@ -0,0 +1,70 @@
+#ifndef _K_CHANGE_DETECTOR_H_
+#define _K_CHANGE_DETECTOR_H_
+
+#include <cstdint>
+#include <atomic>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+// the luma is compared at 1/DETECT_SCALE of the frame size, in blocks of DETECT_BLOCK x DETECT_BLOCK
+#define DETECT_SCALE		8
+#define DETECT_BLOCK		8
+
+/*
+when a scene counts as static and what the stream still sends meanwhile.
+the defaults ignore sensor noise and compression artifacts but catch a person walking through a 1080p view.
+*/
+struct KChangeDetectConfig{
+	bool enabled;
+	int block_threshold;			// mean absolute luma difference of a block that counts as changed, 0-255
+	double changed_ratio;			// share of changed blocks that makes the frame changed, 0 = any block
+	int static_frames;				// unchanged frames before the scene counts as static
+	int idle_fps;					// frames still encoded per second while static, 0 = none
+	int keyframe_interval_ms;		// a keyframe at least this often while static, so late receivers can start
+	double idle_bit_rate_ratio;		// share of the bit rate while static, 1 keeps it. ignored with adaptive bit rate
+
+	KChangeDetectConfig()
+		: enabled(false), block_threshold(6), changed_ratio(0), static_frames(15),
+		idle_fps(1), keyframe_interval_ms(10000), idle_bit_rate_ratio(1)
+	{}
+};
+
+/*
+cheap change detection on a downsampled luma plane. the frame is box-filtered to 1/DETECT_SCALE of its size
+(from the Y plane of I420, from the image for BGR), then compared block by block with the reference
+using SAD (SSE2 psadbw, two blocks per instruction). the reference is the frame last accepted,
+usually the last encoded one, so a slow drift adds up until it counts as a change.
+*/
+class KChangeDetector
+{
+public:
+	KChangeDetector();
+	~KChangeDetector();
+
+private:
+	cv::Mat small_img;
+	cv::Mat luma;
+	cv::Mat reference;
+	std::atomic<int> block_threshold;
+
+	// luma of img at the detection size, into this->luma
+	void make_luma(const cv::Mat& img, enum AVPixelFormat pix_fmt);
+	// number of blocks whose SAD is above the threshold
+	static int count_changed_blocks(const cv::Mat& a, const cv::Mat& b, int sad_threshold);
+
+public:
+	void SetThreshold(int block_threshold);
+	// forget the reference, the next frame counts as changed
+	void Reset();
+	// share of changed blocks against the reference, 1 without a reference or after a size change
+	double Compare(const cv::Mat& img, enum AVPixelFormat pix_fmt);
+	// the frame of the last Compare becomes the reference
+	void Accept();
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include <thread>
+#include "KFramePacer.h"
+
+KFramePacer::KFramePacer()
+	: period(), next_deadline(), window_start(), window_frames(0),
+	target_fps(0), achieved_fps(0.0), last_lateness_us(0), max_lateness_us(0),
+	frame_count(0), skipped_slots(0)
+{}
+
+KFramePacer::~KFramePacer()
+{}
+
+void KFramePacer::Reset(int fps)
+{
+	if (fps < 1)
+		fps = 1;
+
+	this->period = std::chrono::duration_cast<clock::duration>(std::chrono::seconds(1)) / fps;
+	this->next_deadline = clock::now();
+	this->window_start = this->next_deadline;
+	this->window_frames = 0;
+
+	this->target_fps = fps;
+	this->achieved_fps = 0.0;
+	this->last_lateness_us = 0;
+	this->max_lateness_us = 0;
+	this->frame_count = 0;
+	this->skipped_slots = 0;
+}
+
+int64_t KFramePacer::WaitNextFrame()
+{
+	clock::time_point now = clock::now();
+
+	if (now < this->next_deadline)
+	{
+		std::this_thread::sleep_until(this->next_deadline);
+		now = clock::now();
+	}
+
+	clock::duration late = now - this->next_deadline;
+
+	// missed one or more whole slots, move on to the slot we are in
+	if (late >= this->period)
+	{
+		int64_t missed = late / this->period;
+		this->next_deadline += this->period * missed;
+		late -= this->period * missed;
+		this->skipped_slots += missed;
+	}
+	this->next_deadline += this->period;
+
+	int64_t lateness = std::chrono::duration_cast<std::chrono::microseconds>(late).count();
+	this->last_lateness_us = lateness;
+	if (lateness > this->max_lateness_us)
+		this->max_lateness_us = lateness;
+	this->frame_count++;
+
+	// achieved fps
+	this->window_frames++;
+	clock::duration window = now - this->window_start;
+	if (window >= std::chrono::seconds(1))
+	{
+		this->achieved_fps = this->window_frames /
+			std::chrono::duration_cast<std::chrono::duration<double> >(window).count();
+		this->window_start = now;
+		this->window_frames = 0;
+	}
+
+	return lateness;
+}
+
+int KFramePacer::GetTargetFps()
+{
+	return this->target_fps;
+}
+
+double KFramePacer::GetAchievedFps()
+{
+	return this->achieved_fps;
+}
+
+int64_t KFramePacer::GetLastLateness()
+{
+	return this->last_lateness_us;
+}
+
+int64_t KFramePacer::GetMaxLateness()
+{
+	return this->max_lateness_us;
+}
+
+uint64_t KFramePacer::GetFrameCount()
+{
+	return this->frame_count;
+}
+
+uint64_t KFramePacer::GetSkippedSlots()
+{
+	return this->skipped_slots;
+}
@@ -0,0 +1,51 @@
+#ifndef _K_FRAME_PACER_H_
+#define _K_FRAME_PACER_H_
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+/*
+paces a loop on absolute frame deadlines of a steady clock.
+deadlines are start + n * period, so time spent in the loop body never accumulates as drift.
+a frame that misses its slot by a whole period or more skips the missed slots instead of bursting.
+*/
+class KFramePacer
+{
+public:
+	KFramePacer();
+	~KFramePacer();
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	clock::duration period;
+	clock::time_point next_deadline;
+	// achieved fps is measured over windows of about one second
+	clock::time_point window_start;
+	int window_frames;
+	// stats, read from other threads
+	std::atomic<int> target_fps;
+	std::atomic<double> achieved_fps;
+	std::atomic<int64_t> last_lateness_us;
+	std::atomic<int64_t> max_lateness_us;
+	std::atomic<uint64_t> frame_count;
+	std::atomic<uint64_t> skipped_slots;
+
+public:
+	// restart the schedule from now
+	void Reset(int fps);
+	/*
+	sleep until the next frame slot.
+	returns how late this frame started against its deadline, in microseconds.
+	*/
+	int64_t WaitNextFrame();
+	int GetTargetFps();
+	double GetAchievedFps();
+	int64_t GetLastLateness();
+	int64_t GetMaxLateness();
+	uint64_t GetFrameCount();
+	uint64_t GetSkippedSlots();
+};
+
+#endif
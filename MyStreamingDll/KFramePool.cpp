@@ -0,0 +1,101 @@
+#include "KFramePool.h"
+
+KFramePool::KFramePool(int max_buffers)
+	: buffers(), max_buffers(max_buffers), allocation_count(0)
+{
+	this->buffers.reserve(max_buffers);
+}
+
+KFramePool::~KFramePool()
+{}
+
+int KFramePool::ref_count(const cv::Mat& img)
+{
+	// the counter is changed atomically by OpenCV, a stale read only makes a buffer look busy
+#if CV_MAJOR_VERSION < 3
+	return img.refcount ? *img.refcount : 0;
+#else
+	return img.u ? img.u->refcount : 0;
+#endif
+}
+
+bool KFramePool::is_pooled(const cv::Mat& img)
+{
+	for (size_t i = 0; i < this->buffers.size(); i++)
+	{
+		if (this->buffers[i].datastart == img.datastart)
+			return true;
+	}
+	return false;
+}
+
+void KFramePool::Reset(int max_buffers)
+{
+	std::lock_guard<std::mutex> lock(this->pool_lock);
+
+	if (max_buffers < 1)
+		max_buffers = 1;
+
+	// buffers still referenced elsewhere stay until they come back
+	std::vector<cv::Mat> kept;
+	kept.reserve(max_buffers);
+	for (size_t i = 0; i < this->buffers.size(); i++)
+	{
+		if (ref_count(this->buffers[i]) > 1)
+			kept.push_back(this->buffers[i]);
+	}
+	this->buffers.swap(kept);
+	this->max_buffers = max_buffers;
+}
+
+cv::Mat KFramePool::Acquire(int rows, int cols, int type)
+{
+	std::lock_guard<std::mutex> lock(this->pool_lock);
+
+	int replace = -1;
+	for (size_t i = 0; i < this->buffers.size(); i++)
+	{
+		cv::Mat& buf = this->buffers[i];
+		if (ref_count(buf) != 1)
+			continue;
+		if (buf.rows == rows && buf.cols == cols && buf.type() == type)
+			return buf;
+		if (replace < 0)
+			replace = (int)i;
+	}
+
+	this->allocation_count++;
+	if ((int)this->buffers.size() < this->max_buffers)
+	{
+		this->buffers.push_back(cv::Mat(rows, cols, type));
+		return this->buffers.back();
+	}
+
+	// the resolution changed, reuse the slot of a free buffer of the old size
+	if (replace >= 0)
+	{
+		this->buffers[replace].create(rows, cols, type);
+		return this->buffers[replace];
+	}
+
+	// every buffer is in use, this one is not kept
+	return cv::Mat(rows, cols, type);
+}
+
+void KFramePool::Prepare(cv::Mat& img, int rows, int cols, int type)
+{
+	if (!img.empty() && img.rows == rows && img.cols == cols && img.type() == type)
+	{
+		std::lock_guard<std::mutex> lock(this->pool_lock);
+		// one reference is the caller's, a pooled buffer has the pool's as well
+		if (ref_count(img) == (is_pooled(img) ? 2 : 1))
+			return;
+	}
+
+	img = Acquire(rows, cols, type);
+}
+
+uint64_t KFramePool::GetAllocationCount()
+{
+	return this->allocation_count;
+}
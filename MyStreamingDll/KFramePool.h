@@ -0,0 +1,52 @@
+#ifndef _K_FRAME_POOL_H_
+#define _K_FRAME_POOL_H_
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#include "KPlatform.h"
+
+// buffers kept per pool, enough for the frame ring plus the frames held by the sender and its conversions
+#define FRAME_POOL_SIZE		8
+
+/*
+fixed set of preallocated image buffers shared by reference counting.
+a buffer handed out by Acquire() stays referenced by the pool, it is free again as soon as
+every cv::Mat header pointing to it is released, so frames can be passed to other threads by header copy.
+buffers of another size or type are replaced only while free, at most max_buffers are kept.
+every buffer the pool had to allocate is counted, a steady stream stops allocating after warm-up.
+*/
+class K_STREAMING_API KFramePool
+{
+public:
+	KFramePool(int max_buffers = FRAME_POOL_SIZE);
+	~KFramePool();
+
+private:
+	std::mutex pool_lock;
+	std::vector<cv::Mat> buffers;
+	int max_buffers;
+	std::atomic<uint64_t> allocation_count;
+
+	// number of cv::Mat headers sharing the buffer, 0 for user-allocated data
+	static int ref_count(const cv::Mat& img);
+	bool is_pooled(const cv::Mat& img);
+
+public:
+	// drop the free buffers and keep at most max_buffers
+	void Reset(int max_buffers);
+	// a buffer of this size and type nobody else references
+	cv::Mat Acquire(int rows, int cols, int type);
+	/*
+	make img writable without allocating: keep it if it has this size and type and
+	no other header shares its buffer, otherwise replace it by a buffer from the pool.
+	*/
+	void Prepare(cv::Mat& img, int rows, int cols, int type);
+	uint64_t GetAllocationCount();
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include <thread>
+#include <chrono>
+#include "KFrameRing.h"
+
+KFrameRing::KFrameRing()
+	: slots(), times(), capacity(0), drop_policy(KFrameDropPolicy::DROP_OLDEST),
+	head(0), tail(0), reading(-1), is_closed(true),
+	pushed_count(0), dropped_count(0), waiters(0)
+{}
+
+KFrameRing::~KFrameRing()
+{
+	Close();
+}
+
+void KFrameRing::Reset(int capacity, enum KFrameDropPolicy drop_policy,
+						int img_width, int img_height, int img_type)
+{
+	if (capacity < 1)
+		capacity = 1;
+
+	this->slots.clear();
+	this->slots.resize(capacity + 1);
+	this->times.assign(capacity + 1, KFrameTime());
+	if (img_width > 0 && img_height > 0)
+	{
+		for (size_t i = 0; i < this->slots.size(); i++)
+			this->slots[i].create(img_height, img_width, img_type);
+	}
+
+	this->capacity = capacity;
+	this->drop_policy = drop_policy;
+	this->head = 0;
+	this->tail = 0;
+	this->reading = -1;
+	this->pushed_count = 0;
+	this->dropped_count = 0;
+	this->is_closed = false;
+}
+
+cv::Mat* KFrameRing::BeginPush()
+{
+	if (this->slots.empty())
+		return NULL;
+
+	uint64_t h = this->head.load(std::memory_order_relaxed);
+
+	// make room for the frame
+	while (true)
+	{
+		if (this->is_closed)
+			return NULL;
+
+		uint64_t t = this->tail.load();
+		if (h - t < (uint64_t)this->capacity)
+			break;
+
+		if (this->drop_policy == KFrameDropPolicy::DROP_OLDEST)
+		{
+			// consumer may take the same frame at the same time, only one of us wins
+			if (this->tail.compare_exchange_strong(t, t + 1))
+				this->dropped_count++;
+		}
+		else
+			wait_for_space();
+	}
+
+	// the consumer may still be swapping out a frame that lived in this slot
+	int slot = (int)(h % this->slots.size());
+	while (this->reading.load() == slot)
+		std::this_thread::yield();
+
+	return &this->slots[slot];
+}
+
+void KFrameRing::EndPush()
+{
+	EndPush(KFrameTime());
+}
+
+void KFrameRing::EndPush(const struct KFrameTime& time)
+{
+	this->times[this->head.load(std::memory_order_relaxed) % this->slots.size()] = time;
+	this->head.fetch_add(1);
+	this->pushed_count++;
+	notify_change();
+}
+
+bool KFrameRing::Pop(cv::Mat& cv_img, struct KFrameTime* time)
+{
+	if (this->slots.empty())
+		return false;
+
+	while (true)
+	{
+		uint64_t t = this->tail.load();
+		if (t == this->head.load())
+			return false;
+
+		// announce the slot before claiming it so the producer will not refill it under us
+		int slot = (int)(t % this->slots.size());
+		this->reading.store(slot);
+		if (this->tail.compare_exchange_strong(t, t + 1))
+		{
+			cv::swap(cv_img, this->slots[slot]);
+			if (time)
+				*time = this->times[slot];
+			this->reading.store(-1);
+			notify_change();
+			return true;
+		}
+		// dropped by the producer, try the next one
+		this->reading.store(-1);
+	}
+}
+
+bool KFrameRing::WaitPop(cv::Mat& cv_img, struct KFrameTime* time)
+{
+	while (true)
+	{
+		if (Pop(cv_img, time))
+			return true;
+		if (this->is_closed && Size() == 0)
+			return false;
+
+		wait_for_frame();
+	}
+}
+
+void KFrameRing::Close()
+{
+	this->is_closed = true;
+
+	std::lock_guard<std::mutex> lock(this->wait_lock);
+	this->wait_cond.notify_all();
+}
+
+bool KFrameRing::IsClosed()
+{
+	return this->is_closed;
+}
+
+int KFrameRing::Size()
+{
+	uint64_t t = this->tail.load();
+	uint64_t h = this->head.load();
+
+	return h > t ? (int)(h - t) : 0;
+}
+
+int KFrameRing::GetCapacity()
+{
+	return this->capacity;
+}
+
+uint64_t KFrameRing::GetPushedCount()
+{
+	return this->pushed_count;
+}
+
+uint64_t KFrameRing::GetDroppedCount()
+{
+	return this->dropped_count;
+}
+
+void KFrameRing::wait_for_frame()
+{
+	std::unique_lock<std::mutex> lock(this->wait_lock);
+	this->waiters++;
+	// re-check under the lock, the waker takes the same lock before notifying
+	if (Size() == 0 && !this->is_closed)
+		this->wait_cond.wait_for(lock, std::chrono::milliseconds(10));
+	this->waiters--;
+}
+
+void KFrameRing::wait_for_space()
+{
+	std::unique_lock<std::mutex> lock(this->wait_lock);
+	this->waiters++;
+	if (Size() >= this->capacity && !this->is_closed)
+		this->wait_cond.wait_for(lock, std::chrono::milliseconds(10));
+	this->waiters--;
+}
+
+void KFrameRing::notify_change()
+{
+	if (this->waiters.load() > 0)
+	{
+		std::lock_guard<std::mutex> lock(this->wait_lock);
+		this->wait_cond.notify_all();
+	}
+}
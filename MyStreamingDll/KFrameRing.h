@@ -0,0 +1,87 @@
+#ifndef _K_FRAME_RING_H_
+#define _K_FRAME_RING_H_
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+enum KFrameDropPolicy{
+	DROP_OLDEST = 0,
+	BLOCK = 1
+};
+
+// when a queued frame was taken and queued, in microseconds of the steady clock
+struct KFrameTime{
+	int64_t grab_us;
+	int64_t queued_us;
+};
+
+/*
+fixed-capacity single-producer/single-consumer ring of cv::Mat slots.
+the producer writes into the slot returned by BeginPush() and publishes it with EndPush(),
+the consumer takes the oldest frame with Pop()/WaitPop(), which swaps the slot with the caller's Mat
+so image buffers keep circulating between the ring and the consumer without reallocation.
+a KFrameTime travels with every frame.
+the frame path is lock-free, the mutex is only used to park a waiting thread.
+*/
+class KFrameRing
+{
+public:
+	KFrameRing();
+	~KFrameRing();
+
+private:
+	// capacity + 1 slots, the extra slot can be in use by the consumer during a swap
+	std::vector<cv::Mat> slots;
+	std::vector<struct KFrameTime> times;
+	int capacity;
+	enum KFrameDropPolicy drop_policy;
+	// head is written by the producer only, tail by the consumer (and by the producer when dropping)
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> tail;
+	// slot being swapped out by the consumer, -1 if none
+	std::atomic<int> reading;
+	std::atomic<bool> is_closed;
+	// counters
+	std::atomic<uint64_t> pushed_count;
+	std::atomic<uint64_t> dropped_count;
+	// parking for blocked producer/consumer
+	std::mutex wait_lock;
+	std::condition_variable wait_cond;
+	std::atomic<int> waiters;
+
+	void wait_for_frame();
+	void wait_for_space();
+	void notify_change();
+
+public:
+	/*
+	reallocate the ring. must not be called while a producer or consumer is running.
+	if width and height are given, every slot is preallocated with that size and type.
+	*/
+	void Reset(int capacity, enum KFrameDropPolicy drop_policy,
+				int img_width = 0, int img_height = 0, int img_type = CV_8UC3);
+	/*
+	get the slot for the next frame. returns NULL if the ring is closed.
+	when the ring is full, DROP_OLDEST discards the oldest queued frame and BLOCK waits for the consumer.
+	*/
+	cv::Mat* BeginPush();
+	void EndPush();
+	void EndPush(const struct KFrameTime& time);
+	// take the oldest frame, returns false if the ring is empty
+	bool Pop(cv::Mat& cv_img, struct KFrameTime* time = NULL);
+	// take the oldest frame, waits until a frame arrives. returns false if the ring is closed and empty
+	bool WaitPop(cv::Mat& cv_img, struct KFrameTime* time = NULL);
+	void Close();
+	bool IsClosed();
+	int Size();
+	int GetCapacity();
+	uint64_t GetPushedCount();
+	uint64_t GetDroppedCount();
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _K_FRAME_SOURCE_H_
+#define _K_FRAME_SOURCE_H_
+
+#include "KPlatform.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#include "KFramePool.h"
+
+enum KGrabResult{
+	GRAB_FRAME = 0,		// a frame is ready for Retrieve()
+	GRAB_RETRY = 1,		// nothing this time, try again on the next frame slot
+	GRAB_END = 2		// end of stream
+};
+
+/*
+where the capture thread of KStreamer gets its frames from.
+a frame is taken in two steps: Grab() waits until the next frame is available,
+then Retrieve() writes it into a frame ring slot, using buffers from the pool.
+splitting them lets a full ring drop its oldest frame only once the new one is ready.
+StartStream opens the source and EndStream closes it, a source can be opened again.
+*/
+class K_STREAMING_API KFrameSource
+{
+public:
+	virtual ~KFrameSource() {}
+
+	virtual bool Open() = 0;
+	virtual void Close() = 0;
+	virtual enum KGrabResult Grab() = 0;
+	// returns false if the grabbed frame could not be read, which ends the stream
+	virtual bool Retrieve(cv::Mat& cv_img, KFramePool& pool) = 0;
+	// AV_PIX_FMT_NONE for BGR, BGRA or gray Mats, AV_PIX_FMT_YUV420P for packed I420 Mats
+	virtual enum AVPixelFormat GetPixelFormat() { return AV_PIX_FMT_NONE; }
+	// pull sources are paced to the stream rate, push sources follow their producer
+	virtual bool NeedsPacing() { return true; }
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "KFrameTap.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+KFrameTap::KFrameTap(int id, const KTapCallback& callback, enum KTapFormat format,
+					int capacity, enum KFrameDropPolicy drop_policy)
+	: id(id), callback(callback), format(format), ring(), pix_fmt(AV_PIX_FMT_NONE), deliverer(NULL)
+{
+	this->ring.Reset(capacity, drop_policy);
+	this->deliverer = new std::thread(&KFrameTap::DeliverFrames, this);
+}
+
+KFrameTap::~KFrameTap()
+{
+	this->ring.Close();
+	if (this->deliverer)
+	{
+		this->deliverer->join();
+		delete this->deliverer;
+	}
+	this->deliverer = NULL;
+}
+
+int KFrameTap::GetID()
+{
+	return this->id;
+}
+
+enum KTapFormat KFrameTap::GetFormat()
+{
+	return this->format;
+}
+
+void KFrameTap::Push(const cv::Mat& img, enum AVPixelFormat pix_fmt, int64_t grab_us)
+{
+	cv::Mat* slot = this->ring.BeginPush();
+	if (!slot)
+		return;
+
+	// a header copy, the buffer is shared until the tap is done with it
+	*slot = img;
+	this->pix_fmt = pix_fmt;
+
+	struct KFrameTime frame_time;
+	frame_time.grab_us = grab_us;
+	frame_time.queued_us = grab_us;
+	this->ring.EndPush(frame_time);
+}
+
+void KFrameTap::DeliverFrames()
+{
+	struct KTapFrame frame;
+	struct KFrameTime frame_time;
+
+	while (this->ring.WaitPop(frame.img, &frame_time))
+	{
+		frame.pix_fmt = (enum AVPixelFormat)this->pix_fmt.load();
+		frame.grab_us = frame_time.grab_us;
+		this->callback(frame);
+
+		// the swap puts this header back in the ring, don't keep the buffer out of its pool there
+		frame.img.release();
+	}
+}
+
+uint64_t KFrameTap::GetDroppedCount()
+{
+	return this->ring.GetDroppedCount();
+}
+
+int KFrameTap::GetCapacity()
+{
+	return this->ring.GetCapacity();
+}
+
+KFrameTapSet::KFrameTapSet()
+	: taps(), tap_count(0), next_id(0)
+{}
+
+KFrameTapSet::~KFrameTapSet()
+{
+	Clear();
+}
+
+int KFrameTapSet::Subscribe(const KTapCallback& callback, enum KTapFormat format,
+							int capacity, enum KFrameDropPolicy drop_policy)
+{
+	if (!callback)
+		return -1;
+
+	std::lock_guard<std::mutex> lock(this->tap_lock);
+	int id = this->next_id++;
+	this->taps.push_back(new KFrameTap(id, callback, format, capacity, drop_policy));
+	this->tap_count = (int)this->taps.size();
+
+	return id;
+}
+
+bool KFrameTapSet::Unsubscribe(int tap_id)
+{
+	KFrameTap* tap = NULL;
+
+	this->tap_lock.lock();
+	for (size_t i = 0; i < this->taps.size(); i++)
+	{
+		if (this->taps[i]->GetID() == tap_id)
+		{
+			tap = this->taps[i];
+			this->taps.erase(this->taps.begin() + i);
+			break;
+		}
+	}
+	this->tap_count = (int)this->taps.size();
+	this->tap_lock.unlock();
+
+	if (!tap)
+		return false;
+
+	// outside the lock, the stream keeps publishing meanwhile
+	delete tap;
+	return true;
+}
+
+void KFrameTapSet::Clear()
+{
+	std::vector<KFrameTap*> removing;
+	this->tap_lock.lock();
+	removing.swap(this->taps);
+	this->tap_count = 0;
+	this->tap_lock.unlock();
+
+	for (size_t i = 0; i < removing.size(); i++)
+		delete removing[i];
+}
+
+bool KFrameTapSet::IsEmpty()
+{
+	return this->tap_count == 0;
+}
+
+int KFrameTapSet::GetQueuedCapacity()
+{
+	std::lock_guard<std::mutex> lock(this->tap_lock);
+	int capacity = 0;
+	for (size_t i = 0; i < this->taps.size(); i++)
+		capacity += this->taps[i]->GetCapacity();
+
+	return capacity;
+}
+
+uint64_t KFrameTapSet::GetDroppedCount(int tap_id)
+{
+	std::lock_guard<std::mutex> lock(this->tap_lock);
+	for (size_t i = 0; i < this->taps.size(); i++)
+	{
+		if (this->taps[i]->GetID() == tap_id)
+			return this->taps[i]->GetDroppedCount();
+	}
+
+	return 0;
+}
+
+void KFrameTapSet::Publish(const cv::Mat& img, enum AVPixelFormat pix_fmt, int64_t grab_us, KFramePool& pool)
+{
+	std::lock_guard<std::mutex> lock(this->tap_lock);
+	// conversions of this frame, pooled buffers shared by the taps of the format
+	cv::Mat bgr_img;
+	cv::Mat i420_img;
+	bool is_bgr_ready = false;
+	bool is_i420_ready = false;
+	enum AVPixelFormat bgr_fmt = AV_PIX_FMT_NONE;
+	enum AVPixelFormat i420_fmt = AV_PIX_FMT_NONE;
+
+	for (size_t i = 0; i < this->taps.size(); i++)
+	{
+		KFrameTap* tap = this->taps[i];
+		switch (tap->GetFormat())
+		{
+		case KTapFormat::TAP_FORMAT_BGR:
+			if (!is_bgr_ready)
+			{
+				is_bgr_ready = true;
+				if (!convert(img, pix_fmt, KTapFormat::TAP_FORMAT_BGR, pool, bgr_img, &bgr_fmt))
+					bgr_img.release();
+			}
+			if (!bgr_img.empty())
+				tap->Push(bgr_img, bgr_fmt, grab_us);
+			break;
+
+		case KTapFormat::TAP_FORMAT_I420:
+			if (!is_i420_ready)
+			{
+				is_i420_ready = true;
+				if (!convert(img, pix_fmt, KTapFormat::TAP_FORMAT_I420, pool, i420_img, &i420_fmt))
+					i420_img.release();
+			}
+			if (!i420_img.empty())
+				tap->Push(i420_img, i420_fmt, grab_us);
+			break;
+
+		default:
+			tap->Push(img, pix_fmt, grab_us);
+			break;
+		}
+	}
+}
+
+bool KFrameTapSet::convert(const cv::Mat& img, enum AVPixelFormat pix_fmt, enum KTapFormat format,
+							KFramePool& pool, cv::Mat& converted, enum AVPixelFormat* converted_fmt)
+{
+	bool is_i420 = pix_fmt == AV_PIX_FMT_YUV420P;
+
+	if (format == KTapFormat::TAP_FORMAT_BGR)
+	{
+		*converted_fmt = AV_PIX_FMT_BGR24;
+		int rows = is_i420 ? img.rows * 2 / 3 : img.rows;
+		int code;
+		if (is_i420)
+			code = cv::COLOR_YUV2BGR_I420;
+		else if (img.type() == CV_8UC4)
+			code = cv::COLOR_BGRA2BGR;
+		else if (img.type() == CV_8UC1)
+			code = cv::COLOR_GRAY2BGR;
+		else
+		{
+			// already BGR, share the frame itself
+			converted = img;
+			return img.type() == CV_8UC3;
+		}
+
+		// converted only when somebody listens
+		pool.Prepare(converted, rows, img.cols, CV_8UC3);
+		cv::cvtColor(img, converted, code);
+		return true;
+	}
+
+	*converted_fmt = AV_PIX_FMT_YUV420P;
+	if (is_i420)
+	{
+		converted = img;
+		return true;
+	}
+	// the chroma planes need an even size
+	if ((img.rows | img.cols) & 1)
+		return false;
+
+	int code;
+	if (img.type() == CV_8UC3)
+		code = cv::COLOR_BGR2YUV_I420;
+	else if (img.type() == CV_8UC4)
+		code = cv::COLOR_BGRA2YUV_I420;
+	else
+		return false;
+
+	pool.Prepare(converted, img.rows * 3 / 2, img.cols, CV_8UC1);
+	cv::cvtColor(img, converted, code);
+	return true;
+}
@@ -0,0 +1,109 @@
+#ifndef _K_FRAME_TAP_H_
+#define _K_FRAME_TAP_H_
+
+#include "KPlatform.h"
+
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#include "KFrameRing.h"
+#include "KFramePool.h"
+
+#define TAP_QUEUE_CAPACITY		2
+
+enum KTapFormat{
+	TAP_FORMAT_NATIVE = 0,		// as captured, no conversion
+	TAP_FORMAT_BGR = 1,			// CV_8UC3
+	TAP_FORMAT_I420 = 2			// packed CV_8UC1 of height * 3 / 2 rows, cv::COLOR_BGR2YUV_I420
+};
+
+/*
+a frame handed to a tap. the image shares its buffer with the stream and the other taps,
+read it only. copying the cv::Mat header keeps the buffer alive beyond the call.
+*/
+struct KTapFrame{
+	cv::Mat img;
+	enum AVPixelFormat pix_fmt;		// AV_PIX_FMT_NONE: given by the Mat type
+	int64_t grab_us;				// steady clock, microseconds
+};
+
+typedef std::function<void(const struct KTapFrame& frame)> KTapCallback;
+
+/*
+one subscriber of the sent frames. frames are queued by reference and delivered on a thread of the tap,
+so a slow consumer only ever loses its own frames: DROP_OLDEST skips to the newest ones,
+BLOCK holds up the stream until the tap has room.
+*/
+class KFrameTap
+{
+public:
+	KFrameTap(int id, const KTapCallback& callback, enum KTapFormat format,
+			int capacity, enum KFrameDropPolicy drop_policy);
+	~KFrameTap();
+
+private:
+	int id;
+	KTapCallback callback;
+	enum KTapFormat format;
+	KFrameRing ring;
+	std::atomic<int> pix_fmt;
+	std::thread* deliverer;
+
+	// tap thread
+	void DeliverFrames();
+
+public:
+	int GetID();
+	enum KTapFormat GetFormat();
+	// queue a reference to the frame, pix_fmt is the format of img
+	void Push(const cv::Mat& img, enum AVPixelFormat pix_fmt, int64_t grab_us);
+	uint64_t GetDroppedCount();
+	int GetCapacity();
+};
+
+/*
+the taps of one stream. every frame is converted at most once per format, whatever the number of taps,
+and only if some tap asked for a format other than the captured one.
+*/
+class KFrameTapSet
+{
+public:
+	KFrameTapSet();
+	~KFrameTapSet();
+
+private:
+	std::mutex tap_lock;
+	std::vector<KFrameTap*> taps;
+	std::atomic<int> tap_count;
+	int next_id;
+
+	// img converted to format, or img itself. false if the conversion is not supported
+	bool convert(const cv::Mat& img, enum AVPixelFormat pix_fmt, enum KTapFormat format,
+				KFramePool& pool, cv::Mat& converted, enum AVPixelFormat* converted_fmt);
+
+public:
+	int Subscribe(const KTapCallback& callback, enum KTapFormat format = KTapFormat::TAP_FORMAT_NATIVE,
+				int capacity = TAP_QUEUE_CAPACITY, enum KFrameDropPolicy drop_policy = KFrameDropPolicy::DROP_OLDEST);
+	// waits for the frame being delivered, frames still queued are dropped. not from the tap's own callback
+	bool Unsubscribe(int tap_id);
+	void Clear();
+	bool IsEmpty();
+	// frames the taps may hold at once, for sizing the frame pool
+	int GetQueuedCapacity();
+	uint64_t GetDroppedCount(int tap_id);
+	// hand a sent frame to every tap, called by the sending thread
+	void Publish(const cv::Mat& img, enum AVPixelFormat pix_fmt, int64_t grab_us, KFramePool& pool);
+};
+
+#endif
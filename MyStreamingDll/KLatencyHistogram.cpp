@@ -0,0 +1,131 @@
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "KLatencyHistogram.h"
+
+#define HISTOGRAM_SUB_COUNT		(1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_HALF_COUNT	(1 << (HISTOGRAM_SUB_BITS - 1))
+#define HISTOGRAM_MAX_VALUE		((UINT64_C(1) << HISTOGRAM_MAX_BITS) - 1)
+
+static int floor_log2(uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long msb;
+	_BitScanReverse64(&msb, value);
+	return (int)msb;
+#elif defined(__GNUC__)
+	return 63 - __builtin_clzll(value);
+#else
+	int msb = 0;
+	while (value >>= 1)
+		msb++;
+	return msb;
+#endif
+}
+
+KLatencyHistogram::KLatencyHistogram()
+{
+	Reset();
+}
+
+KLatencyHistogram::~KLatencyHistogram()
+{}
+
+int KLatencyHistogram::bucket_index(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_COUNT)
+		return (int)value;
+
+	// keep the top HISTOGRAM_SUB_BITS bits, the shift selects the power of two
+	int shift = floor_log2(value) - (HISTOGRAM_SUB_BITS - 1);
+	return shift * HISTOGRAM_HALF_COUNT + (int)(value >> shift);
+}
+
+uint64_t KLatencyHistogram::bucket_value(int index)
+{
+	if (index < HISTOGRAM_SUB_COUNT)
+		return (uint64_t)index;
+
+	int shift = index / HISTOGRAM_HALF_COUNT - 1;
+	uint64_t sub = (uint64_t)(index - shift * HISTOGRAM_HALF_COUNT);
+	return ((sub + 1) << shift) - 1;
+}
+
+void KLatencyHistogram::Reset()
+{
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		this->counts[i].store(0, std::memory_order_relaxed);
+	this->total_count = 0;
+	this->total_sum = 0;
+	this->min_value = UINT64_MAX;
+	this->max_value = 0;
+}
+
+void KLatencyHistogram::Record(int64_t value_us)
+{
+	uint64_t value = value_us > 0 ? (uint64_t)value_us : 0;
+	if (value > HISTOGRAM_MAX_VALUE)
+		value = HISTOGRAM_MAX_VALUE;
+
+	this->counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+	this->total_count.fetch_add(1, std::memory_order_relaxed);
+	this->total_sum.fetch_add(value, std::memory_order_relaxed);
+
+	uint64_t min = this->min_value.load(std::memory_order_relaxed);
+	while (value < min && !this->min_value.compare_exchange_weak(min, value, std::memory_order_relaxed))
+		;
+	uint64_t max = this->max_value.load(std::memory_order_relaxed);
+	while (value > max && !this->max_value.compare_exchange_weak(max, value, std::memory_order_relaxed))
+		;
+}
+
+uint64_t KLatencyHistogram::GetCount()
+{
+	return this->total_count.load(std::memory_order_relaxed);
+}
+
+struct KStageStats KLatencyHistogram::GetStats()
+{
+	struct KStageStats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	// the percentiles are taken from one pass over a copy of the buckets
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t count = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		counts[i] = this->counts[i].load(std::memory_order_relaxed);
+		count += counts[i];
+	}
+	if (count == 0)
+		return stats;
+
+	uint64_t max = this->max_value.load(std::memory_order_relaxed);
+	uint64_t min = std::min(this->min_value.load(std::memory_order_relaxed), max);
+	uint64_t recorded = std::max<uint64_t>(this->total_count.load(std::memory_order_relaxed), 1);
+
+	stats.count = count;
+	stats.mean_us = (double)this->total_sum.load(std::memory_order_relaxed) / recorded;
+	stats.min_us = (int64_t)min;
+	stats.max_us = (int64_t)max;
+
+	const double percentiles[] = { 0.50, 0.90, 0.99, 0.999 };
+	int64_t* targets[] = { &stats.p50_us, &stats.p90_us, &stats.p99_us, &stats.p999_us };
+	int next = 0;
+	uint64_t seen = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS && next < 4; i++)
+	{
+		seen += counts[i];
+		// the rank of a percentile is the smallest sample count reaching it
+		while (next < 4 && seen >= std::max<uint64_t>((uint64_t)std::ceil(percentiles[next] * count), 1))
+		{
+			*targets[next] = (int64_t)std::min(bucket_value(i), max);
+			next++;
+		}
+	}
+
+	return stats;
+}
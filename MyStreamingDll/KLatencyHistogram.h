@@ -0,0 +1,55 @@
+#ifndef _K_LATENCY_HISTOGRAM_H_
+#define _K_LATENCY_HISTOGRAM_H_
+
+#include <cstdint>
+#include <atomic>
+
+// linear up to 2^HISTOGRAM_SUB_BITS us, then 2^(HISTOGRAM_SUB_BITS-1) buckets per power of two (about 3% resolution)
+#define HISTOGRAM_SUB_BITS		6
+// largest value kept, 2^36 us is about 19 hours
+#define HISTOGRAM_MAX_BITS		36
+#define HISTOGRAM_BUCKETS		((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2) << (HISTOGRAM_SUB_BITS - 1))
+
+// distribution of one stage, in microseconds
+struct KStageStats{
+	uint64_t count;
+	double mean_us;
+	int64_t min_us;
+	int64_t p50_us;
+	int64_t p90_us;
+	int64_t p99_us;
+	int64_t p999_us;
+	int64_t max_us;
+};
+
+/*
+HDR-style histogram of durations with a fixed set of log-linear buckets.
+Record() is a few relaxed atomic adds, so any number of threads record while others read.
+percentiles report the highest value of their bucket, never more than the recorded maximum.
+a snapshot taken while recording may miss the samples being added, never tears a bucket.
+*/
+class KLatencyHistogram
+{
+public:
+	KLatencyHistogram();
+	~KLatencyHistogram();
+
+private:
+	std::atomic<uint64_t> counts[HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> total_count;
+	std::atomic<uint64_t> total_sum;
+	std::atomic<uint64_t> min_value;
+	std::atomic<uint64_t> max_value;
+
+	static int bucket_index(uint64_t value);
+	// highest value that falls into the bucket
+	static uint64_t bucket_value(int index);
+
+public:
+	void Reset();
+	void Record(int64_t value_us);
+	uint64_t GetCount();
+	struct KStageStats GetStats();
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "KMappedFile.h"
+
+KMappedFile::KMappedFile()
+	: path(), data(NULL), size(0), is_created(false),
+#ifdef _WIN32
+	file(INVALID_HANDLE_VALUE), mapping(NULL)
+#else
+	fd(-1)
+#endif
+{}
+
+KMappedFile::~KMappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+bool KMappedFile::Open(const std::string& path, size_t size)
+{
+	Close();
+	if (size == 0)
+		return false;
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+							OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	this->file = file;
+
+	LARGE_INTEGER current;
+	LARGE_INTEGER wanted;
+	wanted.QuadPart = (LONGLONG)size;
+	this->is_created = !GetFileSizeEx(file, &current) || current.QuadPart != wanted.QuadPart;
+	if (this->is_created && (!SetFilePointerEx(file, wanted, NULL, FILE_BEGIN) || !SetEndOfFile(file)))
+	{
+		Close();
+		return false;
+	}
+
+	this->mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+	if (!this->mapping)
+	{
+		Close();
+		return false;
+	}
+	this->data = (uint8_t*)MapViewOfFile(this->mapping, FILE_MAP_WRITE, 0, 0, size);
+	if (!this->data)
+	{
+		Close();
+		return false;
+	}
+
+	this->path = path;
+	this->size = size;
+	return true;
+}
+
+void KMappedFile::Close()
+{
+	if (this->data)
+	{
+		FlushViewOfFile(this->data, 0);
+		UnmapViewOfFile(this->data);
+	}
+	if (this->mapping)
+		CloseHandle(this->mapping);
+	if (this->file != INVALID_HANDLE_VALUE)
+		CloseHandle(this->file);
+
+	this->data = NULL;
+	this->mapping = NULL;
+	this->file = INVALID_HANDLE_VALUE;
+	this->size = 0;
+}
+
+void KMappedFile::Flush(bool wait)
+{
+	if (!this->data)
+		return;
+
+	FlushViewOfFile(this->data, 0);
+	if (wait)
+		FlushFileBuffers(this->file);
+}
+#else
+bool KMappedFile::Open(const std::string& path, size_t size)
+{
+	Close();
+	if (size == 0)
+		return false;
+
+	this->fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (this->fd < 0)
+		return false;
+
+	struct stat st;
+	this->is_created = fstat(this->fd, &st) != 0 || (size_t)st.st_size != size;
+	if (this->is_created && ftruncate(this->fd, (off_t)size) != 0)
+	{
+		Close();
+		return false;
+	}
+#ifdef __linux__
+	// reserve the blocks now, a sparse file would allocate them on the first write of each page
+	if (posix_fallocate(this->fd, 0, (off_t)size) != 0)
+	{
+		Close();
+		return false;
+	}
+#endif
+
+	void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+	if (mapped == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	this->data = (uint8_t*)mapped;
+	this->path = path;
+	this->size = size;
+	return true;
+}
+
+void KMappedFile::Close()
+{
+	if (this->data)
+	{
+		msync(this->data, this->size, MS_ASYNC);
+		munmap(this->data, this->size);
+	}
+	if (this->fd >= 0)
+		close(this->fd);
+
+	this->data = NULL;
+	this->fd = -1;
+	this->size = 0;
+}
+
+void KMappedFile::Flush(bool wait)
+{
+	if (this->data)
+		msync(this->data, this->size, wait ? MS_SYNC : MS_ASYNC);
+}
+#endif
+
+bool KMappedFile::IsOpen()
+{
+	return this->data != NULL;
+}
+
+bool KMappedFile::IsCreated()
+{
+	return this->is_created;
+}
+
+uint8_t* KMappedFile::GetData()
+{
+	return this->data;
+}
+
+size_t KMappedFile::GetSize()
+{
+	return this->size;
+}
+
+const std::string& KMappedFile::GetPath()
+{
+	return this->path;
+}
@@ -0,0 +1,43 @@
+#ifndef _K_MAPPED_FILE_H_
+#define _K_MAPPED_FILE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/*
+a file of fixed size mapped read-write into memory. Open allocates the whole file on disk up front,
+so writing through the mapping never extends the file or allocates blocks.
+*/
+class KMappedFile
+{
+public:
+	KMappedFile();
+	~KMappedFile();
+
+private:
+	std::string path;
+	uint8_t* data;
+	size_t size;
+	bool is_created;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int fd;
+#endif
+
+public:
+	// create the file or bring it to size, then map it. is_created tells whether it had to be resized
+	bool Open(const std::string& path, size_t size);
+	void Close();
+	bool IsOpen();
+	bool IsCreated();
+	uint8_t* GetData();
+	size_t GetSize();
+	const std::string& GetPath();
+	// write dirty pages back, asynchronous unless wait
+	void Flush(bool wait = false);
+};
+
+#endif
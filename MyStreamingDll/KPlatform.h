@@ -0,0 +1,30 @@
+#ifndef _K_PLATFORM_H_
+#define _K_PLATFORM_H_
+
+// dll exports on Windows, default visibility of the shared library elsewhere
+#ifdef _WIN32
+#ifdef KSTREAMINGDLL_EXPORTS
+#define K_STREAMING_API __declspec(dllexport)
+#define MY_FFMPEG_API __declspec(dllexport)
+#else
+#define K_STREAMING_API __declspec(dllimport)
+#define MY_FFMPEG_API __declspec(dllimport)
+#endif
+#else
+#define K_STREAMING_API __attribute__((visibility("default")))
+#define MY_FFMPEG_API __attribute__((visibility("default")))
+#endif
+
+// the library is built with the ZED SDK unless K_STREAMING_NO_ZED is defined
+#if defined(KSTREAMINGDLL_EXPORTS) && !defined(K_STREAMING_NO_ZED)
+#define K_STREAMING_ZED
+#endif
+
+// SAL annotation for MSVC, other compilers' standard headers use __in as a name
+#ifdef _MSC_VER
+#define K_IN __in
+#else
+#define K_IN
+#endif
+
+#endif
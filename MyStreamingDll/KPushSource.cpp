@@ -0,0 +1,88 @@
+#include <chrono>
+#include "KPushSource.h"
+
+KPushSource::KPushSource(enum AVPixelFormat pix_fmt)
+	: pix_fmt(pix_fmt), pending(), is_open(false), replaced_count(0)
+{}
+
+KPushSource::~KPushSource()
+{
+	Close();
+}
+
+bool KPushSource::Push(const cv::Mat& cv_img)
+{
+	if (cv_img.empty())
+		return false;
+
+	std::unique_lock<std::mutex> lock(this->push_lock);
+	if (!this->is_open)
+		return false;
+
+	if (!this->pending.empty())
+		this->replaced_count++;
+	this->pending = cv_img;
+	lock.unlock();
+
+	this->push_cond.notify_one();
+	return true;
+}
+
+uint64_t KPushSource::GetReplacedCount()
+{
+	return this->replaced_count;
+}
+
+bool KPushSource::Open()
+{
+	std::lock_guard<std::mutex> lock(this->push_lock);
+	this->pending.release();
+	this->is_open = true;
+	this->replaced_count = 0;
+	return true;
+}
+
+void KPushSource::Close()
+{
+	std::unique_lock<std::mutex> lock(this->push_lock);
+	this->is_open = false;
+	this->pending.release();
+	lock.unlock();
+
+	this->push_cond.notify_all();
+}
+
+enum KGrabResult KPushSource::Grab()
+{
+	std::unique_lock<std::mutex> lock(this->push_lock);
+	this->push_cond.wait_for(lock, std::chrono::milliseconds(PUSH_WAIT_MS),
+							[this] { return !this->pending.empty() || !this->is_open; });
+
+	if (!this->is_open)
+		return KGrabResult::GRAB_END;
+	if (this->pending.empty())
+		return KGrabResult::GRAB_RETRY;
+	return KGrabResult::GRAB_FRAME;
+}
+
+bool KPushSource::Retrieve(cv::Mat& cv_img, KFramePool& pool)
+{
+	std::lock_guard<std::mutex> lock(this->push_lock);
+	if (this->pending.empty())
+		return false;
+
+	// the slot takes over the pushed buffer, its own buffer goes back to the pool
+	cv_img = this->pending;
+	this->pending.release();
+	return true;
+}
+
+enum AVPixelFormat KPushSource::GetPixelFormat()
+{
+	return this->pix_fmt;
+}
+
+bool KPushSource::NeedsPacing()
+{
+	return false;
+}
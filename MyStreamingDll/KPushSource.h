@@ -0,0 +1,52 @@
+#ifndef _K_PUSH_SOURCE_H_
+#define _K_PUSH_SOURCE_H_
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#include "KFrameSource.h"
+
+// how long the capture thread waits for a pushed frame before checking for EndStream
+#define PUSH_WAIT_MS	100
+
+/*
+frames pushed by the application from its own thread, e.g. images it renders or receives.
+unlike SendFrameManually the caller does not wait for the encoder: the frame goes through the
+frame ring, and a frame not yet taken by the capture thread is replaced by a newer one.
+*/
+class K_STREAMING_API KPushSource : public KFrameSource
+{
+public:
+	// AV_PIX_FMT_YUV420P if packed I420 Mats are pushed
+	KPushSource(enum AVPixelFormat pix_fmt = AV_PIX_FMT_NONE);
+	~KPushSource();
+
+private:
+	enum AVPixelFormat pix_fmt;
+	std::mutex push_lock;
+	std::condition_variable push_cond;
+	cv::Mat pending;
+	bool is_open;
+	std::atomic<uint64_t> replaced_count;
+
+public:
+	/*
+	hand over a frame. the buffer is referenced, not copied, so do not write into it afterwards.
+	returns false if the source is not streaming.
+	*/
+	bool Push(const cv::Mat& cv_img);
+	uint64_t GetReplacedCount();
+
+	bool Open();
+	void Close();
+	enum KGrabResult Grab();
+	bool Retrieve(cv::Mat& cv_img, KFramePool& pool);
+	enum AVPixelFormat GetPixelFormat();
+	bool NeedsPacing();
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "KRawYUVSource.h"
+
+KRawYUVSource::KRawYUVSource(const std::string& path, int width, int height, bool loop, enum KYUVLayout layout)
+	: path(path), width(width), height(height), loop(loop), layout(layout), file(),
+	file_size(0), frame_bytes(KYUVConverter::GetFrameBytes(layout, width, height)), position(0), raw_frame()
+{}
+
+KRawYUVSource::~KRawYUVSource()
+{
+	Close();
+}
+
+bool KRawYUVSource::Open()
+{
+	Close();
+
+	if (this->width < 2 || this->height < 2 || this->width % 2 || this->height % 2)
+		return false;
+
+	this->file.open(this->path.c_str(), std::ios::in | std::ios::binary);
+	if (!this->file.is_open())
+		return false;
+
+	this->file.seekg(0, std::ios::end);
+	this->file_size = (int64_t)this->file.tellg();
+	this->file.seekg(0, std::ios::beg);
+	this->position = 0;
+
+	return this->file_size >= this->frame_bytes;
+}
+
+void KRawYUVSource::Close()
+{
+	if (this->file.is_open())
+		this->file.close();
+}
+
+enum KGrabResult KRawYUVSource::Grab()
+{
+	if (this->position + this->frame_bytes <= this->file_size)
+		return KGrabResult::GRAB_FRAME;
+
+	// a partial frame at the end is ignored
+	if (!this->loop)
+		return KGrabResult::GRAB_END;
+
+	this->file.clear();
+	this->file.seekg(0, std::ios::beg);
+	this->position = 0;
+	return KGrabResult::GRAB_FRAME;
+}
+
+bool KRawYUVSource::Retrieve(cv::Mat& cv_img, KFramePool& pool)
+{
+	pool.Prepare(cv_img, this->height * 3 / 2, this->width, CV_8UC1);
+
+	if (this->layout == KYUVLayout::YUV_LAYOUT_I420)
+	{
+		if (!this->file.read((char *)cv_img.data, this->frame_bytes))
+			return false;
+	}
+	else
+	{
+		this->raw_frame.resize((size_t)this->frame_bytes);
+		if (!this->file.read((char *)this->raw_frame.data(), this->frame_bytes))
+			return false;
+		int stride = this->layout == KYUVLayout::YUV_LAYOUT_YUYV ? this->width * 2 : this->width;
+		KYUVConverter::ToI420(this->layout, this->raw_frame.data(), stride, this->width, this->height, cv_img);
+	}
+
+	this->position += this->frame_bytes;
+	return true;
+}
+
+enum AVPixelFormat KRawYUVSource::GetPixelFormat()
+{
+	return AV_PIX_FMT_YUV420P;
+}
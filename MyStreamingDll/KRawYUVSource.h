@@ -0,0 +1,48 @@
+#ifndef _K_RAW_YUV_SOURCE_H_
+#define _K_RAW_YUV_SOURCE_H_
+
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <vector>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#include "KFrameSource.h"
+#include "KYUVConverter.h"
+
+/*
+frames from a raw planar I420 (yuv420p) file, as written by "ffmpeg -pix_fmt yuv420p out.yuv".
+every frame is read straight into a pooled I420 Mat and goes to the encoder without conversion.
+YUYV (yuyv422) and NV12 files, e.g. dumped from a V4L2 camera, are reordered into I420 the way KV4L2Source does.
+*/
+class K_STREAMING_API KRawYUVSource : public KFrameSource
+{
+public:
+	// width and height must be even
+	KRawYUVSource(const std::string& path, int width, int height, bool loop = true,
+				enum KYUVLayout layout = YUV_LAYOUT_I420);
+	~KRawYUVSource();
+
+private:
+	std::string path;
+	int width;
+	int height;
+	bool loop;
+	enum KYUVLayout layout;
+	std::ifstream file;
+	int64_t file_size;
+	int64_t frame_bytes;
+	int64_t position;
+	// a YUYV or NV12 frame as read from the file
+	std::vector<uint8_t> raw_frame;
+
+public:
+	bool Open();
+	void Close();
+	enum KGrabResult Grab();
+	bool Retrieve(cv::Mat& cv_img, KFramePool& pool);
+	enum AVPixelFormat GetPixelFormat();
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cstring>
+#include "KRenditionSet.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+KRenditionSet::KRenditionSet()
+	: renditions(), next_id(0), last_error(MyFFMPEGStreamerError::NO_FFMPEG_ERROR), crop_img()
+{}
+
+KRenditionSet::~KRenditionSet()
+{
+	Clear();
+}
+
+cv::Size KRenditionSet::GetScaledSize(cv::Size frame_size, int level)
+{
+	return cv::Size((frame_size.width >> level) & ~1, (frame_size.height >> level) & ~1);
+}
+
+int KRenditionSet::Add(std::string name, enum KRenditionScale scale, const MyFFMPEGEncoderConfig& config, std::string ip, int port)
+{
+	if (scale < KRenditionScale::RENDITION_FULL || scale > RENDITION_MAX_LEVEL)
+		return -1;
+
+	struct KRendition* rendition = new KRendition();
+	rendition->name = name;
+	rendition->level = scale;
+
+	return add(rendition, config, ip, port);
+}
+
+int KRenditionSet::AddCrop(std::string name, cv::Rect roi, const MyFFMPEGEncoderConfig& config, std::string ip, int port)
+{
+	// I420 chroma covers 2x2 pixels, keep the region on that grid
+	roi.x &= ~1;
+	roi.y &= ~1;
+	roi.width &= ~1;
+	roi.height &= ~1;
+	if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0)
+		return -1;
+
+	struct KRendition* rendition = new KRendition();
+	rendition->name = name;
+	rendition->level = -1;
+	rendition->crop = roi;
+
+	return add(rendition, config, ip, port);
+}
+
+int KRenditionSet::add(struct KRendition* rendition, const MyFFMPEGEncoderConfig& config, std::string ip, int port)
+{
+	// opening the encoder and its output may take a while, frames keep flowing meanwhile
+	rendition->ffmpeg = new MyFFMPEGStreamer();
+	if (!rendition->ffmpeg->Initialize(config, ip, port))
+	{
+		this->last_error = rendition->ffmpeg->GetLastError();
+		delete rendition->ffmpeg;
+		delete rendition;
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> lock(this->rendition_lock);
+	rendition->id = this->next_id++;
+	this->renditions.push_back(rendition);
+
+	return rendition->id;
+}
+
+bool KRenditionSet::Remove(int rendition_id)
+{
+	struct KRendition* rendition = NULL;
+
+	this->rendition_lock.lock();
+	for (size_t i = 0; i < this->renditions.size(); i++)
+	{
+		if (this->renditions[i]->id == rendition_id)
+		{
+			rendition = this->renditions[i];
+			this->renditions.erase(this->renditions.begin() + i);
+			break;
+		}
+	}
+	this->rendition_lock.unlock();
+
+	if (!rendition)
+		return false;
+
+	// Deinitialize drains the encoder before closing the outputs
+	delete rendition->ffmpeg;
+	delete rendition;
+	return true;
+}
+
+void KRenditionSet::Clear()
+{
+	std::vector<struct KRendition*> removing;
+	this->rendition_lock.lock();
+	removing.swap(this->renditions);
+	this->rendition_lock.unlock();
+
+	for (size_t i = 0; i < removing.size(); i++)
+	{
+		delete removing[i]->ffmpeg;
+		delete removing[i];
+	}
+}
+
+int KRenditionSet::Find(std::string name)
+{
+	std::lock_guard<std::mutex> lock(this->rendition_lock);
+	for (size_t i = 0; i < this->renditions.size(); i++)
+	{
+		if (this->renditions[i]->name == name)
+			return this->renditions[i]->id;
+	}
+
+	return -1;
+}
+
+int KRenditionSet::GetCount()
+{
+	std::lock_guard<std::mutex> lock(this->rendition_lock);
+	return (int)this->renditions.size();
+}
+
+struct KStreamStats KRenditionSet::GetStats(int rendition_id)
+{
+	std::lock_guard<std::mutex> lock(this->rendition_lock);
+	for (size_t i = 0; i < this->renditions.size(); i++)
+	{
+		if (this->renditions[i]->id == rendition_id)
+			return this->renditions[i]->ffmpeg->GetStats();
+	}
+
+	struct KStreamStats stats;
+	memset(&stats, 0, sizeof(stats));
+	return stats;
+}
+
+void KRenditionSet::RequestKeyframe()
+{
+	std::lock_guard<std::mutex> lock(this->rendition_lock);
+	for (size_t i = 0; i < this->renditions.size(); i++)
+		this->renditions[i]->ffmpeg->RequestKeyframe();
+}
+
+bool KRenditionSet::StreamImage(const cv::Mat& cv_img, enum AVPixelFormat pix_fmt)
+{
+	std::lock_guard<std::mutex> lock(this->rendition_lock);
+	if (this->renditions.empty())
+		return true;
+
+	bool is_i420 = pix_fmt == AV_PIX_FMT_YUV420P;
+	cv::Size frame_size(cv_img.cols, is_i420 ? cv_img.rows * 2 / 3 : cv_img.rows);
+
+	// only as deep as the smallest rendition
+	int max_level = 0;
+	for (size_t i = 0; i < this->renditions.size(); i++)
+		max_level = std::max(max_level, this->renditions[i]->level);
+
+	this->levels[0] = cv_img;
+	for (int level = 1; level <= max_level; level++)
+		downscale(this->levels[level - 1], this->levels[level], pix_fmt);
+
+	bool is_sent = true;
+	for (size_t i = 0; i < this->renditions.size(); i++)
+	{
+		struct KRendition* rendition = this->renditions[i];
+		const cv::Mat* img = &this->levels[std::max(rendition->level, 0)];
+
+		if (rendition->level < 0)
+		{
+			cv::Rect roi = rendition->crop & cv::Rect(0, 0, frame_size.width & ~1, frame_size.height & ~1);
+			if (roi.width <= 0 || roi.height <= 0)
+				continue;
+
+			if (is_i420)
+			{
+				crop_i420(cv_img, roi, this->crop_img);
+				img = &this->crop_img;
+			}
+			else
+			{
+				// a view, the encoder reads padded rows
+				this->crop_img = cv_img(roi);
+				img = &this->crop_img;
+			}
+		}
+
+		if (!rendition->ffmpeg->StreamImage(*img, false, pix_fmt))
+		{
+			this->last_error = rendition->ffmpeg->GetLastError();
+			is_sent = false;
+		}
+	}
+	// don't keep the caller's frame out of its pool
+	this->levels[0].release();
+	if (!is_i420)
+		this->crop_img.release();
+
+	return is_sent;
+}
+
+void KRenditionSet::SkipFrame()
+{
+	std::lock_guard<std::mutex> lock(this->rendition_lock);
+	for (size_t i = 0; i < this->renditions.size(); i++)
+		this->renditions[i]->ffmpeg->SkipFrame();
+}
+
+bool KRenditionSet::Flush()
+{
+	std::lock_guard<std::mutex> lock(this->rendition_lock);
+	bool is_flushed = true;
+	for (size_t i = 0; i < this->renditions.size(); i++)
+	{
+		if (!this->renditions[i]->ffmpeg->StreamImage(cv::Mat(), true))
+		{
+			this->last_error = this->renditions[i]->ffmpeg->GetLastError();
+			is_flushed = false;
+		}
+	}
+
+	return is_flushed;
+}
+
+int KRenditionSet::GetLastError()
+{
+	return this->last_error;
+}
+
+void KRenditionSet::downscale(const cv::Mat& src, cv::Mat& dst, enum AVPixelFormat pix_fmt)
+{
+	if (pix_fmt != AV_PIX_FMT_YUV420P)
+	{
+		cv::Size size = GetScaledSize(src.size(), 1);
+		cv::resize(src, dst, size, 0, 0, cv::INTER_AREA);
+		return;
+	}
+
+	// each plane on its own, into one packed I420 Mat like the source
+	cv::Size size = GetScaledSize(cv::Size(src.cols, src.rows * 2 / 3), 1);
+	dst.create(size.height * 3 / 2, size.width, CV_8UC1);
+	for (int i = 0; i < 3; i++)
+	{
+		cv::Mat dst_plane = plane(dst, i);
+		cv::resize(plane(src, i), dst_plane, dst_plane.size(), 0, 0, cv::INTER_AREA);
+	}
+}
+
+void KRenditionSet::crop_i420(const cv::Mat& src, const cv::Rect& roi, cv::Mat& dst)
+{
+	dst.create(roi.height * 3 / 2, roi.width, CV_8UC1);
+
+	cv::Rect chroma_roi(roi.x / 2, roi.y / 2, roi.width / 2, roi.height / 2);
+	for (int i = 0; i < 3; i++)
+	{
+		cv::Mat dst_plane = plane(dst, i);
+		plane(src, i)(i == 0 ? roi : chroma_roi).copyTo(dst_plane);
+	}
+}
+
+cv::Mat KRenditionSet::plane(const cv::Mat& i420, int index)
+{
+	// packed like cv::COLOR_BGR2YUV_I420: the luma rows, then the quarter size U and V planes
+	int width = i420.cols;
+	int height = i420.rows * 2 / 3;
+	uint8_t *y = i420.data;
+	if (index == 0)
+		return cv::Mat(height, width, CV_8UC1, y, i420.step);
+
+	size_t chroma_step = i420.step / 2;
+	uint8_t *u = y + i420.step * height;
+	uint8_t *p = index == 1 ? u : u + chroma_step * (height / 2);
+	return cv::Mat(height / 2, width / 2, CV_8UC1, p, chroma_step);
+}
@@ -0,0 +1,78 @@
+#ifndef _K_RENDITION_SET_H_
+#define _K_RENDITION_SET_H_
+
+#include <string>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#include "MyFFMPEGStreamer.h"
+
+enum KRenditionScale{
+	RENDITION_FULL = 0,
+	RENDITION_HALF = 1,
+	RENDITION_QUARTER = 2,
+	RENDITION_EIGHTH = 3
+};
+
+#define RENDITION_MAX_LEVEL		3
+
+// one extra encoding of the captured frames
+struct KRendition{
+	int id;
+	std::string name;
+	int level;				// halvings of the frame, -1 for a crop
+	cv::Rect crop;			// in frame pixels, even
+	MyFFMPEGStreamer* ffmpeg;
+};
+
+/*
+encodes every captured frame a second, third, ... time: downscaled previews and cropped regions,
+each with its own encoder settings and destination.
+the downscales are one cascade, every level is box-filtered from the level above instead of from the frame,
+so a quarter costs a sixteenth of the frame and only the deepest level asked for is computed.
+crops are views of the frame for BGR, I420 crops copy their planes.
+*/
+class KRenditionSet
+{
+public:
+	KRenditionSet();
+	~KRenditionSet();
+
+private:
+	std::mutex rendition_lock;
+	std::vector<struct KRendition*> renditions;
+	int next_id;
+	int last_error;
+	// cascade levels and I420 crops, reused from frame to frame by the sending thread
+	cv::Mat levels[RENDITION_MAX_LEVEL + 1];
+	cv::Mat crop_img;
+
+	int add(struct KRendition* rendition, const MyFFMPEGEncoderConfig& config, std::string ip, int port);
+	static void downscale(const cv::Mat& src, cv::Mat& dst, enum AVPixelFormat pix_fmt);
+	static void crop_i420(const cv::Mat& src, const cv::Rect& roi, cv::Mat& dst);
+	static cv::Mat plane(const cv::Mat& i420, int index);
+
+public:
+	// size of the frame after level halvings, even
+	static cv::Size GetScaledSize(cv::Size frame_size, int level);
+	// config width and height must be set, the encoder scales a level of another size
+	int Add(std::string name, enum KRenditionScale scale, const MyFFMPEGEncoderConfig& config, std::string ip, int port);
+	int AddCrop(std::string name, cv::Rect roi, const MyFFMPEGEncoderConfig& config, std::string ip, int port);
+	bool Remove(int rendition_id);
+	void Clear();
+	int Find(std::string name);
+	int GetCount();
+	struct KStreamStats GetStats(int rendition_id);
+	void RequestKeyframe();
+	// encode one frame into every rendition, false if any of them failed
+	bool StreamImage(const cv::Mat& cv_img, enum AVPixelFormat pix_fmt);
+	// leave the frame out of every rendition, keeping their timelines
+	void SkipFrame();
+	// drain every encoder
+	bool Flush();
+	int GetLastError();
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "KStereoComposer.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STEREO_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+BT.601 limited range in 8-bit fixed point:
+Y = ((66 R + 129 G + 25 B + 128) >> 8) + 16
+U = ((-38 R - 74 G + 112 B + 128) >> 8) + 128
+V = ((112 R - 94 G - 18 B + 128) >> 8) + 128
+chroma is taken from the rounded average of each 2x2 block.
+*/
+
+// one pixel, averaged with its right neighbour for half width and with the row below for half height
+static inline void fetch_pixel(const uint8_t *p, const uint8_t *q, bool half_width, int x, int *b, int *g, int *r)
+{
+	int c[3];
+	for (int i = 0; i < 3; i++)
+	{
+		int v = half_width ? (p[8 * x + i] + p[8 * x + 4 + i] + 1) >> 1 : p[4 * x + i];
+		if (q)
+		{
+			int w = half_width ? (q[8 * x + i] + q[8 * x + 4 + i] + 1) >> 1 : q[4 * x + i];
+			v = (v + w + 1) >> 1;
+		}
+		c[i] = v;
+	}
+	*b = c[0];
+	*g = c[1];
+	*r = c[2];
+}
+
+static inline uint8_t luma(int b, int g, int r)
+{
+	return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+// output pixels [x, width) of two rows, x even
+static void convert_row_pair_scalar(const uint8_t *p0, const uint8_t *q0, const uint8_t *p1, const uint8_t *q1,
+									bool half_width, int x, int width,
+									uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+	for (; x + 1 < width; x += 2)
+	{
+		int b[4], g[4], r[4];
+		fetch_pixel(p0, q0, half_width, x, &b[0], &g[0], &r[0]);
+		fetch_pixel(p0, q0, half_width, x + 1, &b[1], &g[1], &r[1]);
+		fetch_pixel(p1, q1, half_width, x, &b[2], &g[2], &r[2]);
+		fetch_pixel(p1, q1, half_width, x + 1, &b[3], &g[3], &r[3]);
+
+		y0[x] = luma(b[0], g[0], r[0]);
+		y0[x + 1] = luma(b[1], g[1], r[1]);
+		y1[x] = luma(b[2], g[2], r[2]);
+		y1[x + 1] = luma(b[3], g[3], r[3]);
+
+		int ab = (b[0] + b[1] + b[2] + b[3] + 2) >> 2;
+		int ag = (g[0] + g[1] + g[2] + g[3] + 2) >> 2;
+		int ar = (r[0] + r[1] + r[2] + r[3] + 2) >> 2;
+		u[x / 2] = (uint8_t)(((-38 * ar - 74 * ag + 112 * ab + 128) >> 8) + 128);
+		v[x / 2] = (uint8_t)(((112 * ar - 94 * ag - 18 * ab + 128) >> 8) + 128);
+	}
+}
+
+#ifdef STEREO_SSE2
+// four output pixels as BGRA
+static inline __m128i load4(const uint8_t *p, const uint8_t *q, bool half_width, int x)
+{
+	__m128i px;
+	if (half_width)
+	{
+		__m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(p + 8 * x)));
+		__m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(p + 8 * x + 16)));
+		px = _mm_avg_epu8(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+						_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+	}
+	else
+		px = _mm_loadu_si128((const __m128i*)(p + 4 * x));
+
+	if (q)
+		px = _mm_avg_epu8(px, load4(q, NULL, half_width, x));
+	return px;
+}
+
+// eight BGRA pixels to 16-bit B, G and R lanes
+static inline void split8(__m128i a, __m128i b, __m128i *B, __m128i *G, __m128i *R)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	*B = _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	*G = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask), _mm_and_si128(_mm_srli_epi32(b, 8), mask));
+	*R = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask), _mm_and_si128(_mm_srli_epi32(b, 16), mask));
+}
+
+// the weighted sum stays below 2^16, so unsigned 16-bit lanes hold it
+static inline __m128i luma8(__m128i B, __m128i G, __m128i R)
+{
+	__m128i y = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(R, _mm_set1_epi16(66)), _mm_mullo_epi16(G, _mm_set1_epi16(129))),
+							_mm_add_epi16(_mm_mullo_epi16(B, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+	return _mm_add_epi16(_mm_srli_epi16(y, 8), _mm_set1_epi16(16));
+}
+
+// two rows summed, then adjacent pixels: 2x2 block averages of 16 pixels as 8 lanes
+static inline __m128i block_average(__m128i row0_lo, __m128i row1_lo, __m128i row0_hi, __m128i row1_hi)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i lo = _mm_madd_epi16(_mm_add_epi16(row0_lo, row1_lo), ones);
+	__m128i hi = _mm_madd_epi16(_mm_add_epi16(row0_hi, row1_hi), ones);
+	return _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(lo, hi), _mm_set1_epi16(2)), 2);
+}
+
+// signed terms stay within +-28688, the shift is arithmetic like the scalar path
+static inline __m128i chroma8(__m128i B, __m128i G, __m128i R, short cb, short cg, short cr)
+{
+	__m128i c = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(R, _mm_set1_epi16(cr)), _mm_mullo_epi16(G, _mm_set1_epi16(cg))),
+							_mm_add_epi16(_mm_mullo_epi16(B, _mm_set1_epi16(cb)), _mm_set1_epi16(128)));
+	return _mm_add_epi16(_mm_srai_epi16(c, 8), _mm_set1_epi16(128));
+}
+#endif
+
+static void convert_row_pair(const uint8_t *p0, const uint8_t *q0, const uint8_t *p1, const uint8_t *q1,
+							bool half_width, int width, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+	int x = 0;
+#ifdef STEREO_SSE2
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i B[4], G[4], R[4];
+		split8(load4(p0, q0, half_width, x), load4(p0, q0, half_width, x + 4), &B[0], &G[0], &R[0]);
+		split8(load4(p0, q0, half_width, x + 8), load4(p0, q0, half_width, x + 12), &B[1], &G[1], &R[1]);
+		split8(load4(p1, q1, half_width, x), load4(p1, q1, half_width, x + 4), &B[2], &G[2], &R[2]);
+		split8(load4(p1, q1, half_width, x + 8), load4(p1, q1, half_width, x + 12), &B[3], &G[3], &R[3]);
+
+		_mm_storeu_si128((__m128i*)(y0 + x), _mm_packus_epi16(luma8(B[0], G[0], R[0]), luma8(B[1], G[1], R[1])));
+		_mm_storeu_si128((__m128i*)(y1 + x), _mm_packus_epi16(luma8(B[2], G[2], R[2]), luma8(B[3], G[3], R[3])));
+
+		__m128i ab = block_average(B[0], B[2], B[1], B[3]);
+		__m128i ag = block_average(G[0], G[2], G[1], G[3]);
+		__m128i ar = block_average(R[0], R[2], R[1], R[3]);
+		__m128i zero = _mm_setzero_si128();
+		_mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(chroma8(ab, ag, ar, 112, -74, -38), zero));
+		_mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(chroma8(ab, ag, ar, -18, -94, 112), zero));
+	}
+#endif
+	convert_row_pair_scalar(p0, q0, p1, q1, half_width, x, width, y0, y1, u, v);
+}
+
+KStereoComposer::KStereoComposer()
+	: layout(KStereoLayout::SIDE_BY_SIDE)
+{}
+
+KStereoComposer::~KStereoComposer()
+{}
+
+void KStereoComposer::SetLayout(enum KStereoLayout layout)
+{
+	this->layout = layout;
+}
+
+enum KStereoLayout KStereoComposer::GetLayout()
+{
+	return (enum KStereoLayout)this->layout.load();
+}
+
+void KStereoComposer::get_region_size(enum KStereoLayout layout, int eye_width, int eye_height,
+									int *region_width, int *region_height)
+{
+	*region_width = layout == KStereoLayout::SIDE_BY_SIDE_HALF ? eye_width / 2 : eye_width;
+	*region_height = layout == KStereoLayout::TOP_BOTTOM_HALF ? eye_height / 2 : eye_height;
+	// 4:2:0 chroma needs whole 2x2 blocks in every region
+	*region_width &= ~1;
+	*region_height &= ~1;
+}
+
+cv::Size KStereoComposer::GetFrameSize(int eye_width, int eye_height)
+{
+	enum KStereoLayout layout = GetLayout();
+	int region_width, region_height;
+	get_region_size(layout, eye_width, eye_height, &region_width, &region_height);
+
+	if (layout == KStereoLayout::SIDE_BY_SIDE || layout == KStereoLayout::SIDE_BY_SIDE_HALF)
+		return cv::Size(region_width * 2, region_height);
+	return cv::Size(region_width, region_height * 2);
+}
+
+void KStereoComposer::convert_eye(const uint8_t *bgra, int step,
+								enum KStereoLayout layout, int region_width, int region_height,
+								cv::Mat& i420, int frame_width, int frame_height, int x, int y)
+{
+	bool half_width = layout == KStereoLayout::SIDE_BY_SIDE_HALF;
+	bool half_height = layout == KStereoLayout::TOP_BOTTOM_HALF;
+
+	uint8_t *y_plane = i420.data;
+	uint8_t *u_plane = y_plane + frame_width * frame_height;
+	uint8_t *v_plane = u_plane + (frame_width / 2) * (frame_height / 2);
+
+	for (int row = 0; row < region_height; row += 2)
+	{
+		const uint8_t *p0, *q0, *p1, *q1;
+		if (half_height)
+		{
+			p0 = bgra + (size_t)(2 * row) * step;
+			q0 = p0 + step;
+			p1 = q0 + step;
+			q1 = p1 + step;
+		}
+		else
+		{
+			p0 = bgra + (size_t)row * step;
+			p1 = p0 + step;
+			q0 = q1 = NULL;
+		}
+
+		int chroma_row = (y + row) / 2;
+		convert_row_pair(p0, q0, p1, q1, half_width, region_width,
+						y_plane + (size_t)(y + row) * frame_width + x,
+						y_plane + (size_t)(y + row + 1) * frame_width + x,
+						u_plane + (size_t)chroma_row * (frame_width / 2) + x / 2,
+						v_plane + (size_t)chroma_row * (frame_width / 2) + x / 2);
+	}
+}
+
+void KStereoComposer::Compose(const uint8_t *left, int left_step, const uint8_t *right, int right_step,
+							int eye_width, int eye_height, cv::Mat& i420)
+{
+	// one layout for the whole frame even if SetLayout races
+	enum KStereoLayout layout = GetLayout();
+	int region_width, region_height;
+	get_region_size(layout, eye_width, eye_height, &region_width, &region_height);
+	if (region_width < 2 || region_height < 2)
+		return;
+
+	bool is_side_by_side = layout == KStereoLayout::SIDE_BY_SIDE || layout == KStereoLayout::SIDE_BY_SIDE_HALF;
+	int frame_width = is_side_by_side ? region_width * 2 : region_width;
+	int frame_height = is_side_by_side ? region_height : region_height * 2;
+
+	// the planes are addressed as one packed buffer
+	if (!i420.isContinuous())
+		i420.release();
+	i420.create(frame_height * 3 / 2, frame_width, CV_8UC1);
+
+	if (left_step <= 0)
+		left_step = eye_width * 4;
+	if (right_step <= 0)
+		right_step = eye_width * 4;
+
+	convert_eye(left, left_step, layout, region_width, region_height,
+				i420, frame_width, frame_height, 0, 0);
+	convert_eye(right, right_step, layout, region_width, region_height,
+				i420, frame_width, frame_height,
+				is_side_by_side ? region_width : 0, is_side_by_side ? 0 : region_height);
+}
@@ -0,0 +1,52 @@
+#ifndef _K_STEREO_COMPOSER_H_
+#define _K_STEREO_COMPOSER_H_
+
+#include <cstdint>
+#include <atomic>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+enum KStereoLayout{
+	SIDE_BY_SIDE = 0,			// 2 * width x height
+	TOP_BOTTOM = 1,				// width x 2 * height
+	SIDE_BY_SIDE_HALF = 2,		// width x height, each eye squeezed horizontally
+	TOP_BOTTOM_HALF = 3			// width x height, each eye squeezed vertically
+};
+
+/*
+packs two BGRA eye images into one I420 frame in a single pass.
+each eye is read once and converted (BT.601, limited range like swscale) straight into
+its region of the Y, U and V planes, half layouts average pixel pairs on the way (SSE2 when available).
+the I420 frame is one CV_8UC1 Mat of height * 3 / 2 rows, the layout of cv::COLOR_BGR2YUV_I420.
+*/
+class KStereoComposer
+{
+public:
+	KStereoComposer();
+	~KStereoComposer();
+
+private:
+	std::atomic<int> layout;
+
+	// size of one eye's region in the frame, even in both directions
+	void get_region_size(enum KStereoLayout layout, int eye_width, int eye_height,
+						int *region_width, int *region_height);
+	// convert one eye into the region at (x, y) of the I420 planes
+	void convert_eye(const uint8_t *bgra, int step,
+					enum KStereoLayout layout, int region_width, int region_height,
+					cv::Mat& i420, int frame_width, int frame_height, int x, int y);
+
+public:
+	void SetLayout(enum KStereoLayout layout);
+	enum KStereoLayout GetLayout();
+	// frame size for eyes of the given size
+	cv::Size GetFrameSize(int eye_width, int eye_height);
+	/*
+	compose both eyes into i420, which is reallocated only if its size is wrong.
+	steps are the row strides of the eye buffers in bytes, 0 for packed rows.
+	*/
+	void Compose(const uint8_t *left, int left_step, const uint8_t *right, int right_step,
+				int eye_width, int eye_height, cv::Mat& i420);
+};
+
+#endif
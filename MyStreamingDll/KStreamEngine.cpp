@@ -0,0 +1,143 @@
+#include <algorithm>
+#include "KStreamEngine.h"
+
+KStreamEngine::KStreamEngine()
+	: pool(), streams(), next_worker(0)
+{}
+
+KStreamEngine::~KStreamEngine()
+{
+	Stop();
+
+	// streams outliving the engine go back to a send thread of their own
+	std::lock_guard<std::mutex> lock(this->stream_lock);
+	for (size_t i = 0; i < this->streams.size(); i++)
+		this->streams[i]->engine = NULL;
+	this->streams.clear();
+}
+
+bool KStreamEngine::Start(int cpu_budget, bool pin_workers)
+{
+	int cores = (int)std::thread::hardware_concurrency();
+	int worker_count = cpu_budget > 0 ? cpu_budget : cores;
+	if (cores > 0)
+		worker_count = std::min(worker_count, cores);
+
+	return this->pool.Start(worker_count, pin_workers);
+}
+
+void KStreamEngine::Stop()
+{
+	EndAll();
+	this->pool.Stop();
+}
+
+bool KStreamEngine::IsRunning()
+{
+	return this->pool.IsRunning();
+}
+
+bool KStreamEngine::AddStream(KStreamer* stream, enum KStreamPriority priority)
+{
+	if (!stream || (stream->engine && stream->engine != this))
+		return false;
+
+	std::lock_guard<std::mutex> lock(this->stream_lock);
+	if (std::find(this->streams.begin(), this->streams.end(), stream) == this->streams.end())
+	{
+		this->streams.push_back(stream);
+		// spread the streams' home workers so each keeps its caches on one core
+		stream->engine_worker = this->next_worker++;
+	}
+	stream->engine_priority = priority;
+	stream->engine = this;
+
+	return true;
+}
+
+bool KStreamEngine::RemoveStream(KStreamer* stream)
+{
+	this->stream_lock.lock();
+	std::vector<KStreamer*>::iterator it = std::find(this->streams.begin(), this->streams.end(), stream);
+	bool is_attached = it != this->streams.end();
+	if (is_attached)
+		this->streams.erase(it);
+	this->stream_lock.unlock();
+
+	if (!is_attached)
+		return false;
+
+	if (stream->send_engine == this)
+		stream->EndStream();
+	stream->engine = NULL;
+
+	return true;
+}
+
+void KStreamEngine::SetStreamPriority(KStreamer* stream, enum KStreamPriority priority)
+{
+	std::lock_guard<std::mutex> lock(this->stream_lock);
+	if (std::find(this->streams.begin(), this->streams.end(), stream) != this->streams.end())
+		stream->engine_priority = priority;
+}
+
+bool KStreamEngine::StartAll()
+{
+	std::lock_guard<std::mutex> lock(this->stream_lock);
+	bool is_started = true;
+	for (size_t i = 0; i < this->streams.size(); i++)
+	{
+		if (!this->streams[i]->StartStream())
+			is_started = false;
+	}
+
+	return is_started;
+}
+
+void KStreamEngine::EndAll()
+{
+	std::lock_guard<std::mutex> lock(this->stream_lock);
+	for (size_t i = 0; i < this->streams.size(); i++)
+		this->streams[i]->EndStream();
+}
+
+void KStreamEngine::Schedule(KStreamer* stream)
+{
+	// one task per stream at a time keeps its frames in order
+	if (stream->begin_send_task())
+		submit(stream);
+}
+
+void KStreamEngine::submit(KStreamer* stream)
+{
+	bool is_submitted = this->pool.Submit([this, stream]() {
+		// one frame per task, so the streams of the same priority take turns
+		if (stream->run_send_task())
+			submit(stream);
+	}, stream->engine_priority, stream->engine_worker);
+
+	// stopped pool, EndStream sends what is left
+	if (!is_submitted)
+		stream->cancel_send_task();
+}
+
+int KStreamEngine::GetWorkerCount()
+{
+	return this->pool.GetWorkerCount();
+}
+
+int KStreamEngine::GetStreamCount()
+{
+	std::lock_guard<std::mutex> lock(this->stream_lock);
+	return (int)this->streams.size();
+}
+
+uint64_t KStreamEngine::GetStolenTasks()
+{
+	return this->pool.GetStolenCount();
+}
+
+double KStreamEngine::GetUtilization()
+{
+	return this->pool.GetUtilization();
+}
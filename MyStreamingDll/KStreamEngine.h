@@ -0,0 +1,70 @@
+#ifndef _K_STREAM_ENGINE_H_
+#define _K_STREAM_ENGINE_H_
+
+#include "KPlatform.h"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "KWorkerPool.h"
+#include "KStreamer.h"
+
+enum KStreamPriority{
+	PRIORITY_LOW = 0,
+	PRIORITY_NORMAL = 1,
+	PRIORITY_HIGH = 2
+};
+
+/*
+runs the conversion and encoding of many streams on one shared worker pool instead of a send thread per stream.
+capture keeps a thread per stream, it mostly waits for its device.
+every queued frame is a task of its stream, and a stream has one task at a time so its frames stay in order.
+when the workers are saturated the higher priority streams are encoded first,
+the frame queues of the others fill up and drop frames by their own policy.
+the workers are capped by the cpu budget, and attached streams open their encoder with one thread
+unless their config asks for more, so a multi-camera rig no longer oversubscribes its cores.
+*/
+class K_STREAMING_API KStreamEngine
+{
+public:
+	KStreamEngine();
+	~KStreamEngine();
+
+private:
+	KWorkerPool pool;
+	std::mutex stream_lock;
+	std::vector<KStreamer*> streams;
+	int next_worker;
+
+	void submit(KStreamer* stream);
+
+public:
+	// cpu_budget is the number of cores the workers may use, 0 for every core
+	bool Start(int cpu_budget = 0, bool pin_workers = true);
+	// ends every attached stream, then stops the workers
+	void Stop();
+	bool IsRunning();
+	/*
+	attach a stream, applied on its next StartStream. the stream is not owned.
+	attach before SetFFMPEG so the encoder is opened with the engine's threading.
+	*/
+	bool AddStream(KStreamer* stream, enum KStreamPriority priority = KStreamPriority::PRIORITY_NORMAL);
+	// ends the stream if it is sending on this engine, then detaches it
+	bool RemoveStream(KStreamer* stream);
+	// applied from the next frame
+	void SetStreamPriority(KStreamer* stream, enum KStreamPriority priority);
+	// returns false if any stream failed to start, the others keep running
+	bool StartAll();
+	void EndAll();
+	// called by a stream's capture thread for every queued frame
+	void Schedule(KStreamer* stream);
+	int GetWorkerCount();
+	int GetStreamCount();
+	// tasks run by another worker than their stream's own
+	uint64_t GetStolenTasks();
+	// share of the workers' time spent converting and encoding, 0 to 1
+	double GetUtilization();
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _K_STREAM_STATS_H_
+#define _K_STREAM_STATS_H_
+
+#include <cstdint>
+
+#include "KLatencyHistogram.h"
+
+/*
+snapshot of a stream since StartStream (or the last ResetStats).
+durations are microseconds of the steady clock. counters only grow while streaming.
+*/
+struct KStreamStats{
+	int64_t elapsed_us;
+	// per frame stages
+	struct KStageStats capture;		// frame grabbed until it is in the frame queue
+	struct KStageStats queue;		// waiting in the frame queue for the encoder
+	struct KStageStats detect;		// change detection, with SetChangeDetection only
+	struct KStageStats convert;		// scaling and conversion to the encoder format
+	struct KStageStats overlay;
+	struct KStageStats encode;
+	struct KStageStats write;		// handing the packet to the send queue of every output
+	struct KStageStats send;		// muxing and sending on the output threads, pacing included
+	struct KStageStats latency;		// frame grabbed until the encoder's packet is handed to the outputs
+	// frames
+	uint64_t captured_frames;
+	uint64_t encoded_frames;
+	uint64_t dropped_frames;		// discarded by a full frame queue
+	uint64_t skipped_frames;		// not encoded because the frame rate was stepped down or the scene was static
+	uint64_t keyframes;
+	// encoded output
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t dropped_packets;		// discarded by a full send queue
+	uint64_t failed_packets;		// refused by the muxer or the network
+	// load
+	int queue_depth;
+	int max_queue_depth;
+	int send_queue_depth;			// packets waiting in the fullest output queue
+	bool is_scene_static;
+	int64_t target_bit_rate;
+	int64_t achieved_bit_rate;		// over the last second
+	double achieved_fps;
+};
+
+#endif
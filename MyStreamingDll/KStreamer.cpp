@@ -1,26 +1,134 @@
 #include <iostream>
+#include <algorithm>
+#include <chrono>
 #include "KStreamer.h"
+#include "KStreamEngine.h"
 
 KStreamer::KStreamer()
 	: is_streaming(false), last_error(KStreamerError::NO_STREAMER_ERROR), 
-	sender(NULL), device_id(0), video_cap(), zed_camera(NULL), zed_params(), 
-	is_zed_outside(false), ffmpeg(), sendEvent(NULL)
+	capturer(NULL), sender(NULL), reporter(NULL), frame_ring(), frame_queue_capacity(FRAME_QUEUE_CAPACITY),
+	frame_drop_policy(KFrameDropPolicy::DROP_OLDEST), frame_pool(), stream_fps(STREAM_FPS), frame_pacer(), device_id(0), frame_source(NULL), user_source(NULL), is_source_owned(false),
+	is_native_capture(false), native_format(KV4L2Format::V4L2_FORMAT_AUTO),
+#ifdef K_STREAMING_ZED
+	zed_camera(NULL), zed_params(), is_zed_outside(false),
+#endif
+	ffmpeg(), renditions(), is_adaptive(false), adaptive_min_bit_rate(0), adaptive_max_bit_rate(0),
+	bitrate_controller(), stereo_composer(), capture_pix_fmt(AV_PIX_FMT_NONE), manual_stereo_img(),
+	capture_hist(), queue_hist(), max_queue_depth(0), stats_pushed_base(0), stats_dropped_base(0),
+	is_reporting(false), stats_interval_ms(STATS_INTERVAL_MS),
+	engine(NULL), send_engine(NULL), engine_priority(0), engine_worker(0), is_send_scheduled(false),
+	send_img(), change_config(), detect_config(), change_detector(), detect_hist(), unchanged_frames(0),
+	is_scene_static(false), last_encode_us(0), last_keyframe_us(0), active_bit_rate(0),
+	frame_taps(), send_event_tap(-1), statsEvent(NULL)
 {}
 
-KStreamer::KStreamer(__in sl::zed::Camera* zed_camera, __in const sl::zed::InitParams& zed_params)
+#ifdef K_STREAMING_ZED
+KStreamer::KStreamer(K_IN sl::zed::Camera* zed_camera, K_IN const sl::zed::InitParams& zed_params)
 	: is_streaming(false), last_error(KStreamerError::NO_STREAMER_ERROR),
-	sender(NULL), device_id(0), video_cap(), zed_camera(zed_camera), zed_params(zed_params),
-	is_zed_outside(true), ffmpeg(), sendEvent(NULL)
+	capturer(NULL), sender(NULL), reporter(NULL), frame_ring(), frame_queue_capacity(FRAME_QUEUE_CAPACITY),
+	frame_drop_policy(KFrameDropPolicy::DROP_OLDEST), frame_pool(), stream_fps(STREAM_FPS), frame_pacer(), device_id(0), frame_source(NULL), user_source(NULL), is_source_owned(false),
+	is_native_capture(false), native_format(KV4L2Format::V4L2_FORMAT_AUTO), zed_camera(zed_camera), zed_params(zed_params),
+	is_zed_outside(true), ffmpeg(), renditions(), is_adaptive(false), adaptive_min_bit_rate(0), adaptive_max_bit_rate(0),
+	bitrate_controller(), stereo_composer(), capture_pix_fmt(AV_PIX_FMT_NONE), manual_stereo_img(),
+	capture_hist(), queue_hist(), max_queue_depth(0), stats_pushed_base(0), stats_dropped_base(0),
+	is_reporting(false), stats_interval_ms(STATS_INTERVAL_MS),
+	engine(NULL), send_engine(NULL), engine_priority(0), engine_worker(0), is_send_scheduled(false),
+	send_img(), change_config(), detect_config(), change_detector(), detect_hist(), unchanged_frames(0),
+	is_scene_static(false), last_encode_us(0), last_keyframe_us(0), active_bit_rate(0),
+	frame_taps(), send_event_tap(-1), statsEvent(NULL)
 {}
+#endif
 
 KStreamer::~KStreamer()
-{}
+{
+	if (this->engine)
+		this->engine->RemoveStream(this);
+}
 
 void KStreamer::SetFFMPEG(int img_width, int img_height, int64_t bit_rate, 
 						enum AVCodecID codec_id, std::string ip, int port)
 {
+	MyFFMPEGEncoderConfig config;
+	config.codec_id = codec_id;
+	config.width = img_width;
+	config.height = img_height;
+	config.bit_rate = bit_rate;
+
+	SetFFMPEG(config, ip, port);
+}
+
+void KStreamer::SetFFMPEG(const MyFFMPEGEncoderConfig& config, std::string ip, int port)
+{
+	MyFFMPEGEncoderConfig stream_config = make_stream_config(config);
+
+	// while streaming the encoder is replaced in place, the receivers keep their stream
+	if (this->is_streaming && ffmpeg.Reconfigure(stream_config))
+	{
+		if (!ffmpeg.SetDestination(ip, port))
+			this->last_error = KStreamerError::FFMPEG_ERROR;
+		return;
+	}
+
+	// the send stage uses the encoder without a lock, it stops before the encoder goes and starts again after
+	bool is_restart = this->is_streaming;
+	if (is_restart)
+		EndStream();
+
 	ffmpeg.Deinitialize();
-	ffmpeg.Initialize(img_width, img_height, bit_rate, codec_id, ip, port);
+	if (!ffmpeg.Initialize(stream_config, ip, port))
+	{
+		this->last_error = KStreamerError::FFMPEG_ERROR;
+		return;
+	}
+
+	if (is_restart)
+		StartStream();
+}
+
+bool KStreamer::Reconfigure(const MyFFMPEGEncoderConfig& config)
+{
+	return this->ffmpeg.Reconfigure(make_stream_config(config));
+}
+
+bool KStreamer::SetDestination(std::string ip, int port)
+{
+	return this->ffmpeg.SetDestination(ip, port);
+}
+
+MyFFMPEGEncoderConfig KStreamer::make_stream_config(const MyFFMPEGEncoderConfig& config)
+{
+	MyFFMPEGEncoderConfig stream_config = config;
+	if (stream_config.fps <= 0)
+		stream_config.fps = this->stream_fps;
+	// on a shared pool the parallelism comes from encoding the streams side by side
+	if (this->engine && stream_config.thread_count <= 0)
+		stream_config.thread_count = 1;
+
+	return stream_config;
+}
+
+void KStreamer::SetLowLatencyFFMPEG(int img_width, int img_height, int64_t bit_rate,
+						std::string ip, int port)
+{
+	SetFFMPEG(MyFFMPEGEncoderConfig::LowLatencyH264(img_width, img_height, bit_rate, this->stream_fps), ip, port);
+}
+
+void KStreamer::RequestKeyframe()
+{
+	this->ffmpeg.RequestKeyframe();
+	this->renditions.RequestKeyframe();
+}
+
+void KStreamer::SetAdaptiveBitrate(bool enable, int64_t min_bit_rate, int64_t max_bit_rate)
+{
+	this->is_adaptive = enable;
+	this->adaptive_min_bit_rate = min_bit_rate;
+	this->adaptive_max_bit_rate = max_bit_rate;
+}
+
+int64_t KStreamer::GetCurrentBitRate()
+{
+	return this->ffmpeg.GetBitRate();
 }
 
 void KStreamer::SetCamDeviceID(int id)
@@ -28,123 +136,479 @@ void KStreamer::SetCamDeviceID(int id)
 	this->device_id = id;
 }
 
+void KStreamer::SetFrameSource(KFrameSource* source)
+{
+	this->user_source = source;
+}
+
+void KStreamer::SetNativeCapture(bool enable, enum KV4L2Format format)
+{
+	this->is_native_capture = enable;
+	this->native_format = format;
+}
+
+int KStreamer::AddDestination(std::string ip, int port)
+{
+	return this->ffmpeg.AddRTPDestination(ip, port);
+}
+
+int KStreamer::AddRecording(std::string path)
+{
+	return this->ffmpeg.AddSink(path);
+}
+
+int KStreamer::AddSegmentRecording(std::string directory, int segment_count, size_t segment_size)
+{
+	return this->ffmpeg.AddSegmentSink(directory, segment_count, segment_size);
+}
+
+std::vector<std::string> KStreamer::GetRecordingSegments(int output_id)
+{
+	return this->ffmpeg.GetSegmentPaths(output_id);
+}
+
+int KStreamer::AddClipBuffer(int max_seconds, size_t max_bytes)
+{
+	return this->ffmpeg.AddClipSink(max_seconds, max_bytes);
+}
+
+int KStreamer::ExportClip(int output_id, std::string path, int before_ms, int after_ms)
+{
+	return this->ffmpeg.ExportClip(output_id, path, before_ms, after_ms);
+}
+
+bool KStreamer::RemoveOutput(int output_id)
+{
+	return this->ffmpeg.RemoveSink(output_id);
+}
+
+int KStreamer::AddRendition(std::string name, enum KRenditionScale scale, const MyFFMPEGEncoderConfig& config,
+							std::string ip, int port)
+{
+	MyFFMPEGEncoderConfig stream_config = make_stream_config(config);
+	if (stream_config.width <= 0 || stream_config.height <= 0)
+	{
+		MyFFMPEGEncoderConfig full = this->ffmpeg.GetConfig();
+		cv::Size size = KRenditionSet::GetScaledSize(cv::Size(full.width, full.height), scale);
+		stream_config.width = size.width;
+		stream_config.height = size.height;
+	}
+
+	return this->renditions.Add(name, scale, stream_config, ip, port);
+}
+
+int KStreamer::AddCropRendition(std::string name, cv::Rect roi, const MyFFMPEGEncoderConfig& config,
+								std::string ip, int port)
+{
+	MyFFMPEGEncoderConfig stream_config = make_stream_config(config);
+	if (stream_config.width <= 0 || stream_config.height <= 0)
+	{
+		stream_config.width = roi.width & ~1;
+		stream_config.height = roi.height & ~1;
+	}
+
+	return this->renditions.AddCrop(name, roi, stream_config, ip, port);
+}
+
+bool KStreamer::RemoveRendition(int rendition_id)
+{
+	return this->renditions.Remove(rendition_id);
+}
+
+int KStreamer::FindRendition(std::string name)
+{
+	return this->renditions.Find(name);
+}
+
+struct KStreamStats KStreamer::GetRenditionStats(int rendition_id)
+{
+	return this->renditions.GetStats(rendition_id);
+}
+
+void KStreamer::SetSendPacing(bool enable)
+{
+	this->ffmpeg.SetPacing(enable);
+}
+
+void KStreamer::SetScaler(int sws_flags)
+{
+	this->ffmpeg.SetScalerFlags(sws_flags);
+}
+
+void KStreamer::SetConvertSlices(int slice_count)
+{
+	this->ffmpeg.SetConvertSlices(slice_count);
+}
+
+void KStreamer::SetTimestampOverlay(bool enable, int x, int y)
+{
+	this->ffmpeg.SetOverlay(enable, x, y);
+}
+
+void KStreamer::SetChangeDetection(const struct KChangeDetectConfig& config)
+{
+	this->change_config = config;
+}
+
+bool KStreamer::IsSceneStatic()
+{
+	return this->is_scene_static;
+}
+
+void KStreamer::SetFrameQueue(int capacity, enum KFrameDropPolicy drop_policy)
+{
+	this->frame_queue_capacity = capacity;
+	this->frame_drop_policy = drop_policy;
+}
+
+uint64_t KStreamer::GetDroppedFrames()
+{
+	return this->frame_ring.GetDroppedCount();
+}
+
+uint64_t KStreamer::GetAllocationCount()
+{
+	return this->frame_pool.GetAllocationCount();
+}
+
+void KStreamer::SetStereoLayout(enum KStereoLayout layout)
+{
+	this->stereo_composer.SetLayout(layout);
+}
+
+void KStreamer::SetStreamFps(int fps)
+{
+	if (fps > 0)
+		this->stream_fps = fps;
+}
+
+double KStreamer::GetAchievedFps()
+{
+	return this->frame_pacer.GetAchievedFps();
+}
+
+int64_t KStreamer::GetFrameLateness()
+{
+	return this->frame_pacer.GetLastLateness();
+}
+
+uint64_t KStreamer::GetSkippedFrameSlots()
+{
+	return this->frame_pacer.GetSkippedSlots();
+}
+
+struct KStreamStats KStreamer::GetStats()
+{
+	struct KStreamStats stats = this->ffmpeg.GetStats();
+
+	stats.capture = this->capture_hist.GetStats();
+	stats.queue = this->queue_hist.GetStats();
+	stats.detect = this->detect_hist.GetStats();
+	stats.captured_frames = this->frame_ring.GetPushedCount() - this->stats_pushed_base;
+	stats.dropped_frames = this->frame_ring.GetDroppedCount() - this->stats_dropped_base;
+	stats.queue_depth = this->frame_ring.Size();
+	stats.max_queue_depth = this->max_queue_depth;
+	stats.is_scene_static = this->is_scene_static;
+
+	return stats;
+}
+
+void KStreamer::ResetStats()
+{
+	this->ffmpeg.ResetStats();
+	this->capture_hist.Reset();
+	this->queue_hist.Reset();
+	this->detect_hist.Reset();
+	this->max_queue_depth = 0;
+	this->stats_pushed_base = this->frame_ring.GetPushedCount();
+	this->stats_dropped_base = this->frame_ring.GetDroppedCount();
+}
+
 bool KStreamer::StartStream()
 {
 	EndStream();
 
-	if (this->device_id == DEVICE_OPTION::MANUAL)
+	if (this->device_id == DEVICE_OPTION::MANUAL && !this->user_source)
+	{
+		ResetStats();
+		start_reporter();
 		return true;
+	}
 
-	if (this->device_id == DEVICE_OPTION::ZED_CAMERA_LEFT ||
-		this->device_id == DEVICE_OPTION::ZED_CAMERA_RIGHT ||
-		this->device_id == DEVICE_OPTION::ZED_CAMERA_STEREO)
+	if (this->user_source)
 	{
-		if (!is_zed_outside)
-		{
-			this->zed_camera = new sl::zed::Camera(sl::zed::HD720, 30);
-			this->zed_params.mode = sl::zed::PERFORMANCE;
-			this->zed_params.unit = sl::zed::MILLIMETER;
-			this->zed_params.coordinate = sl::zed::IMAGE;
-			this->zed_params.disableSelfCalib = false;
-			this->zed_params.device = -1;
-			this->zed_params.verbose = false;
-			this->zed_params.vflip = false;
-
-			sl::zed::ERRCODE zederr = zed_camera->init(zed_params);
-
-			if (zederr != sl::zed::SUCCESS)
-			{
-				this->last_error = KStreamerError::CAM_NOT_OPENED;
-				delete zed_camera;
-				return false;
-			}
-		}
+		this->frame_source = this->user_source;
+		this->is_source_owned = false;
 	}
 	else
 	{
-		this->video_cap.open(this->device_id);
-		if (!this->video_cap.isOpened())
-		{
-			this->last_error = KStreamerError::CAM_NOT_OPENED;
-			return false;
-		}
+		this->frame_source = create_device_source();
+		this->is_source_owned = true;
+	}
+
+	if (!this->frame_source || !this->frame_source->Open())
+	{
+		this->last_error = KStreamerError::CAM_NOT_OPENED;
+		close_frame_source();
+		return false;
 	}
 
+	this->frame_ring.Reset(this->frame_queue_capacity, this->frame_drop_policy);
+	// the ring's slots plus the frames held by the sender and the frame taps
+	this->frame_pool.Reset(this->frame_queue_capacity + FRAME_POOL_SIZE + this->frame_taps.GetQueuedCapacity());
+	this->frame_pacer.Reset(this->stream_fps);
+	this->capture_pix_fmt = this->frame_source->GetPixelFormat();
+	ResetStats();
+
 	mtx_lock.lock();
 	this->is_streaming = true;
 	mtx_lock.unlock();
 
-	this->sender = new std::thread(&KStreamer::SendStream, this);
-	if (!this->sender)
+	if (this->engine)
+	{
+		if (!this->engine->IsRunning())
+		{
+			this->last_error = KStreamerError::THREAD_NOT_CREATED;
+			EndStream();
+			return false;
+		}
+		// the capture thread schedules every queued frame on the engine's workers
+		this->send_engine = this->engine;
+		this->is_send_scheduled = false;
+		begin_send();
+	}
+	else
+		this->sender = new std::thread(&KStreamer::SendStream, this);
+	this->capturer = new std::thread(&KStreamer::CaptureStream, this);
+	if ((!this->send_engine && !this->sender) || !this->capturer)
 	{
 		this->last_error = KStreamerError::THREAD_NOT_CREATED;
+		EndStream();
 		return false;
 	}
+	start_reporter();
 
 	return true;
 }
 
 void KStreamer::EndStream()
 {
+	mtx_lock.lock();
+	this->is_streaming = false;
+	mtx_lock.unlock();
+
+	// capturer closes the ring, then sender drains it and flushes the encoder
+	if (this->capturer)
+	{
+		this->capturer->join();
+		delete this->capturer;
+	}
+	this->frame_ring.Close();
 	if (this->sender)
 	{
-		mtx_lock.lock();
-		this->is_streaming = false;
-		mtx_lock.unlock();
-
 		// wait until finish
 		this->sender->join();
-
 		delete this->sender;
 	}
-	if (this->video_cap.isOpened())
-		this->video_cap.release();
-
-	if (!this->is_zed_outside)
+	else if (this->send_engine)
 	{
-		if (this->zed_camera)
-		{
-			delete this->zed_camera;
-			this->zed_camera = NULL;
-		}
+		// wait for the running task, then send what is left and flush here
+		std::unique_lock<std::mutex> lock(this->send_lock);
+		this->send_cond.wait(lock, [this] { return !this->is_send_scheduled; });
+		lock.unlock();
+
+		struct KFrameTime frame_time;
+		while (this->frame_ring.Pop(this->send_img, &frame_time))
+			send_frame(this->send_img, frame_time);
+		end_send(this->send_img);
+		this->send_engine = NULL;
 	}
+	close_frame_source();
+	stop_reporter();
 
+	this->capturer = NULL;
 	this->sender = NULL;
 }
 
-bool KStreamer::SendFrameManually(__in const cv::Mat& cv_img)
+bool KStreamer::SendFrameManually(K_IN const cv::Mat& cv_img)
+{
+	if (this->device_id != DEVICE_OPTION::MANUAL)
+		return false;
+
+	return send_manual_frame(cv_img, AV_PIX_FMT_NONE);
+}
+
+bool KStreamer::SendStereoFrameManually(K_IN const cv::Mat& left_img, K_IN const cv::Mat& right_img)
 {
 	if (this->device_id != DEVICE_OPTION::MANUAL)
 		return false;
 
-	if (!this->ffmpeg.StreamImage(cv_img, false))
+	if (left_img.type() != CV_8UC4 || right_img.type() != CV_8UC4 || left_img.size() != right_img.size())
+		return false;
+
+	this->stereo_composer.Compose(left_img.data, (int)left_img.step, right_img.data, (int)right_img.step,
+								left_img.cols, left_img.rows, this->manual_stereo_img);
+	return send_manual_frame(this->manual_stereo_img, AV_PIX_FMT_YUV420P);
+}
+
+bool KStreamer::send_manual_frame(const cv::Mat& cv_img, enum AVPixelFormat pix_fmt)
+{
+	bool is_sent = true;
+
+	// the frame was handed over just now, that is its capture time
+	if (!this->ffmpeg.StreamImage(cv_img, false, pix_fmt, av_gettime_relative()))
 	{
 		this->last_error = KStreamerError::FFMPEG_ERROR;
-		return false;
+		is_sent = false;
 	}
 
-	return true;
+	// the other encodings of the frame, as for captured frames
+	if (!this->renditions.StreamImage(cv_img, pix_fmt))
+	{
+		this->last_error = KStreamerError::RENDITION_ERROR;
+		is_sent = false;
+	}
+
+	return is_sent;
+}
+
+KFrameSource* KStreamer::create_device_source()
+{
+#ifdef K_STREAMING_ZED
+	// an outside camera stays open, otherwise the source opens its own
+	sl::zed::Camera* camera = this->is_zed_outside ? this->zed_camera : NULL;
+#endif
+
+	switch (this->device_id)
+	{
+#ifdef K_STREAMING_ZED
+	case DEVICE_OPTION::ZED_CAMERA_LEFT:
+		return new KZedSource(KZedView::ZED_VIEW_LEFT, camera, this->stream_fps, &this->stereo_composer);
+	case DEVICE_OPTION::ZED_CAMERA_RIGHT:
+		return new KZedSource(KZedView::ZED_VIEW_RIGHT, camera, this->stream_fps, &this->stereo_composer);
+	case DEVICE_OPTION::ZED_CAMERA_STEREO:
+		return new KZedSource(KZedView::ZED_VIEW_STEREO, camera, this->stream_fps, &this->stereo_composer);
+#else
+	case DEVICE_OPTION::ZED_CAMERA_LEFT:
+	case DEVICE_OPTION::ZED_CAMERA_RIGHT:
+	case DEVICE_OPTION::ZED_CAMERA_STEREO:
+		// built without the ZED SDK
+		return NULL;
+#endif
+	default:
+#ifdef __linux__
+		if (this->is_native_capture)
+		{
+			MyFFMPEGEncoderConfig config = this->ffmpeg.GetConfig();
+			return new KV4L2Source(this->device_id, config.width, config.height, this->stream_fps, this->native_format);
+		}
+#endif
+		return new KCaptureSource(this->device_id);
+	}
+}
+
+void KStreamer::close_frame_source()
+{
+	if (!this->frame_source)
+		return;
+
+	this->frame_source->Close();
+	if (this->is_source_owned)
+		delete this->frame_source;
+	this->frame_source = NULL;
 }
 
 int KStreamer::GetLastError()
 {
 	if (this->last_error == KStreamerError::FFMPEG_ERROR)
 		return this->ffmpeg.GetLastError();
+	else if (this->last_error == KStreamerError::RENDITION_ERROR)
+		return this->renditions.GetLastError();
 	else
 		return this->last_error;
 }
 
-void KStreamer::SetSendEvent(void(*sendEvent)(__in cv::Mat& cv_img))
+int KStreamer::AddFrameTap(const KTapCallback& callback, enum KTapFormat format,
+						int capacity, enum KFrameDropPolicy drop_policy)
 {
-	this->sendEvent = sendEvent;
+	return this->frame_taps.Subscribe(callback, format, capacity, drop_policy);
 }
 
-void KStreamer::SendStream()
+int KStreamer::AddFrameTap(void(*callback)(K_IN const struct KTapFrame& frame, void* context), void* context,
+						enum KTapFormat format, int capacity, enum KFrameDropPolicy drop_policy)
+{
+	if (callback == NULL)
+		return -1;
+
+	return this->frame_taps.Subscribe([callback, context](const struct KTapFrame& frame) {
+		callback(frame, context);
+	}, format, capacity, drop_policy);
+}
+
+bool KStreamer::RemoveFrameTap(int tap_id)
+{
+	return this->frame_taps.Unsubscribe(tap_id);
+}
+
+uint64_t KStreamer::GetTapDroppedFrames(int tap_id)
+{
+	return this->frame_taps.GetDroppedCount(tap_id);
+}
+
+void KStreamer::SetSendEvent(void(*sendEvent)(K_IN cv::Mat& cv_img))
+{
+	if (this->send_event_tap >= 0)
+		this->frame_taps.Unsubscribe(this->send_event_tap);
+	this->send_event_tap = -1;
+
+	if (sendEvent != NULL)
+		this->send_event_tap = this->frame_taps.Subscribe([sendEvent](const struct KTapFrame& frame) {
+			cv::Mat img = frame.img;
+			sendEvent(img);
+		}, KTapFormat::TAP_FORMAT_BGR);
+}
+
+void KStreamer::SetStatsEvent(void(*statsEvent)(K_IN const struct KStreamStats& stats), int interval_ms)
+{
+	// the reporter reads the event under the same lock, it may be changed while streaming
+	std::lock_guard<std::mutex> lock(this->stats_lock);
+	this->statsEvent = statsEvent;
+	this->stats_interval_ms = interval_ms > 0 ? interval_ms : STATS_INTERVAL_MS;
+}
+
+void KStreamer::start_reporter()
+{
+	this->stats_lock.lock();
+	bool has_event = this->statsEvent != NULL;
+	this->is_reporting = has_event;
+	this->stats_lock.unlock();
+
+	// an event set later only takes effect on the next StartStream
+	if (!has_event)
+		return;
+
+	this->reporter = new std::thread(&KStreamer::ReportStats, this);
+}
+
+void KStreamer::stop_reporter()
+{
+	this->stats_lock.lock();
+	this->is_reporting = false;
+	this->stats_cond.notify_all();
+	this->stats_lock.unlock();
+
+	if (this->reporter)
+	{
+		this->reporter->join();
+		delete this->reporter;
+	}
+	this->reporter = NULL;
+}
+
+void KStreamer::CaptureStream()
 {
-	cv::Mat cam_img;
-	cv::Mat frame_pool[STREAM_FPS];
-	int frame_pool_index = 0;
-	int func_device_id = this->device_id;
+	KFrameSource* source = this->frame_source;
+	bool is_paced = source->NeedsPacing();
 
 	while (true)
 	{
@@ -152,97 +616,243 @@ void KStreamer::SendStream()
 		bool thread_end = this->is_streaming;
 		mtx_lock.unlock();
 
-		// get image from camera
-		if (func_device_id == DEVICE_OPTION::ZED_CAMERA_LEFT ||
-			func_device_id == DEVICE_OPTION::ZED_CAMERA_RIGHT)
-		{
-			if (!zed_camera)
-			{
-				this->last_error = KStreamerError::CAM_NOT_OPENED;
-				return;
-			}
-
-			int width = zed_camera->getImageSize().width;
-			int height = zed_camera->getImageSize().height;
-			cv::Mat cam_temp = cv::Mat(height, width, CV_8UC4);
-			cam_img = cv::Mat(height, width, CV_8UC3);
-
-			if (!zed_camera->grab(sl::zed::SENSING_MODE::STANDARD))
-			{
-				// Retrieve left color image
-				sl::zed::Mat zedMat;
-				if (func_device_id == DEVICE_OPTION::ZED_CAMERA_LEFT)
-					zedMat = zed_camera->retrieveImage(sl::zed::SIDE::LEFT);
-				else if (func_device_id == DEVICE_OPTION::ZED_CAMERA_RIGHT)
-					zedMat = zed_camera->retrieveImage(sl::zed::SIDE::RIGHT);
-
-				memcpy(cam_temp.data, zedMat.data, width*height * 4 * sizeof(uchar));
-
-				cv::cvtColor(cam_temp, cam_img, cv::COLOR_BGRA2BGR);
-			}
-		}
-		else if (func_device_id == DEVICE_OPTION::ZED_CAMERA_STEREO)
-		{
-			if (!zed_camera)
-			{
-				this->last_error = KStreamerError::CAM_NOT_OPENED;
-				return;
-			}
-
-			int width = zed_camera->getImageSize().width;
-			int height = zed_camera->getImageSize().height;
-			cv::Mat cam_temp = cv::Mat(height, width * 2, CV_8UC4);
-			cam_img = cv::Mat(height, width * 2, CV_8UC3);
-			cv::Mat zed_left = cv::Mat(height, width, CV_8UC4);
-			cv::Mat zed_right = cv::Mat(height, width, CV_8UC4);
-
-			if (!zed_camera->grab(sl::zed::SENSING_MODE::STANDARD))
-			{
-				// Retrieve left color image
-				sl::zed::Mat zedMat, zedMat2;
-				zedMat = zed_camera->retrieveImage(sl::zed::SIDE::LEFT);
-				memcpy(zed_left.data, zedMat.data, width * height * 4 * sizeof(uchar));
-				zedMat2 = zed_camera->retrieveImage(sl::zed::SIDE::RIGHT);
-				memcpy(zed_right.data, zedMat2.data, width * height * 4 * sizeof(uchar));//width*height * 4 * sizeof(uchar));
-				cv::Mat zed_roi = cam_temp(cv::Range(0, height), cv::Range(0, width));
-				zed_left.copyTo(zed_roi);
-				zed_roi = cam_temp(cv::Range(0, height), cv::Range(width, 2*width));
-				zed_right.copyTo(zed_roi);
-
-				cv::cvtColor(cam_temp, cam_img, cv::COLOR_BGRA2BGR);
-			}
-		}
-		else
-			this->video_cap >> cam_img;
+		// user finish
+		if (!thread_end)
+			break;
 
-		// end of video stream
-		if (cam_img.empty())
-		{
-			EndStream();
+		// wait for this frame's slot
+		if (is_paced)
+			this->frame_pacer.WaitNextFrame();
+
+		// wait for the device first so a full ring only drops when the new frame is ready
+		enum KGrabResult grabbed = source->Grab();
+		if (grabbed == KGrabResult::GRAB_RETRY)
+			continue;
+		if (grabbed == KGrabResult::GRAB_END)
 			break;
-		}
+		struct KFrameTime frame_time;
+		frame_time.grab_us = av_gettime_relative();
 
-		// user finish
-		if (!thread_end)
-		{
-			// write last frame
-			if (!this->ffmpeg.StreamImage(cam_img, true))
-				this->last_error = KStreamerError::FFMPEG_ERROR;
+		cv::Mat* slot = this->frame_ring.BeginPush();
+		if (!slot)
 			break;
-		}
-		
-		// write frame
-		if (!this->ffmpeg.StreamImage(cam_img, false))
-			this->last_error = KStreamerError::FFMPEG_ERROR;
 
-		// occur event
-		if (this->sendEvent != NULL)
+		// end of video stream
+		if (!source->Retrieve(*slot, this->frame_pool))
+			break;
+		frame_time.queued_us = av_gettime_relative();
+		this->frame_ring.EndPush(frame_time);
+		this->capture_hist.Record(frame_time.queued_us - frame_time.grab_us);
+
+		int queue_depth = this->frame_ring.Size();
+		if (queue_depth > this->max_queue_depth)
+			this->max_queue_depth = queue_depth;
+
+		if (this->send_engine)
+			this->send_engine->Schedule(this);
+	}
+
+	// let the sender drain what is left
+	this->frame_ring.Close();
+}
+
+void KStreamer::SendStream()
+{
+	struct KFrameTime frame_time;
+
+	begin_send();
+	// encode until the capturer closes the ring and every queued frame is sent
+	while (this->frame_ring.WaitPop(this->send_img, &frame_time))
+		send_frame(this->send_img, frame_time);
+	end_send(this->send_img);
+}
+
+void KStreamer::begin_send()
+{
+	if (this->is_adaptive)
+	{
+		// bounds default to a quarter and the whole of the configured rate
+		int64_t bit_rate = this->ffmpeg.GetBitRate();
+		int64_t max_bit_rate = this->adaptive_max_bit_rate > 0 ? this->adaptive_max_bit_rate : bit_rate;
+		int64_t min_bit_rate = this->adaptive_min_bit_rate > 0 ? this->adaptive_min_bit_rate : max_bit_rate / 4;
+		this->bitrate_controller.Reset(bit_rate, min_bit_rate, max_bit_rate,
+									this->stream_fps, std::max(1, this->frame_queue_capacity / 2));
+		this->ffmpeg.SetBitRate(this->bitrate_controller.GetBitRate());
+	}
+	this->ffmpeg.SetFrameDecimation(1);
+
+	this->detect_config = this->change_config;
+	this->change_detector.SetThreshold(this->detect_config.block_threshold);
+	this->change_detector.Reset();
+	this->unchanged_frames = 0;
+	this->is_scene_static = false;
+	this->active_bit_rate = 0;
+	this->last_encode_us = 0;
+	this->last_keyframe_us = av_gettime_relative();
+}
+
+bool KStreamer::is_frame_needed(const cv::Mat& cam_img)
+{
+	const struct KChangeDetectConfig& config = this->detect_config;
+	if (!config.enabled)
+		return true;
+
+	int64_t start_time = av_gettime_relative();
+	double changed = this->change_detector.Compare(cam_img, this->capture_pix_fmt);
+	this->detect_hist.Record(av_gettime_relative() - start_time);
+
+	if (changed > config.changed_ratio)
+	{
+		this->unchanged_frames = 0;
+		if (this->is_scene_static)
+			set_scene_static(false);
+	}
+	else if (++this->unchanged_frames >= config.static_frames && !this->is_scene_static)
+		set_scene_static(true);
+
+	if (this->is_scene_static)
+	{
+		// a keyframe now and then, so a receiver joining an idle feed can start
+		if (config.keyframe_interval_ms > 0 &&
+			start_time - this->last_keyframe_us >= (int64_t)config.keyframe_interval_ms * 1000)
 		{
-			frame_pool[frame_pool_index] = cam_img.clone();
-			this->sendEvent(frame_pool[frame_pool_index]);
-			frame_pool_index = (frame_pool_index + 1) % STREAM_FPS;
+			this->ffmpeg.RequestKeyframe();
+			this->renditions.RequestKeyframe();
+			this->last_keyframe_us = start_time;
 		}
+		else if (config.idle_fps <= 0 || start_time - this->last_encode_us < 1000000 / config.idle_fps)
+			return false;
+	}
+
+	// compare with what the receivers have seen, a slow drift adds up
+	this->change_detector.Accept();
+	this->last_encode_us = start_time;
+	return true;
+}
+
+void KStreamer::set_scene_static(bool is_static)
+{
+	this->is_scene_static = is_static;
+
+	// the adaptive controller owns the bit rate, otherwise it drops with the scene and comes back with motion
+	if (this->is_adaptive || this->detect_config.idle_bit_rate_ratio >= 1)
+		return;
+
+	if (is_static)
+	{
+		this->active_bit_rate = this->ffmpeg.GetBitRate();
+		this->ffmpeg.SetBitRate((int64_t)(this->active_bit_rate * this->detect_config.idle_bit_rate_ratio));
+	}
+	else if (this->active_bit_rate > 0)
+	{
+		this->ffmpeg.SetBitRate(this->active_bit_rate);
+		this->active_bit_rate = 0;
+	}
+}
+
+void KStreamer::send_frame(cv::Mat& cam_img, const struct KFrameTime& frame_time)
+{
+	this->queue_hist.Record(av_gettime_relative() - frame_time.queued_us);
+
+	// nothing moved, the slot is left out of every encoding
+	if (!is_frame_needed(cam_img))
+	{
+		this->ffmpeg.SkipFrame();
+		this->renditions.SkipFrame();
+		return;
+	}
+
+	// write frame
+	if (!this->ffmpeg.StreamImage(cam_img, false, this->capture_pix_fmt, frame_time.grab_us))
+		this->last_error = KStreamerError::FFMPEG_ERROR;
+
+	// follow the backpressure of this frame
+	MyFFMPEGFrameTiming timing = this->ffmpeg.GetLastFrameTiming();
+
+	// the other encodings of the frame, the main stream's timing leads the bit rate
+	if (!this->renditions.StreamImage(cam_img, this->capture_pix_fmt))
+		this->last_error = KStreamerError::RENDITION_ERROR;
+	if (timing.is_keyframe)
+		this->last_keyframe_us = av_gettime_relative();
+	if (this->is_adaptive && timing.is_encoded &&
+		this->bitrate_controller.Update(timing.encode_us, timing.write_us, this->frame_ring.Size() + timing.send_queue))
+	{
+		this->ffmpeg.SetBitRate(this->bitrate_controller.GetBitRate());
+		this->ffmpeg.SetFrameDecimation(this->bitrate_controller.GetDecimation());
+	}
+
+	// taps hold the frame by reference, the capture thread refills its slot with another pooled buffer
+	if (!this->frame_taps.IsEmpty())
+		this->frame_taps.Publish(cam_img, this->capture_pix_fmt, frame_time.grab_us, this->frame_pool);
+}
+
+void KStreamer::end_send(cv::Mat& cam_img)
+{
+	// the next stream starts at the full bit rate
+	if (this->is_scene_static)
+		set_scene_static(false);
+
+	// drain the encoder, the frames it still holds go out before EndStream returns
+	if (!this->ffmpeg.StreamImage(cam_img, true))
+		this->last_error = KStreamerError::FFMPEG_ERROR;
+	if (!this->renditions.Flush())
+		this->last_error = KStreamerError::RENDITION_ERROR;
+}
+
+bool KStreamer::begin_send_task()
+{
+	std::lock_guard<std::mutex> lock(this->send_lock);
+	if (this->is_send_scheduled)
+		return false;
+
+	this->is_send_scheduled = true;
+	return true;
+}
+
+bool KStreamer::run_send_task()
+{
+	struct KFrameTime frame_time;
+	if (this->frame_ring.Pop(this->send_img, &frame_time))
+		send_frame(this->send_img, frame_time);
+
+	// checked under the lock, a frame queued meanwhile is either seen here or schedules a new task
+	std::lock_guard<std::mutex> lock(this->send_lock);
+	if (this->frame_ring.Size() > 0)
+		return true;
+
+	this->is_send_scheduled = false;
+	this->send_cond.notify_all();
+	return false;
+}
+
+void KStreamer::cancel_send_task()
+{
+	std::lock_guard<std::mutex> lock(this->send_lock);
+	this->is_send_scheduled = false;
+	this->send_cond.notify_all();
+}
+
+void KStreamer::ReportStats()
+{
+	std::unique_lock<std::mutex> lock(this->stats_lock);
+	std::chrono::milliseconds interval(this->stats_interval_ms);
+	std::chrono::steady_clock::time_point next_report = std::chrono::steady_clock::now() + interval;
+
+	while (true)
+	{
+		// woken early only by EndStream
+		if (this->stats_cond.wait_until(lock, next_report, [this] { return !this->is_reporting; }))
+			break;
+		next_report += interval;
+
+		// SetStatsEvent(NULL) while streaming stops the reports, not the reporter
+		void(*event)(K_IN const struct KStreamStats& stats) = this->statsEvent;
+		if (event == NULL)
+			continue;
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1000 / STREAM_FPS));
+		lock.unlock();
+		struct KStreamStats stats = GetStats();
+		event(stats);
+		lock.lock();
 	}
 }
\ No newline at end of file
@@ -1,14 +1,11 @@
 #ifndef _K_STREAMER_H_
 #define _K_STREAMER_H_
 
-#ifdef KSTREAMINGDLL_EXPORTS
-#define K_STREAMING_API __declspec(dllexport)
-#define K_STREAMING_ZED
-#else
-#define K_STREAMING_API __declspec(dllimport)
-#endif
+#include "KPlatform.h"
 
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
 
 extern "C"
@@ -25,7 +22,25 @@ extern "C"
 #endif
 
 #include "MyFFMPEGStreamer.h"
+#include "KFrameRing.h"
+#include "KFramePacer.h"
+#include "KFramePool.h"
+#include "KBitrateController.h"
+#include "KStereoComposer.h"
+#include "KFrameSource.h"
+#include "KLatencyHistogram.h"
+#include "KStreamStats.h"
+#include "KRenditionSet.h"
+#include "KFrameTap.h"
+#include "KChangeDetector.h"
+#include "KCaptureSource.h"
+#include "KV4L2Source.h"
+#include "KRawYUVSource.h"
+#include "KSyntheticSource.h"
+#include "KPushSource.h"
+#include "KZedSource.h"
 
+#ifdef _MSC_VER
 // opencv
 #pragma comment(lib, "opencv_core2413.lib")
 #pragma comment(lib, "opencv_core2413d.lib")
@@ -38,11 +53,16 @@ extern "C"
 #ifdef K_STREAMING_ZED
 #pragma comment(lib, "sl_zed64.lib")
 #endif
+#endif
+
+#define FRAME_QUEUE_CAPACITY	4
+#define STATS_INTERVAL_MS		1000
 
 enum KStreamerError{
 	CAM_NOT_OPENED = 0,
 	THREAD_NOT_CREATED = 1,
 	FFMPEG_ERROR = 9, 
+	RENDITION_ERROR = 10,
 	NO_STREAMER_ERROR = 100
 };
 
@@ -54,24 +74,43 @@ enum DEVICE_OPTION{
 	MANUAL = 120
 };
 
+class KStreamEngine;
+
 class K_STREAMING_API KStreamer
 {
+	friend class KStreamEngine;
+
 public:
 	KStreamer();
 #ifdef K_STREAMING_ZED
-	KStreamer(__in sl::zed::Camera* zed_camera, __in const sl::zed::InitParams& zed_params);
+	KStreamer(K_IN sl::zed::Camera* zed_camera, K_IN const sl::zed::InitParams& zed_params);
 #endif
 	~KStreamer();
 
 private:
 	bool is_streaming;
 	enum KStreamerError last_error;
-	// send stream from camera device to remote media server
+	// capture thread pushes frames into the ring, send thread encodes and sends them
 	std::mutex mtx_lock;
+	std::thread* capturer;
 	std::thread* sender;
-	// opencv for capture
+	std::thread* reporter;
+	KFrameRing frame_ring;
+	int frame_queue_capacity;
+	enum KFrameDropPolicy frame_drop_policy;
+	// image buffers of the capture and send threads
+	KFramePool frame_pool;
+	// capture pacing
+	int stream_fps;
+	KFramePacer frame_pacer;
+	// frames for the capture thread, from the device id or set by the user
 	int device_id;
-	cv::VideoCapture video_cap;
+	KFrameSource* frame_source;
+	KFrameSource* user_source;
+	bool is_source_owned;
+	// camera indices read through V4L2 in the camera's own YUV format instead of cv::VideoCapture
+	bool is_native_capture;
+	enum KV4L2Format native_format;
 	// zed camera
 #ifdef K_STREAMING_ZED
 	bool is_zed_outside;
@@ -80,25 +119,232 @@ private:
 #endif
 	// ffmpeg members
 	MyFFMPEGStreamer ffmpeg;
+	// extra encodings of the same frames
+	KRenditionSet renditions;
+	// adaptive bit rate
+	bool is_adaptive;
+	int64_t adaptive_min_bit_rate;
+	int64_t adaptive_max_bit_rate;
+	KBitrateController bitrate_controller;
+	// zed stereo frames go to the encoder as I420
+	KStereoComposer stereo_composer;
+	enum AVPixelFormat capture_pix_fmt;
+	cv::Mat manual_stereo_img;
+	// stream statistics of the capture side, the encoder keeps its own
+	KLatencyHistogram capture_hist;
+	KLatencyHistogram queue_hist;
+	std::atomic<int> max_queue_depth;
+	uint64_t stats_pushed_base;
+	uint64_t stats_dropped_base;
+	// periodic statistics event
+	std::mutex stats_lock;
+	std::condition_variable stats_cond;
+	bool is_reporting;
+	int stats_interval_ms;
+	// shared worker pool doing the send side instead of the sender thread, set by KStreamEngine
+	KStreamEngine* engine;
+	KStreamEngine* send_engine;
+	std::atomic<int> engine_priority;
+	int engine_worker;
+	// one engine task at a time, guarded by send_lock
+	bool is_send_scheduled;
+	std::mutex send_lock;
+	std::condition_variable send_cond;
+	cv::Mat send_img;
+	// static scene detection, the send side only reads detect_config
+	struct KChangeDetectConfig change_config;
+	struct KChangeDetectConfig detect_config;
+	KChangeDetector change_detector;
+	KLatencyHistogram detect_hist;
+	int unchanged_frames;
+	std::atomic<bool> is_scene_static;
+	int64_t last_encode_us;
+	int64_t last_keyframe_us;
+	int64_t active_bit_rate;
+	// consumers of the sent frames
+	KFrameTapSet frame_taps;
+	int send_event_tap;
+	// frame grabber
+	void CaptureStream();
 	// stream sender
 	void SendStream();
+	void begin_send();
+	void send_frame(cv::Mat& cam_img, const struct KFrameTime& frame_time);
+	void end_send(cv::Mat& cam_img);
+	// MANUAL frames to the encoder and the renditions, pix_fmt AV_PIX_FMT_NONE takes it from the Mat type
+	bool send_manual_frame(const cv::Mat& cv_img, enum AVPixelFormat pix_fmt);
+	// change detection: false if the frame can be left out of a static scene
+	bool is_frame_needed(const cv::Mat& cam_img);
+	void set_scene_static(bool is_static);
+	// engine tasks: claim the task slot, send one queued frame (true if more are waiting), give the slot back
+	bool begin_send_task();
+	bool run_send_task();
+	void cancel_send_task();
+	// statistics event caller
+	void ReportStats();
+	void start_reporter();
+	void stop_reporter();
+	// fps and threading defaults of the streams encoded here
+	MyFFMPEGEncoderConfig make_stream_config(const MyFFMPEGEncoderConfig& config);
+	KFrameSource* create_device_source();
+	void close_frame_source();
 
-	// event occur when send image successfully
-	void(*sendEvent)(__in cv::Mat& cv_img);
+	// event occur every stats interval while streaming
+	void(*statsEvent)(K_IN const struct KStreamStats& stats);
 
 public:
 	void SetFFMPEG(int img_width, int img_height, int64_t bit_rate, 
 				enum AVCodecID codec_id = AV_CODEC_ID_MPEG4, 
 				std::string ip = "127.0.0.1", int port = 8554);
+	/*
+	full encoder settings, config.fps 0 uses the rate from SetStreamFps.
+	while streaming the encoder is replaced in place, a codec change stops and restarts the stream.
+	*/
+	void SetFFMPEG(const MyFFMPEGEncoderConfig& config,
+				std::string ip = "127.0.0.1", int port = 8554);
+	// H.264 with intra refresh, RTP sized slices and no B-frames for sub-100 ms streaming
+	void SetLowLatencyFFMPEG(int img_width, int img_height, int64_t bit_rate,
+				std::string ip = "127.0.0.1", int port = 8554);
+	/*
+	change the encoder of a running stream without stopping it, SetFFMPEG does the same while streaming.
+	a new bit rate applies from the next frame, other settings from the next keyframe of an encoder
+	opened in the background. false if SetFFMPEG was not called yet or the codec differs,
+	SetFFMPEG then restarts the stream instead.
+	*/
+	bool Reconfigure(const MyFFMPEGEncoderConfig& config);
+	// send the SetFFMPEG stream to another receiver
+	bool SetDestination(std::string ip, int port);
 	void SetCamDeviceID(int id);
+	/*
+	capture from source instead of the device of SetCamDeviceID, NULL goes back to the device.
+	the source is not owned and must outlive the stream. applied on next StartStream.
+	*/
+	void SetFrameSource(KFrameSource* source);
+	/*
+	read the camera of SetCamDeviceID through V4L2 in its own format (NV12, YUYV or MJPEG), Linux only.
+	the frames reach the encoder as I420 without a BGR round trip, at the SetFFMPEG size if the camera has it.
+	BGR is only made for frame taps that ask for it. applied on next StartStream.
+	*/
+	void SetNativeCapture(bool enable, enum KV4L2Format format = V4L2_FORMAT_AUTO);
+	// send a keyframe as soon as possible
+	void RequestKeyframe();
+	/*
+	let the bit rate follow send backpressure within [min_bit_rate, max_bit_rate].
+	under heavy congestion the frame rate is stepped down too. applied on next StartStream.
+	*/
+	void SetAdaptiveBitrate(bool enable, int64_t min_bit_rate = 0, int64_t max_bit_rate = 0);
+	int64_t GetCurrentBitRate();
+	/*
+	extra outputs of the same encoded stream, available after SetFFMPEG.
+	each returns an output id for RemoveOutput, -1 on failure.
+	*/
+	int AddDestination(std::string ip, int port);
+	int AddRecording(std::string path);
+	/*
+	record locally into segment_count memory-mapped MPEG-TS files of segment_size bytes in directory,
+	the oldest is overwritten when the ring is full. a segment starts at a keyframe and plays on its own.
+	*/
+	int AddSegmentRecording(std::string directory, int segment_count = SEGMENT_COUNT, size_t segment_size = SEGMENT_SIZE);
+	// recorded segment files of a segment recording, oldest first
+	std::vector<std::string> GetRecordingSegments(int output_id);
+	/*
+	buffer the last max_seconds of the encoded stream, bounded by max_bytes, for ExportClip.
+	compressed packets are kept, at a few Mbit/s half a minute costs some megabytes.
+	*/
+	int AddClipBuffer(int max_seconds = CLIP_RING_SECONDS, size_t max_bytes = CLIP_RING_BYTES);
+	/*
+	save what a clip buffer holds from before_ms ahead of now to after_ms from now into path (.mkv or .ts),
+	starting at the keyframe before. written in the background, returns a clip id, -1 on failure.
+	*/
+	int ExportClip(int output_id, std::string path, int before_ms, int after_ms);
+	bool RemoveOutput(int output_id);
+	/*
+	encode every captured frame once more, downscaled or cropped, with its own settings and destination.
+	scaled renditions are one cascade (full, half, quarter, eighth), each level box-filtered from the one above.
+	config width and height 0 take the size of the level of the SetFFMPEG encoder, or of the crop.
+	the name is for FindRendition, returns a rendition id, -1 on failure.
+	*/
+	int AddRendition(std::string name, enum KRenditionScale scale, const MyFFMPEGEncoderConfig& config,
+					std::string ip, int port);
+	int AddCropRendition(std::string name, cv::Rect roi, const MyFFMPEGEncoderConfig& config,
+					std::string ip, int port);
+	// drains and closes the rendition's encoder
+	bool RemoveRendition(int rendition_id);
+	int FindRendition(std::string name);
+	struct KStreamStats GetRenditionStats(int rendition_id);
+	// spread the datagrams of large frames over the frame interval on RTP outputs, on by default
+	void SetSendPacing(bool enable);
+	// swscale flags for the encoder's conversion, SWS_FAST_BILINEAR or SWS_POINT for latency-sensitive streams
+	void SetScaler(int sws_flags);
+	// convert in slice_count horizontal slices on as many cores, 0 picks from the frame size and the cores
+	void SetConvertSlices(int slice_count);
+	// show or move the time stamp overlay
+	void SetTimestampOverlay(bool enable, int x = 20, int y = 20);
+	/*
+	skip frames of a static scene: once nothing moved for config.static_frames frames, only idle_fps frames
+	per second are encoded, plus a keyframe every keyframe_interval_ms. the first changed frame resumes the full rate.
+	applied on next StartStream.
+	*/
+	void SetChangeDetection(const struct KChangeDetectConfig& config);
+	bool IsSceneStatic();
+	/*
+	set the frame queue between capture and encoding. applied on next StartStream.
+	DROP_OLDEST keeps the camera at its native rate, BLOCK never loses a captured frame.
+	*/
+	void SetFrameQueue(int capacity, enum KFrameDropPolicy drop_policy = KFrameDropPolicy::DROP_OLDEST);
+	uint64_t GetDroppedFrames();
+	// buffers allocated by the frame pool, stops growing once streaming has warmed up
+	uint64_t GetAllocationCount();
+	/*
+	packing of ZED_CAMERA_STEREO frames, applied from the next frame. the encoder size set with SetFFMPEG
+	should match: SIDE_BY_SIDE 2w x h, TOP_BOTTOM w x 2h, the half layouts w x h.
+	*/
+	void SetStereoLayout(enum KStereoLayout layout);
+	/*
+	set target capture rate. also used as encoder time base by following SetFFMPEG calls.
+	*/
+	void SetStreamFps(int fps);
+	double GetAchievedFps();
+	// how late the last frame started against its deadline, in microseconds
+	int64_t GetFrameLateness();
+	uint64_t GetSkippedFrameSlots();
+	/*
+	per stage latency percentiles and frame, packet and byte counters since StartStream or ResetStats.
+	recording is lock-free, a snapshot may be taken from any thread at any time.
+	*/
+	struct KStreamStats GetStats();
+	void ResetStats();
 	bool StartStream();
 	void EndStream();
-	bool SendFrameManually(__in const cv::Mat& cv_img);
+	bool SendFrameManually(K_IN const cv::Mat& cv_img);
+	// compose two BGRA eye images of the same size with the stereo layout and send them, MANUAL only
+	bool SendStereoFrameManually(K_IN const cv::Mat& left_img, K_IN const cv::Mat& right_img);
 	int GetLastError();
 	/*
-	set event to get image when streamer succesfully send.
+	subscribe to the sent frames. every tap gets a reference to the frame, no copy, on a thread of its own
+	through a queue of capacity frames: a slow tap loses its oldest frames (DROP_OLDEST) and never the stream's,
+	BLOCK holds up the stream instead. TAP_FORMAT_BGR and TAP_FORMAT_I420 convert once per frame for all taps.
+	returns a tap id for RemoveFrameTap.
+	*/
+	int AddFrameTap(const KTapCallback& callback, enum KTapFormat format = KTapFormat::TAP_FORMAT_NATIVE,
+					int capacity = TAP_QUEUE_CAPACITY, enum KFrameDropPolicy drop_policy = KFrameDropPolicy::DROP_OLDEST);
+	int AddFrameTap(void(*callback)(K_IN const struct KTapFrame& frame, void* context), void* context,
+					enum KTapFormat format = KTapFormat::TAP_FORMAT_NATIVE,
+					int capacity = TAP_QUEUE_CAPACITY, enum KFrameDropPolicy drop_policy = KFrameDropPolicy::DROP_OLDEST);
+	// not from the tap's own callback
+	bool RemoveFrameTap(int tap_id);
+	uint64_t GetTapDroppedFrames(int tap_id);
+	/*
+	set event to get image when streamer succesfully send, NULL to stop. a BGR frame tap:
+	called from the tap's thread, copy the cv::Mat header to keep the image beyond the call and don't write it.
+	*/
+	void SetSendEvent(void(*sendEvent)(K_IN cv::Mat& cv_img));
+	/*
+	set event to get GetStats() every interval_ms while streaming, NULL to stop. a running reporter switches to the
+	new event at once, the interval and an event set while none was running apply on next StartStream.
+	it is called from a thread of its own, a slow event never holds up capture or encoding.
 	*/
-	void SetSendEvent(void(*sendEvent)(__in cv::Mat& cv_img));
+	void SetStatsEvent(void(*statsEvent)(K_IN const struct KStreamStats& stats), int interval_ms = STATS_INTERVAL_MS);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "KSyntheticSource.h"
+
+// horizontal speed of the box in pixels per frame
+#define SYNTHETIC_BOX_SPEED		8
+
+// 75% bars in BGR, limited range: white, yellow, cyan, green, magenta, red, blue, black
+static const uint8_t synthetic_bars[8][3] = {
+	{ 180, 180, 180 }, { 16, 180, 180 }, { 180, 180, 16 }, { 16, 180, 16 },
+	{ 180, 16, 180 }, { 16, 16, 180 }, { 180, 16, 16 }, { 16, 16, 16 }
+};
+
+KSyntheticSource::KSyntheticSource(int width, int height, enum AVPixelFormat pix_fmt, uint64_t frame_limit)
+	: width(width), height(height), pix_fmt(pix_fmt), frame_limit(frame_limit), pattern(), frame_index(0)
+{}
+
+KSyntheticSource::~KSyntheticSource()
+{}
+
+bool KSyntheticSource::Open()
+{
+	if (this->width < 16 || this->height < 16)
+		return false;
+	if (this->pix_fmt != AV_PIX_FMT_BGR24 && this->pix_fmt != AV_PIX_FMT_YUV420P)
+		return false;
+	if (this->pix_fmt == AV_PIX_FMT_YUV420P && (this->width % 2 || this->height % 2))
+		return false;
+
+	// bars over the upper three quarters, a black to white ramp below
+	cv::Mat bgr(this->height, this->width, CV_8UC3);
+	int bar_height = this->height * 3 / 4;
+	for (int y = 0; y < this->height; y++)
+	{
+		uint8_t *row = bgr.ptr<uint8_t>(y);
+		for (int x = 0; x < this->width; x++)
+		{
+			if (y < bar_height)
+			{
+				const uint8_t *bar = synthetic_bars[x * 8 / this->width];
+				row[3 * x] = bar[0];
+				row[3 * x + 1] = bar[1];
+				row[3 * x + 2] = bar[2];
+			}
+			else
+				row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = (uint8_t)(16 + x * 219 / (this->width - 1));
+		}
+	}
+
+	if (this->pix_fmt == AV_PIX_FMT_YUV420P)
+		cv::cvtColor(bgr, this->pattern, cv::COLOR_BGR2YUV_I420);
+	else
+		this->pattern = bgr;
+
+	this->frame_index = 0;
+	return true;
+}
+
+void KSyntheticSource::Close()
+{
+	this->pattern.release();
+}
+
+enum KGrabResult KSyntheticSource::Grab()
+{
+	if (this->frame_limit > 0 && this->frame_index >= this->frame_limit)
+		return KGrabResult::GRAB_END;
+
+	return KGrabResult::GRAB_FRAME;
+}
+
+bool KSyntheticSource::Retrieve(cv::Mat& cv_img, KFramePool& pool)
+{
+	pool.Prepare(cv_img, this->pattern.rows, this->pattern.cols, this->pattern.type());
+	this->pattern.copyTo(cv_img);
+
+	// the box position only depends on the frame index, even so it stays on whole chroma blocks
+	uint64_t index = this->frame_index++;
+	int box = std::max(2, this->height / 8) & ~1;
+	int x = (int)((index * SYNTHETIC_BOX_SPEED) % (uint64_t)(this->width - box + 1)) & ~1;
+	int y = ((this->height - box) / 2) & ~1;
+
+	// for I420 the first height rows are the luma plane
+	cv::Mat box_roi = cv_img(cv::Rect(x, y, box, box));
+	if (this->pix_fmt == AV_PIX_FMT_YUV420P)
+		box_roi.setTo(cv::Scalar(235));
+	else
+		box_roi.setTo(cv::Scalar(235, 235, 235));
+
+	return true;
+}
+
+enum AVPixelFormat KSyntheticSource::GetPixelFormat()
+{
+	// BGR is recognized from the Mat type
+	return this->pix_fmt == AV_PIX_FMT_YUV420P ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_NONE;
+}
+
+uint64_t KSyntheticSource::GetFrameIndex()
+{
+	return this->frame_index;
+}
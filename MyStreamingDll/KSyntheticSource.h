@@ -0,0 +1,41 @@
+#ifndef _K_SYNTHETIC_SOURCE_H_
+#define _K_SYNTHETIC_SOURCE_H_
+
+#include <cstdint>
+#include <atomic>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#include "KFrameSource.h"
+
+/*
+deterministic test pattern for headless runs: color bars over a gray ramp with a white box
+sweeping across, frame n is the same on every run. the rate is the stream rate of KStreamer.
+BGR24 frames exercise the full conversion path, YUV420P frames go to the encoder as they are.
+*/
+class K_STREAMING_API KSyntheticSource : public KFrameSource
+{
+public:
+	// frame_limit 0 streams until EndStream
+	KSyntheticSource(int width, int height, enum AVPixelFormat pix_fmt = AV_PIX_FMT_BGR24, uint64_t frame_limit = 0);
+	~KSyntheticSource();
+
+private:
+	int width;
+	int height;
+	enum AVPixelFormat pix_fmt;
+	uint64_t frame_limit;
+	// the still part, rendered once in Open
+	cv::Mat pattern;
+	std::atomic<uint64_t> frame_index;
+
+public:
+	bool Open();
+	void Close();
+	enum KGrabResult Grab();
+	bool Retrieve(cv::Mat& cv_img, KFramePool& pool);
+	enum AVPixelFormat GetPixelFormat();
+	uint64_t GetFrameIndex();
+};
+
+#endif
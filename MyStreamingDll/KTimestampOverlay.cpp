@@ -0,0 +1,210 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <algorithm>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OVERLAY_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "KTimestampOverlay.h"
+
+#define OVERLAY_FONT		cv::FONT_HERSHEY_SIMPLEX
+#define OVERLAY_THICKNESS	2
+#if CV_MAJOR_VERSION >= 3
+#define OVERLAY_LINE_TYPE	cv::LINE_AA
+#else
+#define OVERLAY_LINE_TYPE	CV_AA
+#endif
+
+KTimestampOverlay::KTimestampOverlay()
+	: atlas(), cell_width(0), cell_height(0), ascent(0), atlas_scale(0.0), text_mask(),
+	is_enabled(true), pos_x(20), pos_y(20), font_scale(0.75)
+{
+	memset(this->glyph_advance, 0, sizeof(this->glyph_advance));
+}
+
+KTimestampOverlay::~KTimestampOverlay()
+{}
+
+void KTimestampOverlay::SetEnabled(bool enable)
+{
+	this->is_enabled = enable;
+}
+
+bool KTimestampOverlay::IsEnabled()
+{
+	return this->is_enabled;
+}
+
+void KTimestampOverlay::SetPosition(int x, int y)
+{
+	this->pos_x = x;
+	this->pos_y = y;
+}
+
+void KTimestampOverlay::SetFontScale(double scale)
+{
+	if (scale > 0.0)
+		this->font_scale = scale;
+}
+
+void KTimestampOverlay::Render(uint8_t* luma, int linesize, int width, int height)
+{
+	if (!this->is_enabled)
+		return;
+
+	double scale = this->font_scale;
+	if (scale != this->atlas_scale)
+		build_atlas(scale);
+
+	char timebuf[OVERLAY_MAX_TEXT];
+	format_time(timebuf);
+	int text_width = compose_text(timebuf);
+
+	int x0 = this->pos_x - OVERLAY_THICKNESS;
+	int y0 = this->pos_y - this->ascent;
+	int cx0 = std::max(0, x0);
+	int cx1 = std::min(width, x0 + text_width);
+	if (cx1 <= cx0)
+		return;
+
+	for (int r = 0; r < this->cell_height; r++)
+	{
+		int y = y0 + r;
+		if (y < 0 || y >= height)
+			continue;
+
+		blend_row(luma + (size_t)y * linesize + cx0, this->text_mask.ptr(r) + (cx0 - x0), cx1 - cx0);
+	}
+}
+
+void KTimestampOverlay::build_atlas(double scale)
+{
+	const char* glyphs = OVERLAY_GLYPHS;
+	int glyph_count = (int)strlen(glyphs);
+	int max_width = 0, max_height = 0, max_baseline = 0;
+
+	for (int i = 0; i < glyph_count; i++)
+	{
+		int baseline = 0;
+		cv::Size size = cv::getTextSize(std::string(1, glyphs[i]), OVERLAY_FONT, scale, OVERLAY_THICKNESS, &baseline);
+		this->glyph_advance[i] = size.width;
+		max_width = std::max(max_width, size.width);
+		max_height = std::max(max_height, size.height);
+		max_baseline = std::max(max_baseline, baseline);
+	}
+
+	// leave room for the stroke thickness around every glyph
+	this->cell_width = max_width + OVERLAY_THICKNESS * 2;
+	this->ascent = max_height + OVERLAY_THICKNESS;
+	this->cell_height = this->ascent + max_baseline + OVERLAY_THICKNESS;
+
+	this->atlas.create(this->cell_height, this->cell_width * glyph_count, CV_8UC1);
+	this->atlas.setTo(cv::Scalar::all(0));
+	for (int i = 0; i < glyph_count; i++)
+	{
+		cv::Mat cell = this->atlas(cv::Rect(i * this->cell_width, 0, this->cell_width, this->cell_height));
+		cv::putText(cell, std::string(1, glyphs[i]), cv::Point(OVERLAY_THICKNESS, this->ascent),
+					OVERLAY_FONT, scale, cv::Scalar::all(255), OVERLAY_THICKNESS, OVERLAY_LINE_TYPE);
+	}
+
+	this->text_mask.create(this->cell_height, this->cell_width * OVERLAY_MAX_TEXT, CV_8UC1);
+	this->atlas_scale = scale;
+}
+
+int KTimestampOverlay::compose_text(const char* text)
+{
+	const char* glyphs = OVERLAY_GLYPHS;
+	int x = 0, width = 0;
+
+	this->text_mask.setTo(cv::Scalar::all(0));
+
+	for (const char* ch = text; *ch && x + this->cell_width <= this->text_mask.cols; ch++)
+	{
+		const char* found = strchr(glyphs, *ch);
+		if (!found)
+		{
+			x += this->cell_width / 2;
+			continue;
+		}
+
+		int index = (int)(found - glyphs);
+		for (int r = 0; r < this->cell_height; r++)
+		{
+			uint8_t* dst = this->text_mask.ptr(r) + x;
+			const uint8_t* src = this->atlas.ptr(r) + index * this->cell_width;
+			// neighbouring cells may overlap by the stroke thickness
+			for (int i = 0; i < this->cell_width; i++)
+				dst[i] = std::max(dst[i], src[i]);
+		}
+
+		width = x + this->cell_width;
+		x += this->glyph_advance[index];
+	}
+
+	return width;
+}
+
+void KTimestampOverlay::blend_row(uint8_t* dst, const uint8_t* alpha, int width)
+{
+	// white text: dst + (255 - dst) * alpha / 255
+	int x = 0;
+
+#ifdef OVERLAY_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i white = _mm_set1_epi16(255);
+	const __m128i round = _mm_set1_epi16(128);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(alpha + x));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) == 0xFFFF)
+			continue;
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + x));
+
+		__m128i d_lo = _mm_unpacklo_epi8(d, zero);
+		__m128i d_hi = _mm_unpackhi_epi8(d, zero);
+		__m128i a_lo = _mm_unpacklo_epi8(a, zero);
+		__m128i a_hi = _mm_unpackhi_epi8(a, zero);
+
+		// t = (255 - d) * a + 128, t / 255 ~= (t + (t >> 8)) >> 8
+		__m128i t_lo = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(white, d_lo), a_lo), round);
+		__m128i t_hi = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(white, d_hi), a_hi), round);
+		t_lo = _mm_srli_epi16(_mm_add_epi16(t_lo, _mm_srli_epi16(t_lo, 8)), 8);
+		t_hi = _mm_srli_epi16(_mm_add_epi16(t_hi, _mm_srli_epi16(t_hi, 8)), 8);
+
+		d = _mm_packus_epi16(_mm_add_epi16(d_lo, t_lo), _mm_add_epi16(d_hi, t_hi));
+		_mm_storeu_si128((__m128i*)(dst + x), d);
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		int t = (255 - dst[x]) * alpha[x] + 128;
+		dst[x] = (uint8_t)(dst[x] + ((t + (t >> 8)) >> 8));
+	}
+}
+
+void KTimestampOverlay::format_time(char* timebuf)
+{
+	std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+	std::time_t rawtime = std::chrono::system_clock::to_time_t(now);
+	int millis = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+	struct std::tm timeinfo;
+
+#ifdef _WIN32
+	localtime_s(&timeinfo, &rawtime);
+#else
+	localtime_r(&rawtime, &timeinfo);
+#endif
+
+	sprintf(timebuf, "%04d:%02d:%02d-%02d:%02d:%02d:%03d",
+			timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+			timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, millis);
+}
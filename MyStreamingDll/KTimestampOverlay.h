@@ -0,0 +1,53 @@
+#ifndef _K_TIMESTAMP_OVERLAY_H_
+#define _K_TIMESTAMP_OVERLAY_H_
+
+#include <cstdint>
+#include <atomic>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#define OVERLAY_GLYPHS		"0123456789:-"
+#define OVERLAY_MAX_TEXT	32
+
+/*
+draws the local time as "YYYY:MM:DD-hh:mm:ss:mmm" into an 8-bit luma plane.
+glyphs are rasterized once into an alpha atlas, every frame only composes the text mask
+and alpha blends it (SSE2 when available) over the plane.
+*/
+class KTimestampOverlay
+{
+public:
+	KTimestampOverlay();
+	~KTimestampOverlay();
+
+private:
+	// glyph atlas, one cell per character of OVERLAY_GLYPHS
+	cv::Mat atlas;
+	int cell_width;
+	int cell_height;
+	int ascent;
+	int glyph_advance[sizeof(OVERLAY_GLYPHS) - 1];
+	double atlas_scale;
+	// composed text mask, reused every frame
+	cv::Mat text_mask;
+	// settings, may be changed from another thread
+	std::atomic<bool> is_enabled;
+	std::atomic<int> pos_x;
+	std::atomic<int> pos_y;
+	std::atomic<double> font_scale;
+
+	void build_atlas(double scale);
+	int compose_text(const char* text);
+	void blend_row(uint8_t* dst, const uint8_t* alpha, int width);
+	void format_time(char* timebuf);
+
+public:
+	void SetEnabled(bool enable);
+	bool IsEnabled();
+	// text origin (bottom-left of the text, as cv::putText)
+	void SetPosition(int x, int y);
+	void SetFontScale(double scale);
+	void Render(uint8_t* luma, int linesize, int width, int height);
+};
+
+#endif
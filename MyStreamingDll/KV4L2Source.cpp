@@ -0,0 +1,423 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#endif
+#include "KV4L2Source.h"
+#include "KYUVConverter.h"
+
+KV4L2Source::KV4L2Source(int device_id, int width, int height, int fps, enum KV4L2Format format)
+	: path("/dev/video" + std::to_string(device_id)), width(width), height(height), fps(fps), format(format),
+	active_format(format), active_width(0), active_height(0), stride(0), fd(-1), buffers(),
+	dequeued(-1), dequeued_bytes(0), jpeg_ctx(NULL), jpeg_pkt(NULL), jpeg_frame(NULL), jpeg_sws(NULL)
+{}
+
+KV4L2Source::~KV4L2Source()
+{
+	Close();
+}
+
+enum AVPixelFormat KV4L2Source::GetPixelFormat()
+{
+	return AV_PIX_FMT_YUV420P;
+}
+
+bool KV4L2Source::NeedsPacing()
+{
+	// Grab waits for the camera, which runs at the rate it was set to
+	return false;
+}
+
+enum KV4L2Format KV4L2Source::GetFormat()
+{
+	return this->active_format;
+}
+
+cv::Size KV4L2Source::GetFrameSize()
+{
+	return cv::Size(this->active_width, this->active_height);
+}
+
+#ifdef __linux__
+int KV4L2Source::retry_ioctl(int fd, unsigned long request, void* arg)
+{
+	int ret;
+	do {
+		ret = ioctl(fd, request, arg);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+bool KV4L2Source::Open()
+{
+	Close();
+
+	this->fd = open(this->path.c_str(), O_RDWR | O_NONBLOCK);
+	if (this->fd < 0)
+	{
+		fprintf(stderr, "Could not open '%s': %s\n", this->path.c_str(), strerror(errno));
+		return false;
+	}
+
+	struct v4l2_capability cap;
+	memset(&cap, 0, sizeof(cap));
+	if (retry_ioctl(this->fd, VIDIOC_QUERYCAP, &cap) < 0)
+	{
+		Close();
+		return false;
+	}
+	unsigned int caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+	if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+	{
+		fprintf(stderr, "'%s' is not a streaming capture device\n", this->path.c_str());
+		Close();
+		return false;
+	}
+
+	/* the chroma of NV12 is kept as it is, YUYV loses half its rows, MJPEG has to be decoded */
+	bool is_set = false;
+	if (this->format == KV4L2Format::V4L2_FORMAT_AUTO)
+	{
+		is_set = set_format(KV4L2Format::V4L2_FORMAT_NV12) || set_format(KV4L2Format::V4L2_FORMAT_YUYV) ||
+			set_format(KV4L2Format::V4L2_FORMAT_MJPEG);
+	}
+	else
+		is_set = set_format(this->format);
+	if (!is_set)
+	{
+		fprintf(stderr, "'%s' offers none of the requested formats\n", this->path.c_str());
+		Close();
+		return false;
+	}
+
+	if (this->fps > 0)
+	{
+		// a camera that cannot set its rate keeps its own
+		struct v4l2_streamparm parm;
+		memset(&parm, 0, sizeof(parm));
+		parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		parm.parm.capture.timeperframe.numerator = 1;
+		parm.parm.capture.timeperframe.denominator = this->fps;
+		retry_ioctl(this->fd, VIDIOC_S_PARM, &parm);
+	}
+
+	if (this->active_format == KV4L2Format::V4L2_FORMAT_MJPEG && !open_jpeg_decoder())
+	{
+		Close();
+		return false;
+	}
+
+	if (!map_buffers())
+	{
+		Close();
+		return false;
+	}
+
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (retry_ioctl(this->fd, VIDIOC_STREAMON, &type) < 0)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool KV4L2Source::set_format(enum KV4L2Format format)
+{
+	unsigned int fourcc;
+	switch (format)
+	{
+	case KV4L2Format::V4L2_FORMAT_YUYV:
+		fourcc = V4L2_PIX_FMT_YUYV;
+		break;
+	case KV4L2Format::V4L2_FORMAT_NV12:
+		fourcc = V4L2_PIX_FMT_NV12;
+		break;
+	case KV4L2Format::V4L2_FORMAT_MJPEG:
+		fourcc = V4L2_PIX_FMT_MJPEG;
+		break;
+	default:
+		return false;
+	}
+
+	struct v4l2_format fmt;
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (retry_ioctl(this->fd, VIDIOC_G_FMT, &fmt) < 0)
+		return false;
+
+	if (this->width > 0 && this->height > 0)
+	{
+		fmt.fmt.pix.width = this->width;
+		fmt.fmt.pix.height = this->height;
+	}
+	fmt.fmt.pix.pixelformat = fourcc;
+	fmt.fmt.pix.field = V4L2_FIELD_ANY;
+
+	// the driver answers with the nearest it supports, another pixel format means this one is not
+	if (retry_ioctl(this->fd, VIDIOC_S_FMT, &fmt) < 0 || fmt.fmt.pix.pixelformat != fourcc)
+		return false;
+	if (fmt.fmt.pix.width < 2 || fmt.fmt.pix.height < 2 || fmt.fmt.pix.width % 2 || fmt.fmt.pix.height % 2)
+		return false;
+
+	this->active_format = format;
+	this->active_width = fmt.fmt.pix.width;
+	this->active_height = fmt.fmt.pix.height;
+	this->stride = fmt.fmt.pix.bytesperline;
+	if (this->stride == 0)
+		this->stride = format == KV4L2Format::V4L2_FORMAT_YUYV ? this->active_width * 2 : this->active_width;
+	return true;
+}
+
+bool KV4L2Source::map_buffers()
+{
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count = V4L2_BUFFER_COUNT;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (retry_ioctl(this->fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2)
+		return false;
+
+	for (unsigned int i = 0; i < req.count; i++)
+	{
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (retry_ioctl(this->fd, VIDIOC_QUERYBUF, &buf) < 0)
+			return false;
+
+		void* data = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, buf.m.offset);
+		if (data == MAP_FAILED)
+			return false;
+
+		struct KV4L2Buffer mapped = { data, buf.length };
+		this->buffers.push_back(mapped);
+
+		if (retry_ioctl(this->fd, VIDIOC_QBUF, &buf) < 0)
+			return false;
+	}
+
+	return true;
+}
+
+void KV4L2Source::Close()
+{
+	if (this->fd >= 0)
+	{
+		enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		retry_ioctl(this->fd, VIDIOC_STREAMOFF, &type);
+	}
+	this->dequeued = -1;
+
+	for (size_t i = 0; i < this->buffers.size(); i++)
+		munmap(this->buffers[i].data, this->buffers[i].size);
+	this->buffers.clear();
+
+	if (this->fd >= 0)
+		close(this->fd);
+	this->fd = -1;
+
+	if (this->jpeg_sws)
+		sws_freeContext(this->jpeg_sws);
+	this->jpeg_sws = NULL;
+	av_frame_free(&this->jpeg_frame);
+	av_packet_free(&this->jpeg_pkt);
+	avcodec_free_context(&this->jpeg_ctx);
+}
+
+void KV4L2Source::requeue()
+{
+	if (this->dequeued < 0)
+		return;
+
+	struct v4l2_buffer buf;
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = this->dequeued;
+	retry_ioctl(this->fd, VIDIOC_QBUF, &buf);
+	this->dequeued = -1;
+}
+
+enum KGrabResult KV4L2Source::Grab()
+{
+	if (this->fd < 0)
+		return KGrabResult::GRAB_END;
+
+	// a frame grabbed but never retrieved goes back to the driver
+	requeue();
+
+	struct pollfd pfd;
+	pfd.fd = this->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int ret = poll(&pfd, 1, V4L2_GRAB_TIMEOUT_MS);
+	if (ret == 0 || (ret < 0 && errno == EINTR))
+		return KGrabResult::GRAB_RETRY;
+	if (ret < 0 || (pfd.revents & (POLLERR | POLLHUP)))
+		return KGrabResult::GRAB_END;
+
+	struct v4l2_buffer buf;
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	if (retry_ioctl(this->fd, VIDIOC_DQBUF, &buf) < 0)
+		return errno == EAGAIN ? KGrabResult::GRAB_RETRY : KGrabResult::GRAB_END;
+
+	this->dequeued = buf.index;
+	this->dequeued_bytes = buf.bytesused;
+
+	// a frame the driver marked as corrupt is skipped
+	if (buf.flags & V4L2_BUF_FLAG_ERROR)
+	{
+		requeue();
+		return KGrabResult::GRAB_RETRY;
+	}
+
+	return KGrabResult::GRAB_FRAME;
+}
+
+bool KV4L2Source::Retrieve(cv::Mat& cv_img, KFramePool& pool)
+{
+	if (this->dequeued < 0)
+		return false;
+
+	const uint8_t* data = (const uint8_t*)this->buffers[this->dequeued].data;
+	pool.Prepare(cv_img, this->active_height * 3 / 2, this->active_width, CV_8UC1);
+
+	bool is_read = true;
+	switch (this->active_format)
+	{
+	case KV4L2Format::V4L2_FORMAT_YUYV:
+	case KV4L2Format::V4L2_FORMAT_NV12:
+	{
+		enum KYUVLayout layout = this->active_format == KV4L2Format::V4L2_FORMAT_YUYV ?
+			KYUVLayout::YUV_LAYOUT_YUYV : KYUVLayout::YUV_LAYOUT_NV12;
+		bool is_yuyv = layout == KYUVLayout::YUV_LAYOUT_YUYV;
+		int64_t rows = is_yuyv ? this->active_height : this->active_height * 3 / 2;
+		int64_t row_bytes = is_yuyv ? this->active_width * 2 : this->active_width;
+		// a short buffer would be read past its end, the last row may come without padding
+		is_read = (int64_t)this->dequeued_bytes >= (rows - 1) * this->stride + row_bytes;
+		if (is_read)
+			KYUVConverter::ToI420(layout, data, this->stride, this->active_width, this->active_height, cv_img);
+		break;
+	}
+	case KV4L2Format::V4L2_FORMAT_MJPEG:
+		is_read = decode_jpeg(data, this->dequeued_bytes, cv_img);
+		break;
+	default:
+		is_read = false;
+		break;
+	}
+
+	requeue();
+	return is_read;
+}
+
+bool KV4L2Source::open_jpeg_decoder()
+{
+	AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+	if (!codec)
+		return false;
+
+	this->jpeg_ctx = avcodec_alloc_context3(codec);
+	this->jpeg_pkt = av_packet_alloc();
+	this->jpeg_frame = av_frame_alloc();
+	if (!this->jpeg_ctx || !this->jpeg_pkt || !this->jpeg_frame)
+		return false;
+
+	// one frame in, one frame out, frame threading would add a frame of delay
+	this->jpeg_ctx->thread_count = 1;
+	return avcodec_open2(this->jpeg_ctx, codec, NULL) >= 0;
+}
+
+bool KV4L2Source::decode_jpeg(const uint8_t* data, size_t size, cv::Mat& dst)
+{
+	// the decoder copies data that is not reference counted, the driver buffer can be requeued after
+	this->jpeg_pkt->data = (uint8_t*)data;
+	this->jpeg_pkt->size = (int)size;
+	int ret = avcodec_send_packet(this->jpeg_ctx, this->jpeg_pkt);
+	this->jpeg_pkt->data = NULL;
+	this->jpeg_pkt->size = 0;
+	if (ret < 0 || avcodec_receive_frame(this->jpeg_ctx, this->jpeg_frame) < 0)
+		return false;
+
+	/* yuvj422p or yuvj420p in, limited range I420 out. the chroma planes are only resampled */
+	this->jpeg_sws = sws_getCachedContext(this->jpeg_sws,
+		this->jpeg_frame->width, this->jpeg_frame->height, (enum AVPixelFormat)this->jpeg_frame->format,
+		this->active_width, this->active_height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+	if (!this->jpeg_sws)
+	{
+		av_frame_unref(this->jpeg_frame);
+		return false;
+	}
+
+	uint8_t* planes[3];
+	int linesizes[3] = { this->active_width, this->active_width / 2, this->active_width / 2 };
+	planes[0] = dst.data;
+	planes[1] = planes[0] + (size_t)this->active_width * this->active_height;
+	planes[2] = planes[1] + (size_t)(this->active_width / 2) * (this->active_height / 2);
+	sws_scale(this->jpeg_sws, this->jpeg_frame->data, this->jpeg_frame->linesize, 0, this->jpeg_frame->height,
+		planes, linesizes);
+
+	av_frame_unref(this->jpeg_frame);
+	return true;
+}
+#else
+int KV4L2Source::retry_ioctl(int fd, unsigned long request, void* arg)
+{
+	return -1;
+}
+
+bool KV4L2Source::Open()
+{
+	// V4L2 exists on Linux only
+	return false;
+}
+
+void KV4L2Source::Close()
+{}
+
+enum KGrabResult KV4L2Source::Grab()
+{
+	return KGrabResult::GRAB_END;
+}
+
+bool KV4L2Source::Retrieve(cv::Mat& cv_img, KFramePool& pool)
+{
+	return false;
+}
+
+bool KV4L2Source::set_format(enum KV4L2Format format)
+{
+	return false;
+}
+
+bool KV4L2Source::map_buffers()
+{
+	return false;
+}
+
+bool KV4L2Source::open_jpeg_decoder()
+{
+	return false;
+}
+
+bool KV4L2Source::decode_jpeg(const uint8_t* data, size_t size, cv::Mat& dst)
+{
+	return false;
+}
+
+void KV4L2Source::requeue()
+{}
+#endif
@@ -0,0 +1,90 @@
+#ifndef _K_V4L2_SOURCE_H_
+#define _K_V4L2_SOURCE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+#include "KFrameSource.h"
+
+// what the camera is asked to deliver, AUTO takes the first of NV12, YUYV and MJPEG it offers
+enum KV4L2Format{
+	V4L2_FORMAT_AUTO = 0,
+	V4L2_FORMAT_YUYV = 1,
+	V4L2_FORMAT_NV12 = 2,
+	V4L2_FORMAT_MJPEG = 3
+};
+
+// driver buffers mapped at once, one is being read while the others fill
+#define V4L2_BUFFER_COUNT		4
+// a camera without a frame for this long returns GRAB_RETRY
+#define V4L2_GRAB_TIMEOUT_MS	1000
+
+struct KV4L2Buffer{
+	void* data;
+	size_t size;
+};
+
+/*
+frames of a V4L2 camera (/dev/videoN, also v4l2loopback) in the camera's own format, Linux only.
+cv::VideoCapture converts every frame to BGR and the encoder converts it back to YUV,
+here the driver's memory-mapped buffers are only reordered into the pooled I420 Mat the encoder takes as is.
+MJPEG is decoded by libavcodec into YUV. BGR is made only for frame taps that ask for it.
+*/
+class K_STREAMING_API KV4L2Source : public KFrameSource
+{
+public:
+	// width, height or fps 0 keep what the camera is set to
+	KV4L2Source(int device_id, int width = 0, int height = 0, int fps = 0, enum KV4L2Format format = V4L2_FORMAT_AUTO);
+	~KV4L2Source();
+
+private:
+	std::string path;
+	int width;
+	int height;
+	int fps;
+	enum KV4L2Format format;
+	// negotiated with the driver in Open
+	enum KV4L2Format active_format;
+	int active_width;
+	int active_height;
+	int stride;
+	int fd;
+	std::vector<struct KV4L2Buffer> buffers;
+	// the buffer taken by Grab, given back to the driver by Retrieve
+	int dequeued;
+	size_t dequeued_bytes;
+	// MJPEG decoding
+	AVCodecContext* jpeg_ctx;
+	AVPacket* jpeg_pkt;
+	AVFrame* jpeg_frame;
+	struct SwsContext* jpeg_sws;
+
+	static int retry_ioctl(int fd, unsigned long request, void* arg);
+	bool set_format(enum KV4L2Format format);
+	bool map_buffers();
+	bool open_jpeg_decoder();
+	bool decode_jpeg(const uint8_t* data, size_t size, cv::Mat& dst);
+	void requeue();
+
+public:
+	bool Open();
+	void Close();
+	enum KGrabResult Grab();
+	bool Retrieve(cv::Mat& cv_img, KFramePool& pool);
+	enum AVPixelFormat GetPixelFormat();
+	bool NeedsPacing();
+	// what the camera delivers, valid after Open
+	enum KV4L2Format GetFormat();
+	cv::Size GetFrameSize();
+};
+
+#endif
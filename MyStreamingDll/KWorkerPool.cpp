@@ -0,0 +1,223 @@
+#include <climits>
+#include <chrono>
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "KWorkerPool.h"
+
+KWorkerPool::KWorkerPool()
+	: workers(), queues(), is_running(false), next_seq(0), pending(0),
+	stolen_count(0), busy_us(0), start_time()
+{}
+
+KWorkerPool::~KWorkerPool()
+{
+	Stop();
+}
+
+bool KWorkerPool::Start(int worker_count, bool pin_workers)
+{
+	Stop();
+
+	int cores = (int)std::thread::hardware_concurrency();
+	if (cores < 1)
+		cores = 1;
+	if (worker_count <= 0)
+		worker_count = cores;
+
+	for (int i = 0; i < worker_count; i++)
+		this->queues.push_back(new KWorkerQueue());
+
+	this->pending = 0;
+	this->stolen_count = 0;
+	this->busy_us = 0;
+	this->start_time = std::chrono::steady_clock::now();
+	this->is_running = true;
+
+	for (int i = 0; i < worker_count; i++)
+	{
+		std::thread* worker = new std::thread(&KWorkerPool::Work, this, i);
+		if (pin_workers)
+			pin_thread(worker, i % cores);
+		this->workers.push_back(worker);
+	}
+
+	return true;
+}
+
+void KWorkerPool::Stop()
+{
+	this->wait_lock.lock();
+	this->is_running = false;
+	this->wait_cond.notify_all();
+	this->wait_lock.unlock();
+
+	for (size_t i = 0; i < this->workers.size(); i++)
+	{
+		this->workers[i]->join();
+		delete this->workers[i];
+	}
+	this->workers.clear();
+
+	for (size_t i = 0; i < this->queues.size(); i++)
+		delete this->queues[i];
+	this->queues.clear();
+	this->pending = 0;
+}
+
+bool KWorkerPool::IsRunning()
+{
+	return this->is_running;
+}
+
+bool KWorkerPool::Submit(const std::function<void()>& run, int priority, int home_worker)
+{
+	if (!this->is_running || this->queues.empty())
+		return false;
+
+	struct KWorkerTask task;
+	task.run = run;
+	task.priority = priority;
+	task.seq = this->next_seq++;
+
+	int count = (int)this->queues.size();
+	int index = home_worker >= 0 ? home_worker % count : (int)(task.seq % count);
+	struct KWorkerQueue* queue = this->queues[index];
+	queue->lock.lock();
+	queue->tasks.push_back(task);
+	queue->lock.unlock();
+
+	// the parked worker re-checks pending under the same lock, no wakeup is lost
+	this->pending++;
+	std::lock_guard<std::mutex> lock(this->wait_lock);
+	this->wait_cond.notify_one();
+
+	return true;
+}
+
+int KWorkerPool::GetWorkerCount()
+{
+	return (int)this->workers.size();
+}
+
+int KWorkerPool::GetPendingCount()
+{
+	return this->pending;
+}
+
+uint64_t KWorkerPool::GetStolenCount()
+{
+	return this->stolen_count;
+}
+
+double KWorkerPool::GetUtilization()
+{
+	if (this->workers.empty())
+		return 0;
+
+	int64_t elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - this->start_time).count();
+	if (elapsed_us <= 0)
+		return 0;
+
+	return (double)this->busy_us / ((double)elapsed_us * this->workers.size());
+}
+
+void KWorkerPool::Work(int index)
+{
+	struct KWorkerTask task;
+
+	while (true)
+	{
+		if (take_task(index, task))
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			task.run();
+			this->busy_us += std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			task.run = nullptr;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(this->wait_lock);
+		if (!this->is_running)
+			break;
+		this->wait_cond.wait(lock, [this] { return !this->is_running || this->pending > 0; });
+		if (!this->is_running)
+			break;
+	}
+}
+
+bool KWorkerPool::take_task(int index, struct KWorkerTask& task)
+{
+	int count = (int)this->queues.size();
+
+	while (this->pending > 0)
+	{
+		// look at the best task of every queue, own queue first so it wins ties
+		int best_queue = -1;
+		int best_priority = INT_MIN;
+		for (int n = 0; n < count; n++)
+		{
+			struct KWorkerQueue* queue = this->queues[(index + n) % count];
+			std::lock_guard<std::mutex> lock(queue->lock);
+			int best = best_task(queue);
+			if (best >= 0 && queue->tasks[best].priority > best_priority)
+			{
+				best_queue = (index + n) % count;
+				best_priority = queue->tasks[best].priority;
+			}
+		}
+		if (best_queue < 0)
+			return false;
+
+		// another worker may have taken it meanwhile, then look again
+		struct KWorkerQueue* queue = this->queues[best_queue];
+		std::lock_guard<std::mutex> lock(queue->lock);
+		int best = best_task(queue);
+		if (best < 0)
+			continue;
+
+		task = queue->tasks[best];
+		queue->tasks.erase(queue->tasks.begin() + best);
+		this->pending--;
+		if (best_queue != index)
+			this->stolen_count++;
+		return true;
+	}
+
+	return false;
+}
+
+int KWorkerPool::best_task(const struct KWorkerQueue* queue)
+{
+	int best = -1;
+	for (int i = 0; i < (int)queue->tasks.size(); i++)
+	{
+		const struct KWorkerTask& task = queue->tasks[i];
+		if (best < 0 || task.priority > queue->tasks[best].priority ||
+			(task.priority == queue->tasks[best].priority && task.seq < queue->tasks[best].seq))
+			best = i;
+	}
+
+	return best;
+}
+
+void KWorkerPool::pin_thread(std::thread* thread, int core)
+{
+#ifdef _WIN32
+	SetThreadAffinityMask((HANDLE)thread->native_handle(), (DWORD_PTR)1 << core);
+#elif defined(__linux__)
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(core, &cpus);
+	pthread_setaffinity_np(thread->native_handle(), sizeof(cpus), &cpus);
+#else
+	// no affinity api, the scheduler places the workers
+	(void)thread;
+	(void)core;
+#endif
+}
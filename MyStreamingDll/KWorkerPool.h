@@ -0,0 +1,71 @@
+#ifndef _K_WORKER_POOL_H_
+#define _K_WORKER_POOL_H_
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <vector>
+
+struct KWorkerTask{
+	std::function<void()> run;
+	int priority;
+	uint64_t seq;
+};
+
+// tasks waiting for one worker
+struct KWorkerQueue{
+	std::mutex lock;
+	std::vector<struct KWorkerTask> tasks;
+};
+
+/*
+fixed set of worker threads, optionally pinned one per core.
+a task is queued at its home worker, so the same job keeps landing on the same core.
+an idle worker takes the highest priority task of any queue, its own first on a tie,
+so work is stolen from busy workers instead of waiting behind them. equal priorities run in submit order.
+*/
+class KWorkerPool
+{
+public:
+	KWorkerPool();
+	~KWorkerPool();
+
+private:
+	std::vector<std::thread*> workers;
+	std::vector<struct KWorkerQueue*> queues;
+	std::atomic<bool> is_running;
+	std::atomic<uint64_t> next_seq;
+	std::atomic<int> pending;
+	// parking for idle workers
+	std::mutex wait_lock;
+	std::condition_variable wait_cond;
+	// counters
+	std::atomic<uint64_t> stolen_count;
+	std::atomic<int64_t> busy_us;
+	std::chrono::steady_clock::time_point start_time;
+
+	void Work(int index);
+	bool take_task(int index, struct KWorkerTask& task);
+	static int best_task(const struct KWorkerQueue* queue);
+	static void pin_thread(std::thread* thread, int core);
+
+public:
+	// worker_count 0 uses every core
+	bool Start(int worker_count, bool pin_workers);
+	// waits for the running tasks, queued tasks that did not start are dropped. stop submitting first
+	void Stop();
+	bool IsRunning();
+	// home_worker -1 spreads tasks over the workers. returns false if the pool is not running
+	bool Submit(const std::function<void()>& run, int priority = 0, int home_worker = -1);
+	int GetWorkerCount();
+	int GetPendingCount();
+	uint64_t GetStolenCount();
+	// share of the workers' time spent running tasks since Start, 0 to 1
+	double GetUtilization();
+};
+
+#endif
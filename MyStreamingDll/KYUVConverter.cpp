@@ -0,0 +1,129 @@
+#include <cstring>
+#include "KYUVConverter.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YUV_SSE2
+#include <emmintrin.h>
+#endif
+
+int64_t KYUVConverter::GetFrameBytes(enum KYUVLayout layout, int width, int height)
+{
+	switch (layout)
+	{
+	case KYUVLayout::YUV_LAYOUT_YUYV:
+		return (int64_t)width * height * 2;
+	default:
+		return (int64_t)width * height * 3 / 2;
+	}
+}
+
+void KYUVConverter::ToI420(enum KYUVLayout layout, const uint8_t* src, int stride, int width, int height, cv::Mat& dst)
+{
+	switch (layout)
+	{
+	case KYUVLayout::YUV_LAYOUT_YUYV:
+		yuyv_to_i420(src, stride, width, height, dst);
+		break;
+	case KYUVLayout::YUV_LAYOUT_NV12:
+		nv12_to_i420(src, stride, width, height, dst);
+		break;
+	default:
+		// the planes of I420 only lose their padding
+		for (int y = 0; y < height; y++)
+			memcpy(dst.data + (size_t)y * width, src + (size_t)y * stride, width);
+		for (int y = 0; y < height; y++)
+			memcpy(dst.data + (size_t)width * height + (size_t)y * (width / 2),
+				src + (size_t)stride * height + (size_t)y * (stride / 2), width / 2);
+		break;
+	}
+}
+
+void KYUVConverter::yuyv_to_i420(const uint8_t* src, int stride, int width, int height, cv::Mat& dst)
+{
+	uint8_t *dst_y = dst.data;
+	uint8_t *dst_u = dst_y + (size_t)width * height;
+	uint8_t *dst_v = dst_u + (size_t)(width / 2) * (height / 2);
+
+	for (int y = 0; y < height; y += 2)
+	{
+		const uint8_t *row0 = src + (size_t)y * stride;
+		const uint8_t *row1 = row0 + stride;
+		uint8_t *y0 = dst_y + (size_t)y * width;
+		uint8_t *y1 = y0 + width;
+		uint8_t *u = dst_u + (size_t)(y / 2) * (width / 2);
+		uint8_t *v = dst_v + (size_t)(y / 2) * (width / 2);
+		int x = 0;
+
+#ifdef YUV_SSE2
+		const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 2));
+			__m128i b0 = _mm_loadu_si128((const __m128i*)(row0 + x * 2 + 16));
+			__m128i a1 = _mm_loadu_si128((const __m128i*)(row1 + x * 2));
+			__m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 2 + 16));
+
+			// the even bytes are luma
+			_mm_storeu_si128((__m128i*)(y0 + x),
+				_mm_packus_epi16(_mm_and_si128(a0, low_bytes), _mm_and_si128(b0, low_bytes)));
+			_mm_storeu_si128((__m128i*)(y1 + x),
+				_mm_packus_epi16(_mm_and_si128(a1, low_bytes), _mm_and_si128(b1, low_bytes)));
+
+			// the odd bytes are U V U V ..., both rows averaged into one
+			__m128i uv = _mm_avg_epu8(
+				_mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8)),
+				_mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8)));
+			_mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(_mm_and_si128(uv, low_bytes), zero));
+			_mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
+		}
+#endif
+		for (; x < width; x += 2)
+		{
+			const uint8_t *p0 = row0 + x * 2;
+			const uint8_t *p1 = row1 + x * 2;
+			y0[x] = p0[0];
+			y0[x + 1] = p0[2];
+			y1[x] = p1[0];
+			y1[x + 1] = p1[2];
+			u[x / 2] = (uint8_t)((p0[1] + p1[1] + 1) >> 1);
+			v[x / 2] = (uint8_t)((p0[3] + p1[3] + 1) >> 1);
+		}
+	}
+}
+
+void KYUVConverter::nv12_to_i420(const uint8_t* src, int stride, int width, int height, cv::Mat& dst)
+{
+	uint8_t *dst_y = dst.data;
+	uint8_t *dst_u = dst_y + (size_t)width * height;
+	uint8_t *dst_v = dst_u + (size_t)(width / 2) * (height / 2);
+	const uint8_t *src_uv = src + (size_t)stride * height;
+
+	for (int y = 0; y < height; y++)
+		memcpy(dst_y + (size_t)y * width, src + (size_t)y * stride, width);
+
+	for (int y = 0; y < height / 2; y++)
+	{
+		const uint8_t *uv = src_uv + (size_t)y * stride;
+		uint8_t *u = dst_u + (size_t)y * (width / 2);
+		uint8_t *v = dst_v + (size_t)y * (width / 2);
+		int x = 0;
+
+#ifdef YUV_SSE2
+		const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(uv + x));
+			// 8 U and 8 V bytes interleaved, split into the two planes
+			__m128i split = _mm_packus_epi16(_mm_and_si128(a, low_bytes), _mm_srli_epi16(a, 8));
+			_mm_storel_epi64((__m128i*)(u + x / 2), split);
+			_mm_storel_epi64((__m128i*)(v + x / 2), _mm_srli_si128(split, 8));
+		}
+#endif
+		for (; x < width; x += 2)
+		{
+			u[x / 2] = uv[x];
+			v[x / 2] = uv[x + 1];
+		}
+	}
+}
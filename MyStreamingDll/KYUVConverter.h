@@ -0,0 +1,36 @@
+#ifndef _K_YUV_CONVERTER_H_
+#define _K_YUV_CONVERTER_H_
+
+#include <cstdint>
+
+#include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
+
+// byte layouts of the YUV frames cameras and raw files deliver
+enum KYUVLayout{
+	YUV_LAYOUT_I420 = 0,	// planar Y, U, V, 4:2:0
+	YUV_LAYOUT_YUYV = 1,	// packed Y0 U Y1 V, 4:2:2
+	YUV_LAYOUT_NV12 = 2		// planar Y, interleaved UV, 4:2:0
+};
+
+/*
+reorders YUV frames into the packed I420 Mat the encoder takes without conversion.
+the samples are only moved, never converted to another colorspace: YUYV averages its two chroma rows,
+NV12 splits its chroma plane. the SSE2 paths handle 16 pixels per step.
+*/
+class KYUVConverter
+{
+public:
+	// size of one frame in layout without row padding, width and height even
+	static int64_t GetFrameBytes(enum KYUVLayout layout, int width, int height);
+	/*
+	src rows are stride bytes apart, NV12's chroma plane follows its luma at stride * height.
+	dst must be a continuous CV_8UC1 Mat of height * 3 / 2 rows and width columns.
+	*/
+	static void ToI420(enum KYUVLayout layout, const uint8_t* src, int stride, int width, int height, cv::Mat& dst);
+
+private:
+	static void yuyv_to_i420(const uint8_t* src, int stride, int width, int height, cv::Mat& dst);
+	static void nv12_to_i420(const uint8_t* src, int stride, int width, int height, cv::Mat& dst);
+};
+
+#endif
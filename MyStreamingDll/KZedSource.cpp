@@ -0,0 +1,101 @@
+#include <opencv2/imgproc/imgproc.hpp>
+#include "KZedSource.h"
+
+#ifdef K_STREAMING_ZED
+
+KZedSource::KZedSource(enum KZedView view, sl::zed::Camera* camera, int fps, KStereoComposer* composer)
+	: view(view), camera(camera), is_camera_outside(camera != NULL), fps(fps),
+	own_composer(), composer(composer ? composer : &own_composer)
+{}
+
+KZedSource::~KZedSource()
+{
+	Close();
+}
+
+bool KZedSource::Open()
+{
+	if (this->is_camera_outside)
+		return this->camera != NULL;
+
+	Close();
+
+	this->camera = new sl::zed::Camera(sl::zed::HD720, (float)this->fps);
+	sl::zed::InitParams zed_params;
+	zed_params.mode = sl::zed::PERFORMANCE;
+	zed_params.unit = sl::zed::MILLIMETER;
+	zed_params.coordinate = sl::zed::IMAGE;
+	zed_params.disableSelfCalib = false;
+	zed_params.device = -1;
+	zed_params.verbose = false;
+	zed_params.vflip = false;
+
+	sl::zed::ERRCODE zederr = this->camera->init(zed_params);
+	if (zederr != sl::zed::SUCCESS)
+	{
+		delete this->camera;
+		this->camera = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+void KZedSource::Close()
+{
+	if (!this->is_camera_outside && this->camera)
+	{
+		delete this->camera;
+		this->camera = NULL;
+	}
+}
+
+enum KGrabResult KZedSource::Grab()
+{
+	if (!this->camera)
+		return KGrabResult::GRAB_END;
+
+	// grab returns true when no new frame could be taken
+	if (this->camera->grab(sl::zed::SENSING_MODE::STANDARD))
+		return KGrabResult::GRAB_RETRY;
+
+	return KGrabResult::GRAB_FRAME;
+}
+
+bool KZedSource::Retrieve(cv::Mat& cv_img, KFramePool& pool)
+{
+	int width = this->camera->getImageSize().width;
+	int height = this->camera->getImageSize().height;
+
+	if (this->view == KZedView::ZED_VIEW_STEREO)
+	{
+		// both eyes stay valid until the next grab, one pass from both camera buffers into the I420 frame
+		sl::zed::Mat zedMat, zedMat2;
+		zedMat = this->camera->retrieveImage(sl::zed::SIDE::LEFT);
+		zedMat2 = this->camera->retrieveImage(sl::zed::SIDE::RIGHT);
+
+		cv::Size frame_size = this->composer->GetFrameSize(width, height);
+		pool.Prepare(cv_img, frame_size.height * 3 / 2, frame_size.width, CV_8UC1);
+		this->composer->Compose(zedMat.data, zedMat.step, zedMat2.data, zedMat2.step, width, height, cv_img);
+		return true;
+	}
+
+	sl::zed::Mat zedMat;
+	if (this->view == KZedView::ZED_VIEW_LEFT)
+		zedMat = this->camera->retrieveImage(sl::zed::SIDE::LEFT);
+	else
+		zedMat = this->camera->retrieveImage(sl::zed::SIDE::RIGHT);
+
+	// convert straight out of the camera buffer into a pooled frame
+	cv::Mat zed_view(height, width, CV_8UC4, zedMat.data, zedMat.step);
+	pool.Prepare(cv_img, height, width, CV_8UC3);
+	cv::cvtColor(zed_view, cv_img, cv::COLOR_BGRA2BGR);
+	return true;
+}
+
+enum AVPixelFormat KZedSource::GetPixelFormat()
+{
+	return this->view == KZedView::ZED_VIEW_STEREO ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_NONE;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _K_ZED_SOURCE_H_
+#define _K_ZED_SOURCE_H_
+
+#include "KFrameSource.h"
+
+#ifdef K_STREAMING_ZED
+#include <zed/Camera.hpp>
+
+#include "KStereoComposer.h"
+
+enum KZedView{
+	ZED_VIEW_LEFT = 0,
+	ZED_VIEW_RIGHT = 1,
+	ZED_VIEW_STEREO = 2		// both eyes packed into one I420 frame
+};
+
+/*
+frames of a ZED camera. left and right views are converted to BGR straight from the camera buffer,
+the stereo view is composed into I420 with the layout of the composer.
+*/
+class K_STREAMING_API KZedSource : public KFrameSource
+{
+public:
+	/*
+	camera NULL opens an HD720 camera at fps in Open() and closes it in Close(),
+	otherwise the caller's initialized camera is used and left open.
+	composer NULL uses a side-by-side composer of its own.
+	*/
+	KZedSource(enum KZedView view, sl::zed::Camera* camera = NULL, int fps = 30, KStereoComposer* composer = NULL);
+	~KZedSource();
+
+private:
+	enum KZedView view;
+	sl::zed::Camera* camera;
+	bool is_camera_outside;
+	int fps;
+	KStereoComposer own_composer;
+	KStereoComposer* composer;
+
+public:
+	bool Open();
+	void Close();
+	enum KGrabResult Grab();
+	bool Retrieve(cv::Mat& cv_img, KFramePool& pool);
+	enum AVPixelFormat GetPixelFormat();
+};
+
+#endif
+
+#endif
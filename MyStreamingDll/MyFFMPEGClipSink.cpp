@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "MyFFMPEGStreamer.h"
+#include "MyFFMPEGClipSink.h"
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+bool MyFFMPEGClipWriter::Write(AVPacket *pkt, const AVRational *time_base)
+{
+	return write_packet(pkt, time_base);
+}
+
+MyFFMPEGClipSink::MyFFMPEGClipSink(int max_seconds, size_t max_bytes)
+	: MyFFMPEGSink(), max_duration_us((int64_t)(max_seconds > 0 ? max_seconds : CLIP_RING_SECONDS) * 1000000),
+	max_bytes(max_bytes > 0 ? max_bytes : CLIP_RING_BYTES), codec_ctx(NULL), ring(), ring_bytes(0),
+	exports(), next_clip_id(0), written_clips(0), failed_clips(0)
+{}
+
+MyFFMPEGClipSink::~MyFFMPEGClipSink()
+{
+	Close();
+}
+
+bool MyFFMPEGClipSink::Open(int id, const std::string& url, const char* format_name, AVCodecContext *codec_ctx)
+{
+	Close();
+
+	this->id = id;
+	this->url = url;
+
+	/* the clips are muxed long after, possibly when the encoder is gone */
+	this->codec_ctx = copy_codec_context(codec_ctx);
+	if (!this->codec_ctx)
+	{
+		this->last_error = MyFFMPEGStreamerError::CANT_ALLOC_CODEC_CONTEXT;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+	this->written_clips = 0;
+	this->failed_clips = 0;
+	return true;
+}
+
+void MyFFMPEGClipSink::Close()
+{
+	reap_exports(true);
+
+	this->ring_lock.lock();
+	while (!this->ring.empty())
+		pop_front();
+	this->ring_lock.unlock();
+
+	this->ring_lock.lock();
+	if (this->codec_ctx)
+		avcodec_free_context(&this->codec_ctx);
+	this->ring_lock.unlock();
+
+	MyFFMPEGSink::Close();
+}
+
+void MyFFMPEGClipSink::OnEncoderChanged(AVCodecContext *codec_ctx)
+{
+	AVCodecContext *copy = copy_codec_context(codec_ctx);
+
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+	// the old encoder's tail is already in, nothing of the new one is queued to these
+	for (size_t i = 0; i < this->exports.size(); i++)
+		this->exports[i]->is_collected = true;
+	this->export_cond.notify_all();
+
+	while (!this->ring.empty())
+		pop_front();
+
+	// a copy that fails keeps the old parameters, the clips still play with in-band headers
+	if (this->codec_ctx && copy)
+		std::swap(this->codec_ctx, copy);
+	if (copy)
+		avcodec_free_context(&copy);
+}
+
+AVCodecContext* MyFFMPEGClipSink::copy_codec_context(AVCodecContext *codec_ctx)
+{
+	AVCodecContext *copy = avcodec_alloc_context3(codec_ctx->codec);
+	if (copy && avcodec_copy_context(copy, codec_ctx) < 0)
+		avcodec_free_context(&copy);
+	return copy;
+}
+
+bool MyFFMPEGClipSink::WritePacket(const AVPacket *pkt, const AVRational *time_base)
+{
+	if (!this->codec_ctx)
+		return false;
+
+	/* a buffer of the packet's own size, the encoder's goes back as soon as the other sinks sent it */
+	AVPacket *copy = av_packet_alloc();
+	if (!copy || av_new_packet(copy, pkt->size) < 0 || av_packet_copy_props(copy, pkt) < 0)
+	{
+		av_packet_free(&copy);
+		this->failed_packets++;
+		return false;
+	}
+	memcpy(copy->data, pkt->data, pkt->size);
+
+	int64_t now = av_gettime_relative();
+	struct MyClipPacket entry = { copy, now, *time_base };
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+
+	// clips waiting for what follows their trigger
+	for (size_t i = 0; i < this->exports.size(); i++)
+	{
+		struct MyClipExport *clip = this->exports[i];
+		if (clip->is_collected || now > clip->end_us)
+			continue;
+
+		struct MyClipPacket queued = { av_packet_clone(copy), now, *time_base };
+		if (queued.pkt)
+			clip->queue.push_back(queued);
+		this->export_cond.notify_all();
+	}
+
+	// the ring starts at a keyframe
+	if (this->ring.empty() && !(copy->flags & AV_PKT_FLAG_KEY))
+	{
+		av_packet_free(&copy);
+		return true;
+	}
+
+	this->ring.push_back(entry);
+	this->ring_bytes += copy->size;
+	evict();
+
+	this->written_packets++;
+	return true;
+}
+
+void MyFFMPEGClipSink::evict()
+{
+	int64_t newest_us = this->ring.back().time_us;
+	bool is_evicted = false;
+
+	while (!this->ring.empty() &&
+		(this->ring_bytes > this->max_bytes || newest_us - this->ring.front().time_us > this->max_duration_us))
+	{
+		pop_front();
+		is_evicted = true;
+	}
+
+	// the rest of a GOP without its keyframe cannot be decoded
+	while (is_evicted && !this->ring.empty() && !(this->ring.front().pkt->flags & AV_PKT_FLAG_KEY))
+		pop_front();
+}
+
+void MyFFMPEGClipSink::pop_front()
+{
+	this->ring_bytes -= this->ring.front().pkt->size;
+	av_packet_free(&this->ring.front().pkt);
+	this->ring.pop_front();
+}
+
+int MyFFMPEGClipSink::ExportClip(const std::string& path, int before_ms, int after_ms, int64_t trigger_us,
+								const char* format_name)
+{
+	if (trigger_us <= 0)
+		trigger_us = av_gettime_relative();
+	int64_t start_us = trigger_us - (int64_t)std::max(before_ms, 0) * 1000;
+	int64_t end_us = trigger_us + (int64_t)std::max(after_ms, 0) * 1000;
+
+	reap_exports(false);
+
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+	if (!this->codec_ctx || this->ring.empty())
+		return -1;
+
+	// the keyframe at or before the start, the oldest one if the ring is shorter than asked
+	size_t first = 0;
+	for (size_t i = 0; i < this->ring.size() && this->ring[i].time_us <= start_us; i++)
+	{
+		if (this->ring[i].pkt->flags & AV_PKT_FLAG_KEY)
+			first = i;
+	}
+
+	// the writer opens later, the ring's parameters may be replaced meanwhile
+	AVCodecContext *clip_ctx = copy_codec_context(this->codec_ctx);
+	if (!clip_ctx)
+		return -1;
+
+	struct MyClipExport *clip = new MyClipExport();
+	clip->id = this->next_clip_id++;
+	clip->codec_ctx = clip_ctx;
+	clip->path = path;
+	clip->format = format_name ? format_name : "";
+	clip->end_us = end_us;
+	clip->is_collected = false;
+	clip->is_finished = false;
+
+	/* the buffered part is shared by reference, the ring may drop it meanwhile */
+	for (size_t i = first; i < this->ring.size() && this->ring[i].time_us <= end_us; i++)
+	{
+		struct MyClipPacket queued = this->ring[i];
+		queued.pkt = av_packet_clone(queued.pkt);
+		if (queued.pkt)
+			clip->queue.push_back(queued);
+	}
+
+	clip->thread = new std::thread(&MyFFMPEGClipSink::WriteClip, this, clip);
+	this->exports.push_back(clip);
+
+	return clip->id;
+}
+
+void MyFFMPEGClipSink::WriteClip(struct MyClipExport *clip)
+{
+	MyFFMPEGClipWriter writer;
+	bool is_ok = writer.Open(clip->id, clip->path, clip->format.empty() ? NULL : clip->format.c_str(), clip->codec_ctx);
+	int64_t offset = AV_NOPTS_VALUE;
+
+	std::unique_lock<std::mutex> lock(this->ring_lock);
+	while (true)
+	{
+		if (clip->queue.empty())
+		{
+			// packets stamped after end_us are never queued, the clip is complete once that time passed
+			int64_t left_us = clip->end_us - av_gettime_relative();
+			if (clip->is_collected || left_us < 0)
+				break;
+			this->export_cond.wait_for(lock, std::chrono::microseconds(left_us));
+			continue;
+		}
+
+		AVPacket *pkt = clip->queue.front().pkt;
+		AVRational time_base = clip->queue.front().time_base;
+		clip->queue.pop_front();
+		lock.unlock();
+
+		// the clip starts at zero
+		if (offset == AV_NOPTS_VALUE)
+			offset = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+		if (offset != AV_NOPTS_VALUE)
+		{
+			if (pkt->pts != AV_NOPTS_VALUE)
+				pkt->pts -= offset;
+			if (pkt->dts != AV_NOPTS_VALUE)
+				pkt->dts -= offset;
+		}
+		if (is_ok && !writer.Write(pkt, &time_base))
+			is_ok = false;
+		av_packet_free(&pkt);
+
+		lock.lock();
+	}
+	clip->is_collected = true;
+	lock.unlock();
+
+	writer.Close();
+	if (!is_ok)
+		fprintf(stderr, "Could not write clip '%s'\n", clip->path.c_str());
+
+	lock.lock();
+	clip->is_finished = true;
+	if (is_ok)
+		this->written_clips++;
+	else
+		this->failed_clips++;
+}
+
+void MyFFMPEGClipSink::reap_exports(bool wait_all)
+{
+	std::vector<struct MyClipExport*> done;
+
+	this->ring_lock.lock();
+	for (size_t i = 0; i < this->exports.size();)
+	{
+		struct MyClipExport *clip = this->exports[i];
+		if (wait_all)
+			clip->is_collected = true;
+		if (clip->is_finished || wait_all)
+		{
+			done.push_back(clip);
+			this->exports.erase(this->exports.begin() + i);
+		}
+		else
+			i++;
+	}
+	this->export_cond.notify_all();
+	this->ring_lock.unlock();
+
+	// an export still writing is waited for outside the lock it needs
+	for (size_t i = 0; i < done.size(); i++)
+	{
+		done[i]->thread->join();
+		delete done[i]->thread;
+		for (size_t j = 0; j < done[i]->queue.size(); j++)
+			av_packet_free(&done[i]->queue[j].pkt);
+		avcodec_free_context(&done[i]->codec_ctx);
+		delete done[i];
+	}
+}
+
+int MyFFMPEGClipSink::GetExportCount()
+{
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+	int count = 0;
+	for (size_t i = 0; i < this->exports.size(); i++)
+	{
+		if (!this->exports[i]->is_finished)
+			count++;
+	}
+	return count;
+}
+
+uint64_t MyFFMPEGClipSink::GetWrittenClips()
+{
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+	return this->written_clips;
+}
+
+uint64_t MyFFMPEGClipSink::GetFailedClips()
+{
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+	return this->failed_clips;
+}
+
+size_t MyFFMPEGClipSink::GetBufferedBytes()
+{
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+	return this->ring_bytes;
+}
+
+int64_t MyFFMPEGClipSink::GetBufferedDuration()
+{
+	std::lock_guard<std::mutex> lock(this->ring_lock);
+	if (this->ring.empty())
+		return 0;
+	return this->ring.back().time_us - this->ring.front().time_us;
+}
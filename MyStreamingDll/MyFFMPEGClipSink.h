@@ -0,0 +1,107 @@
+#ifndef _MY_FFMPEG_CLIP_SINK_H_
+#define _MY_FFMPEG_CLIP_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MyFFMPEGSink.h"
+
+// how much encoded video the ring keeps at most, whichever limit is reached first
+#define CLIP_RING_SECONDS		40
+#define CLIP_RING_BYTES			(64 * 1024 * 1024)
+
+// one encoded packet in the ring, stamped with the time it left the encoder
+struct MyClipPacket{
+	AVPacket *pkt;
+	int64_t time_us;
+	AVRational time_base;
+};
+
+// one clip being written, its packets after the trigger are appended as they are encoded
+struct MyClipExport{
+	int id;
+	std::string path;
+	std::string format;		// empty guesses from the path
+	AVCodecContext *codec_ctx;	// parameters of the encoder when the clip was asked for
+	int64_t end_us;
+	std::deque<struct MyClipPacket> queue;
+	bool is_collected;		// past end_us or closing, nothing more is queued
+	bool is_finished;		// the file is closed
+	std::thread *thread;
+};
+
+// muxes a clip on the export thread, writing synchronously instead of through an output thread
+class MyFFMPEGClipWriter : public MyFFMPEGSink
+{
+public:
+	bool Write(AVPacket *pkt, const AVRational *time_base);
+};
+
+/*
+keeps the last seconds of the encoded stream in memory, so an event can be saved with what led up to it.
+the ring holds whole GOPs and always starts at a keyframe. each packet is copied into a buffer of its own,
+so the ring never holds on to buffers of the encoder or of the other sinks.
+ExportClip writes [trigger - before, trigger + after] from the keyframe at or before the start
+into a file on a thread of its own, mp4 and mkv take their headers from the clip's first keyframe.
+*/
+class MyFFMPEGClipSink : public MyFFMPEGSink
+{
+public:
+	MyFFMPEGClipSink(int max_seconds = CLIP_RING_SECONDS, size_t max_bytes = CLIP_RING_BYTES);
+	~MyFFMPEGClipSink();
+
+private:
+	int64_t max_duration_us;
+	size_t max_bytes;
+	// parameters of the encoder, each clip is muxed from a copy, under ring_lock
+	AVCodecContext *codec_ctx;
+	std::mutex ring_lock;
+	std::condition_variable export_cond;
+	std::deque<struct MyClipPacket> ring;
+	size_t ring_bytes;
+	std::vector<struct MyClipExport*> exports;
+	int next_clip_id;
+	uint64_t written_clips;
+	uint64_t failed_clips;
+
+	// NULL if the context cannot be allocated
+	static AVCodecContext* copy_codec_context(AVCodecContext *codec_ctx);
+	void evict();
+	void pop_front();
+	// export thread
+	void WriteClip(struct MyClipExport *clip);
+	// join the exports that are done, wait_all ends the others with what they have
+	void reap_exports(bool wait_all);
+
+public:
+	// url is ignored, the ring only keeps the parameters of codec_ctx
+	bool Open(int id, const std::string& url, const char* format_name, AVCodecContext *codec_ctx);
+	bool WritePacket(const AVPacket *pkt, const AVRational *time_base);
+	// finishes the exports with the packets they have
+	void Close();
+	/*
+	the ring starts over at the first keyframe of the new encoder and the exports being collected end
+	with the last packet of the old one, a clip never mixes the parameters of two encoders.
+	*/
+	void OnEncoderChanged(AVCodecContext *codec_ctx);
+	/*
+	save from before_ms ahead of trigger_us to after_ms past it, trigger_us 0 is now (av_gettime_relative clock).
+	returns at once with a clip id, -1 if nothing is buffered yet. format_name NULL guesses from the path.
+	*/
+	int ExportClip(const std::string& path, int before_ms, int after_ms, int64_t trigger_us = 0, const char* format_name = NULL);
+	// exports still collecting or writing
+	int GetExportCount();
+	// clips closed since Open, complete or failed
+	uint64_t GetWrittenClips();
+	uint64_t GetFailedClips();
+	size_t GetBufferedBytes();
+	int64_t GetBufferedDuration();
+};
+
+#endif
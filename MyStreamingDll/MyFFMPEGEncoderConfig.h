@@ -0,0 +1,94 @@
+#ifndef _MY_FFMPEG_ENCODER_CONFIG_H_
+#define _MY_FFMPEG_ENCODER_CONFIG_H_
+
+#include <cstdint>
+#include <string>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+// largest slice that still fits one RTP packet (1472 byte UDP payload minus RTP/NAL headers)
+#define RTP_SLICE_MAX_SIZE	1400
+
+enum MyRateControl{
+	RATE_CONTROL_DEFAULT = 0,	// bit_rate as average, codec defaults for the rest
+	RATE_CONTROL_CBR = 1,		// constant bit_rate, vbv_buffer_size as the allowed burst
+	RATE_CONTROL_VBR = 2,		// average bit_rate, peaks up to max_bit_rate
+	RATE_CONTROL_CRF = 3		// constant quality crf, optionally capped by max_bit_rate
+};
+
+enum MyThreadType{
+	THREAD_TYPE_AUTO = 0,
+	THREAD_TYPE_SLICE = 1,		// no extra latency
+	THREAD_TYPE_FRAME = 2		// more throughput, thread_count frames of delay
+};
+
+/*
+encoder settings passed to the codec. fields left at their defaults keep the codec's own choice.
+preset, tune and extra_options are codec private options (libx264: preset=ultrafast, tune=zerolatency),
+extra_options is a "key=value:key=value" list.
+*/
+struct MyFFMPEGEncoderConfig{
+	enum AVCodecID codec_id;
+	int width;
+	int height;
+	int fps;					// 0 = stream default
+	int64_t bit_rate;
+	// threading, thread_count 0 lets the codec decide
+	int thread_count;
+	enum MyThreadType thread_type;
+	// codec private options
+	std::string preset;
+	std::string tune;
+	std::string extra_options;
+	// stream structure
+	int gop_size;
+	int max_b_frames;			// -1 = codec default
+	// rate control
+	enum MyRateControl rate_control;
+	int crf;
+	int64_t max_bit_rate;		// 0 = no cap
+	int vbv_buffer_size;		// bits, 0 = codec default
+	// low latency (libx264)
+	bool intra_refresh;			// refresh a moving intra column instead of sending full keyframes
+	int slice_max_size;			// bytes per slice, 0 = one slice per frame
+
+	MyFFMPEGEncoderConfig()
+		: codec_id(AV_CODEC_ID_MPEG4), width(0), height(0), fps(0), bit_rate(400000),
+		thread_count(0), thread_type(MyThreadType::THREAD_TYPE_AUTO),
+		preset(), tune(), extra_options(),
+		gop_size(12), max_b_frames(-1),
+		rate_control(MyRateControl::RATE_CONTROL_DEFAULT), crf(23), max_bit_rate(0), vbv_buffer_size(0),
+		intra_refresh(false), slice_max_size(0)
+	{}
+
+	/*
+	H.264 tuned for glass-to-glass latency over RTP: no B-frames, no lookahead,
+	periodic intra refresh once per second instead of keyframes, slices sized to the RTP packet
+	and a one-frame VBV so no frame is much larger than the average.
+	*/
+	static MyFFMPEGEncoderConfig LowLatencyH264(int width, int height, int64_t bit_rate, int fps = 0)
+	{
+		MyFFMPEGEncoderConfig config;
+		config.codec_id = AV_CODEC_ID_H264;
+		config.width = width;
+		config.height = height;
+		config.fps = fps;
+		config.bit_rate = bit_rate;
+		config.thread_type = MyThreadType::THREAD_TYPE_SLICE;
+		config.preset = "ultrafast";
+		config.tune = "zerolatency";
+		config.gop_size = fps > 0 ? fps : 30;
+		config.max_b_frames = 0;
+		config.rate_control = MyRateControl::RATE_CONTROL_VBR;
+		config.max_bit_rate = bit_rate;
+		config.vbv_buffer_size = (int)(bit_rate / (fps > 0 ? fps : 30));
+		config.intra_refresh = true;
+		config.slice_max_size = RTP_SLICE_MAX_SIZE;
+		return config;
+	}
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include <cerrno>
+#include <algorithm>
+#include "MyFFMPEGRTPSink.h"
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+MyFFMPEGRTPSink::MyFFMPEGRTPSink()
+	: MyFFMPEGSink(), rtp_io(NULL), is_paced(true),
+	frame_interval_us(0), avg_packet_bytes(0), pace_bytes_per_us(0), next_send_us(0)
+{}
+
+MyFFMPEGRTPSink::~MyFFMPEGRTPSink()
+{
+	// the base destructor can no longer reach close_io of this class
+	Close();
+}
+
+bool MyFFMPEGRTPSink::IsRTP(const std::string& url, const char* format_name)
+{
+	if (format_name)
+		return std::string(format_name) == "rtp";
+
+	return url.compare(0, 6, "rtp://") == 0;
+}
+
+bool MyFFMPEGRTPSink::Open(int id, const std::string& url, const char* format_name, AVCodecContext *codec_ctx)
+{
+	OnEncoderChanged(codec_ctx);
+	this->avg_packet_bytes = 0;
+	this->pace_bytes_per_us = 0;
+	this->next_send_us = 0;
+
+	return MyFFMPEGSink::Open(id, url, format_name, codec_ctx);
+}
+
+void MyFFMPEGRTPSink::OnEncoderChanged(AVCodecContext *codec_ctx)
+{
+	AVRational microseconds = { 1, 1000000 };
+	this->frame_interval_us = av_rescale_q(1, codec_ctx->time_base, microseconds);
+}
+
+void MyFFMPEGRTPSink::SetPacing(bool enable)
+{
+	this->is_paced = enable;
+}
+
+int MyFFMPEGRTPSink::open_io()
+{
+	int ret = avio_open(&this->rtp_io, this->url.c_str(), AVIO_FLAG_WRITE);
+	if (ret < 0)
+		return ret;
+
+	/* one datagram per flush, the muxer sizes its packets to max_packet_size */
+	int size = this->rtp_io->max_packet_size > 0 ? this->rtp_io->max_packet_size : RTP_DATAGRAM_SIZE;
+	unsigned char *buffer = (unsigned char *)av_malloc(size);
+	this->oc->pb = buffer ? avio_alloc_context(buffer, size, 1, this, NULL, write_datagram, NULL) : NULL;
+	if (!this->oc->pb)
+	{
+		av_free(buffer);
+		avio_closep(&this->rtp_io);
+		return AVERROR(ENOMEM);
+	}
+	this->oc->pb->max_packet_size = size;
+	this->oc->pb->seekable = 0;
+
+	return 0;
+}
+
+void MyFFMPEGRTPSink::close_io()
+{
+	if (this->oc && this->oc->pb)
+	{
+		avio_flush(this->oc->pb);
+		av_freep(&this->oc->pb->buffer);
+		av_freep(&this->oc->pb);
+	}
+	if (this->rtp_io)
+		avio_closep(&this->rtp_io);
+}
+
+bool MyFFMPEGRTPSink::write_packet(AVPacket *pkt, const AVRational *time_base)
+{
+	// the floor follows the average frame, a frame larger than the floor allows is stretched instead
+	if (this->avg_packet_bytes <= 0)
+		this->avg_packet_bytes = pkt->size;
+	else
+		this->avg_packet_bytes += (pkt->size - this->avg_packet_bytes) * PACING_SMOOTHING;
+
+	int64_t frame_interval_us = this->frame_interval_us;
+	if (frame_interval_us > 0)
+	{
+		double floor_rate = PACING_RATE_FACTOR * this->avg_packet_bytes / frame_interval_us;
+		double frame_rate = pkt->size / (frame_interval_us * PACING_SPREAD);
+		this->pace_bytes_per_us = std::max(floor_rate, frame_rate);
+	}
+
+	return MyFFMPEGSink::write_packet(pkt, time_base);
+}
+
+int MyFFMPEGRTPSink::write_datagram(void *opaque, uint8_t *buf, int buf_size)
+{
+	MyFFMPEGRTPSink *sink = (MyFFMPEGRTPSink *)opaque;
+
+	// RTCP packet types 200-204 share the byte of the RTP marker and payload type
+	bool is_rtcp = buf_size >= 2 && buf[1] >= 200 && buf[1] <= 204;
+	if (!is_rtcp && sink->is_paced)
+		sink->pace(buf_size);
+
+	avio_write(sink->rtp_io, buf, buf_size);
+	avio_flush(sink->rtp_io);
+	if (sink->rtp_io->error < 0)
+		return sink->rtp_io->error;
+
+	return buf_size;
+}
+
+void MyFFMPEGRTPSink::pace(int size)
+{
+	if (this->pace_bytes_per_us <= 0)
+		return;
+
+	int64_t now = av_gettime_relative();
+	// an idle link carries no debt, the next frame starts right away
+	if (this->next_send_us < now)
+		this->next_send_us = now;
+	else if (this->next_send_us - now > PACING_SLACK_US)
+		av_usleep((unsigned)(this->next_send_us - now));
+
+	this->next_send_us += (int64_t)(size / this->pace_bytes_per_us);
+}
@@ -0,0 +1,58 @@
+#ifndef _MY_FFMPEG_RTP_SINK_H_
+#define _MY_FFMPEG_RTP_SINK_H_
+
+#include <atomic>
+
+#include "MyFFMPEGSink.h"
+
+// largest UDP payload of an Ethernet MTU, used if the protocol does not tell
+#define RTP_DATAGRAM_SIZE		1472
+// paced outputs send at least this multiple of their average rate, ordinary frames stay short
+#define PACING_RATE_FACTOR		4
+// a frame too large for that rate is spread over this share of the frame interval
+#define PACING_SPREAD			0.8
+// ahead of schedule by less than this, the datagram goes out without sleeping
+#define PACING_SLACK_US			500
+#define PACING_SMOOTHING		0.05
+
+/*
+RTP output with packet pacing. the RTP muxer writes into an AVIOContext of the sink,
+which hands every datagram to the rtp:// protocol on the output thread, spaced so a keyframe
+is spread across the frame interval instead of leaving as one burst that overflows
+the queues of a constrained link. RTCP is never delayed.
+*/
+class MyFFMPEGRTPSink : public MyFFMPEGSink
+{
+public:
+	MyFFMPEGRTPSink();
+	~MyFFMPEGRTPSink();
+
+	// whether url and format_name make an RTP output
+	static bool IsRTP(const std::string& url, const char* format_name);
+
+private:
+	// the rtp:// protocol, the muxer's own AVIOContext writes into it
+	AVIOContext *rtp_io;
+	std::atomic<bool> is_paced;
+	// follows the frame rate of the encoder
+	std::atomic<int64_t> frame_interval_us;
+	// pacing state, output thread only
+	double avg_packet_bytes;
+	double pace_bytes_per_us;
+	int64_t next_send_us;
+
+	static int write_datagram(void *opaque, uint8_t *buf, int buf_size);
+	void pace(int size);
+
+protected:
+	int open_io();
+	void close_io();
+	bool write_packet(AVPacket *pkt, const AVRational *time_base);
+
+public:
+	bool Open(int id, const std::string& url, const char* format_name, AVCodecContext *codec_ctx);
+	void OnEncoderChanged(AVCodecContext *codec_ctx);
+	void SetPacing(bool enable);
+};
+
+#endif
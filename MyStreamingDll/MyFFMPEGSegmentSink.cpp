@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "MyFFMPEGSegmentSink.h"
+
+extern "C"
+{
+#include <libavutil/opt.h>
+}
+
+MyFFMPEGSegmentSink::MyFFMPEGSegmentSink(int segment_count, size_t segment_size)
+	: MyFFMPEGSink(), segment_count(segment_count > 1 ? segment_count : 2),
+	segment_size(segment_size - segment_size % TS_PACKET_SIZE), segments(), is_unfilled(),
+	current(0), used(0), started_segments(0)
+{
+	if (this->segment_size < SEGMENT_IO_BUFFER)
+		this->segment_size = SEGMENT_IO_BUFFER;
+}
+
+MyFFMPEGSegmentSink::~MyFFMPEGSegmentSink()
+{
+	// the base destructor can no longer reach close_io of this class
+	Close();
+}
+
+std::string MyFFMPEGSegmentSink::GetSegmentPath(const std::string& directory, int index)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "segment_%03d.ts", index);
+
+	std::string path(directory);
+	if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\')
+		path.append("/");
+	return path.append(name);
+}
+
+std::vector<std::string> MyFFMPEGSegmentSink::GetSegmentPaths()
+{
+	std::vector<std::string> paths;
+	std::lock_guard<std::mutex> lock(this->segment_lock);
+
+	uint64_t count = std::min(this->started_segments, (uint64_t)this->segment_count);
+	for (uint64_t i = this->started_segments - count; i < this->started_segments; i++)
+		paths.push_back(GetSegmentPath(this->url, (int)(i % this->segment_count)));
+
+	return paths;
+}
+
+bool MyFFMPEGSegmentSink::Open(int id, const std::string& url, const char* format_name, AVCodecContext *codec_ctx)
+{
+	// url is the directory of the ring, the segments are always MPEG-TS
+	return MyFFMPEGSink::Open(id, url, "mpegts", codec_ctx);
+}
+
+int MyFFMPEGSegmentSink::open_io()
+{
+	/* map the whole ring now. Open runs while the encoder waits, touching every page is left to the output thread */
+	for (int i = 0; i < this->segment_count; i++)
+	{
+		KMappedFile *segment = new KMappedFile();
+		this->segments.push_back(segment);
+		if (!segment->Open(GetSegmentPath(this->url, i), this->segment_size))
+		{
+			close_segments();
+			return AVERROR(EIO);
+		}
+		this->is_unfilled.push_back(segment->IsCreated());
+	}
+
+	unsigned char *buffer = (unsigned char *)av_malloc(SEGMENT_IO_BUFFER);
+	this->oc->pb = buffer ? avio_alloc_context(buffer, SEGMENT_IO_BUFFER, 1, this, NULL, write_data, NULL) : NULL;
+	if (!this->oc->pb)
+	{
+		av_free(buffer);
+		close_segments();
+		return AVERROR(ENOMEM);
+	}
+	this->oc->pb->seekable = 0;
+
+	this->current = 0;
+	this->used = 0;
+	this->segment_lock.lock();
+	this->started_segments = 1;
+	this->segment_lock.unlock();
+
+	return 0;
+}
+
+void MyFFMPEGSegmentSink::close_io()
+{
+	if (this->oc && this->oc->pb)
+	{
+		avio_flush(this->oc->pb);
+		av_freep(&this->oc->pb->buffer);
+		av_freep(&this->oc->pb);
+	}
+	if (!this->segments.empty())
+		finish_segment();
+	close_segments();
+}
+
+void MyFFMPEGSegmentSink::close_segments()
+{
+	for (size_t i = 0; i < this->segments.size(); i++)
+		delete this->segments[i];
+	this->segments.clear();
+	this->is_unfilled.clear();
+}
+
+bool MyFFMPEGSegmentSink::write_packet(AVPacket *pkt, const AVRational *time_base)
+{
+	// every segment starts at a keyframe so it plays on its own
+	if ((pkt->flags & AV_PKT_FLAG_KEY) && this->used >= this->segment_size * SEGMENT_ROTATE_FILL)
+	{
+		// what the muxer still buffers belongs to the old segment
+		avio_flush(this->oc->pb);
+		next_segment();
+	}
+
+	return MyFFMPEGSink::write_packet(pkt, time_base);
+}
+
+int MyFFMPEGSegmentSink::write_data(void *opaque, uint8_t *buf, int buf_size)
+{
+	MyFFMPEGSegmentSink *sink = (MyFFMPEGSegmentSink *)opaque;
+	int left = buf_size;
+
+	while (left > 0)
+	{
+		// a GOP larger than the segment goes on in the next one, both stay aligned to TS packets
+		if (sink->used == sink->segment_size)
+			sink->next_segment();
+		if (sink->used == 0)
+			sink->begin_segment();
+
+		size_t count = std::min((size_t)left, sink->segment_size - sink->used);
+		memcpy(sink->segments[sink->current]->GetData() + sink->used, buf, count);
+		sink->used += count;
+		buf += count;
+		left -= (int)count;
+	}
+
+	return buf_size;
+}
+
+void MyFFMPEGSegmentSink::next_segment()
+{
+	finish_segment();
+
+	this->current = (this->current + 1) % this->segment_count;
+	this->used = 0;
+	this->segment_lock.lock();
+	this->started_segments++;
+	this->segment_lock.unlock();
+
+	// the program tables again before the next packet, a player can open the file cold
+	if (this->oc && this->oc->priv_data)
+		av_opt_set(this->oc->priv_data, "mpegts_flags", "+resend_headers", 0);
+}
+
+void MyFFMPEGSegmentSink::begin_segment()
+{
+	// a new file is padded once, a crash leaves null packets after the last write instead of zeros
+	if (!this->is_unfilled[this->current])
+		return;
+
+	KMappedFile *segment = this->segments[this->current];
+	fill_null_packets(segment->GetData(), segment->GetSize());
+	this->is_unfilled[this->current] = false;
+}
+
+void MyFFMPEGSegmentSink::finish_segment()
+{
+	KMappedFile *segment = this->segments[this->current];
+
+	// what an earlier lap left behind becomes padding
+	fill_null_packets(segment->GetData() + this->used, segment->GetSize() - this->used);
+	segment->Flush();
+}
+
+void MyFFMPEGSegmentSink::fill_null_packets(uint8_t *data, size_t size)
+{
+	static const uint8_t null_header[4] = { 0x47, 0x1f, 0xff, 0x10 };
+
+	for (size_t offset = 0; offset + TS_PACKET_SIZE <= size; offset += TS_PACKET_SIZE)
+	{
+		memcpy(data + offset, null_header, sizeof(null_header));
+		memset(data + offset + sizeof(null_header), 0xff, TS_PACKET_SIZE - sizeof(null_header));
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef _MY_FFMPEG_SEGMENT_SINK_H_
+#define _MY_FFMPEG_SEGMENT_SINK_H_
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "MyFFMPEGSink.h"
+#include "KMappedFile.h"
+
+#define SEGMENT_COUNT			16
+#define SEGMENT_SIZE			(16 * 1024 * 1024)
+#define TS_PACKET_SIZE			188
+// the muxer's write buffer, whole TS packets so a flush never splits one
+#define SEGMENT_IO_BUFFER		(TS_PACKET_SIZE * 64)
+// a keyframe past this share of the segment starts the next one
+#define SEGMENT_ROTATE_FILL		0.75
+
+/*
+records the encoded packets as MPEG-TS into a ring of segment_count files of segment_size bytes,
+"<directory>/segment_000.ts" and on, each preallocated and memory-mapped once in Open.
+writing is a memcpy into the mapping, the file system never allocates on the output thread.
+a new file is padded with null packets by the output thread when the ring first reaches it, not in Open.
+segments start at a keyframe with the PAT/PMT resent, the unused tail is filled with TS null packets,
+so every file plays on its own. the ring keeps about segment_count * segment_size * 0.75 bytes of video,
+at 4 Mbit/s the defaults hold six minutes. the oldest segment is overwritten first.
+*/
+class MyFFMPEGSegmentSink : public MyFFMPEGSink
+{
+public:
+	MyFFMPEGSegmentSink(int segment_count = SEGMENT_COUNT, size_t segment_size = SEGMENT_SIZE);
+	~MyFFMPEGSegmentSink();
+
+private:
+	int segment_count;
+	size_t segment_size;
+	std::vector<KMappedFile*> segments;
+	// files created by Open, padded with null packets when the ring first reaches them
+	std::vector<bool> is_unfilled;
+	// current segment and how far it is written, output thread only
+	int current;
+	size_t used;
+	// segments started since Open, for the recording order
+	std::mutex segment_lock;
+	uint64_t started_segments;
+
+	static int write_data(void *opaque, uint8_t *buf, int buf_size);
+	// close the current segment and start writing over the oldest
+	void next_segment();
+	void finish_segment();
+	// on the output thread, before the first byte goes into the current segment
+	void begin_segment();
+	static void fill_null_packets(uint8_t *data, size_t size);
+	void close_segments();
+
+protected:
+	int open_io();
+	void close_io();
+	bool write_packet(AVPacket *pkt, const AVRational *time_base);
+
+public:
+	// url is the directory of the ring, format_name is ignored
+	bool Open(int id, const std::string& url, const char* format_name, AVCodecContext *codec_ctx);
+	static std::string GetSegmentPath(const std::string& directory, int index);
+	// the segments recorded since Open, oldest first
+	std::vector<std::string> GetSegmentPaths();
+};
+
+#endif
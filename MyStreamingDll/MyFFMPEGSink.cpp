@@ -0,0 +1,367 @@
+#include <iostream>
+#include <cstring>
+#include "MyFFMPEGStreamer.h"
+#include "MyFFMPEGSink.h"
+
+MyFFMPEGSink::MyFFMPEGSink()
+	: id(-1), last_error(MyFFMPEGStreamerError::NO_FFMPEG_ERROR), url(),
+	fmt(NULL), oc(NULL), video_st(NULL), is_header_written(false), is_header_deferred(false), wait_keyframe(true),
+	written_packets(0), failed_packets(0), send_stats(NULL),
+	io_thread(NULL), queue(), is_closing(false), is_resyncing(false), keyframe_wanted(false)
+{}
+
+MyFFMPEGSink::~MyFFMPEGSink()
+{
+	Close();
+}
+
+bool MyFFMPEGSink::NeedsGlobalHeader(const std::string& url, const char* format_name)
+{
+	AVOutputFormat *guess = av_guess_format(format_name, url.c_str(), NULL);
+
+	return guess && (guess->flags & AVFMT_GLOBALHEADER);
+}
+
+bool MyFFMPEGSink::ExtractExtradata(AVCodecContext *codec_ctx, const AVPacket *pkt)
+{
+	const AVBitStreamFilter *filter = av_bsf_get_by_name("extract_extradata");
+	AVBSFContext *bsf = NULL;
+	bool is_found = false;
+
+	/* the filter takes the reference it is given, the caller's packet stays untouched */
+	AVPacket *filtered = av_packet_clone(pkt);
+	if (filter && filtered && av_bsf_alloc(filter, &bsf) >= 0 &&
+		avcodec_parameters_from_context(bsf->par_in, codec_ctx) >= 0 && av_bsf_init(bsf) >= 0 &&
+		av_bsf_send_packet(bsf, filtered) >= 0 && av_bsf_receive_packet(bsf, filtered) >= 0)
+	{
+		int size = 0;
+		uint8_t *data = av_packet_get_side_data(filtered, AV_PKT_DATA_NEW_EXTRADATA, &size);
+		if (data && size > 0)
+		{
+			av_freep(&codec_ctx->extradata);
+			codec_ctx->extradata_size = 0;
+			codec_ctx->extradata = (uint8_t*)av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+			if (codec_ctx->extradata)
+			{
+				memcpy(codec_ctx->extradata, data, size);
+				codec_ctx->extradata_size = size;
+				is_found = true;
+			}
+		}
+	}
+
+	av_packet_free(&filtered);
+	av_bsf_free(&bsf);
+	return is_found;
+}
+
+bool MyFFMPEGSink::Open(int id, const std::string& url, const char* format_name, AVCodecContext *codec_ctx)
+{
+	int ret;
+	char errorBuff[80];
+
+	Close();
+
+	this->id = id;
+	this->url = url;
+
+	/* allocate the output media context */
+	avformat_alloc_output_context2(&this->oc, NULL, format_name, url.c_str());
+	if (!this->oc)
+	{
+		this->last_error = MyFFMPEGStreamerError::CANT_ALLOC_FORMAT_CONTEXT;
+		return false;
+	}
+
+	// alloc output format
+	this->fmt = this->oc->oformat;
+	if (!this->fmt)
+	{
+		this->last_error = MyFFMPEGStreamerError::CANT_ALLOC_OUTPUT_FORMAT;
+		Close();
+		return false;
+	}
+
+	/* the stream describes the shared encoder, nothing is encoded here */
+	this->video_st = avformat_new_stream(this->oc, codec_ctx->codec);
+	if (!this->video_st || avcodec_copy_context(this->video_st->codec, codec_ctx) < 0)
+	{
+		this->last_error = MyFFMPEGStreamerError::CANT_ADD_STREAM;
+		Close();
+		return false;
+	}
+	this->video_st->id = this->oc->nb_streams - 1;
+	this->video_st->time_base = codec_ctx->time_base;
+
+	/* Some formats want stream headers to be separate. */
+	if (this->fmt->flags & AVFMT_GLOBALHEADER)
+		this->video_st->codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	av_dump_format(this->oc, 0, url.c_str(), 1);
+
+	ret = open_io();
+	if (ret < 0) {
+		this->last_error = MyFFMPEGStreamerError::CANT_OPEN_RTSP_OUTPUT;
+		fprintf(stderr, "Could not open outfile '%s': %s", url.c_str(), av_make_error_string(errorBuff, 80, ret));
+		Close();
+		return false;
+	}
+
+	/* mp4 and mkv describe the stream in their header, an encoder opened for RTP puts that into its keyframes */
+	this->is_header_deferred = (this->fmt->flags & AVFMT_GLOBALHEADER) && codec_ctx->extradata_size <= 0;
+	if (!this->is_header_deferred)
+	{
+		ret = avformat_write_header(this->oc, NULL);
+		if (ret < 0) {
+			this->last_error = MyFFMPEGStreamerError::CANT_WRITE_HEADER;
+			fprintf(stderr, "Error occurred when writing header: %s", av_make_error_string(errorBuff, 80, ret));
+			Close();
+			return false;
+		}
+		this->is_header_written = true;
+	}
+	this->wait_keyframe = true;
+	this->is_resyncing = false;
+
+	this->is_closing = false;
+	this->io_thread = new std::thread(&MyFFMPEGSink::SendPackets, this);
+
+	return true;
+}
+
+bool MyFFMPEGSink::WritePacket(const AVPacket *pkt, const AVRational *time_base)
+{
+	if (!this->is_header_written && !this->is_header_deferred)
+		return false;
+
+	std::lock_guard<std::mutex> lock(this->queue_lock);
+
+	// the link stalled, what is queued is stale. start over at the next keyframe
+	if ((int)this->queue.size() >= SINK_QUEUE_PACKETS)
+	{
+		if (this->send_stats)
+			this->send_stats->dropped_packets += this->queue.size();
+		clear_queue();
+		this->wait_keyframe = true;
+		this->is_resyncing = true;
+		this->keyframe_wanted = true;
+	}
+
+	// a receiver can only start decoding at a keyframe
+	if (this->wait_keyframe)
+	{
+		if (!(pkt->flags & AV_PKT_FLAG_KEY))
+		{
+			// frames a receiver would have had are dropped, a new receiver simply starts later
+			if (!this->is_resyncing)
+				return true;
+			if (this->send_stats)
+				this->send_stats->dropped_packets++;
+			return false;
+		}
+		this->wait_keyframe = false;
+		this->is_resyncing = false;
+	}
+
+	/* take a reference to the encoded data, the output thread releases it */
+	AVPacket *queued = av_packet_clone(pkt);
+	if (!queued)
+	{
+		this->failed_packets++;
+		if (this->send_stats)
+			this->send_stats->failed_packets++;
+		return false;
+	}
+
+	// an encoder swapped in later may count in another time base, the queued packets keep theirs
+	struct MySinkPacket entry = { queued, *time_base };
+	this->queue.push_back(entry);
+	this->queue_cond.notify_one();
+	return true;
+}
+
+bool MyFFMPEGSink::write_packet(AVPacket *pkt, const AVRational *time_base)
+{
+	// the first packet is a keyframe, its headers complete the stream description
+	if (this->is_header_deferred && !write_deferred_header(pkt))
+	{
+		this->failed_packets++;
+		if (this->send_stats)
+			this->send_stats->failed_packets++;
+		return false;
+	}
+
+	/* rescale output packet timestamp values from codec to stream timebase */
+	pkt->pts = av_rescale_q_rnd(pkt->pts, *time_base, this->video_st->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+	pkt->dts = av_rescale_q_rnd(pkt->dts, *time_base, this->video_st->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+	pkt->duration = av_rescale_q(pkt->duration, *time_base, this->video_st->time_base);
+	pkt->stream_index = this->video_st->index;
+
+	/* Write the compressed frame to the media file. a single stream needs no interleaving queue. */
+	int ret = av_write_frame(this->oc, pkt);
+	if (ret < 0)
+	{
+		this->failed_packets++;
+		if (this->send_stats)
+			this->send_stats->failed_packets++;
+		return false;
+	}
+
+	this->written_packets++;
+	return true;
+}
+
+bool MyFFMPEGSink::write_deferred_header(const AVPacket *pkt)
+{
+	int ret;
+	char errorBuff[80];
+
+	this->is_header_deferred = false;
+	if (!ExtractExtradata(this->video_st->codec, pkt))
+		fprintf(stderr, "No stream headers found in the first keyframe for '%s'\n", this->url.c_str());
+
+	ret = avformat_write_header(this->oc, NULL);
+	if (ret < 0) {
+		this->last_error = MyFFMPEGStreamerError::CANT_WRITE_HEADER;
+		fprintf(stderr, "Error occurred when writing header: %s", av_make_error_string(errorBuff, 80, ret));
+		return false;
+	}
+	this->is_header_written = true;
+
+	return true;
+}
+
+void MyFFMPEGSink::SendPackets()
+{
+	std::unique_lock<std::mutex> lock(this->queue_lock);
+
+	while (true)
+	{
+		this->queue_cond.wait(lock, [this] { return this->is_closing || !this->queue.empty(); });
+		// Close waits for the packets already queued
+		if (this->queue.empty())
+			break;
+
+		AVPacket *pkt = this->queue.front().pkt;
+		AVRational time_base = this->queue.front().time_base;
+		this->queue.pop_front();
+		lock.unlock();
+
+		int64_t start_time = av_gettime_relative();
+		write_packet(pkt, &time_base);
+		if (this->send_stats)
+			this->send_stats->send_hist.Record(av_gettime_relative() - start_time);
+		av_packet_free(&pkt);
+
+		lock.lock();
+	}
+}
+
+void MyFFMPEGSink::clear_queue()
+{
+	for (size_t i = 0; i < this->queue.size(); i++)
+		av_packet_free(&this->queue[i].pkt);
+	this->queue.clear();
+}
+
+void MyFFMPEGSink::Close()
+{
+	/* send what is queued, the trailer comes after the last packet */
+	if (this->io_thread)
+	{
+		this->queue_lock.lock();
+		this->is_closing = true;
+		this->queue_cond.notify_all();
+		this->queue_lock.unlock();
+
+		this->io_thread->join();
+		delete this->io_thread;
+		this->io_thread = NULL;
+	}
+	this->queue_lock.lock();
+	clear_queue();
+	this->queue_lock.unlock();
+
+	/* Write the trailer, if any. */
+	if (this->oc && this->is_header_written)
+		av_write_trailer(this->oc);
+
+	if (this->oc)
+		close_io();
+
+	/* free the stream */
+	if (this->oc)
+		avformat_free_context(this->oc);
+
+	this->oc = NULL;
+	this->fmt = NULL;
+	this->video_st = NULL;
+	this->is_header_written = false;
+	this->is_header_deferred = false;
+}
+
+int MyFFMPEGSink::GetID()
+{
+	return this->id;
+}
+
+const std::string& MyFFMPEGSink::GetUrl()
+{
+	return this->url;
+}
+
+uint64_t MyFFMPEGSink::GetWrittenPackets()
+{
+	return this->written_packets;
+}
+
+uint64_t MyFFMPEGSink::GetFailedPackets()
+{
+	return this->failed_packets;
+}
+
+void MyFFMPEGSink::OnEncoderChanged(AVCodecContext *codec_ctx)
+{
+	// the header is written, decoders follow the parameter sets in the stream
+}
+
+void MyFFMPEGSink::SetPacing(bool enable)
+{
+	// files and other byte outputs have nothing to pace
+}
+
+void MyFFMPEGSink::SetSendStats(struct MyFFMPEGSendStats *stats)
+{
+	this->send_stats = stats;
+}
+
+int MyFFMPEGSink::GetQueueSize()
+{
+	std::lock_guard<std::mutex> lock(this->queue_lock);
+	return (int)this->queue.size();
+}
+
+bool MyFFMPEGSink::TakeKeyframeRequest()
+{
+	return this->keyframe_wanted.exchange(false);
+}
+
+int MyFFMPEGSink::GetLastError()
+{
+	return this->last_error;
+}
+
+int MyFFMPEGSink::open_io()
+{
+	if (this->fmt->flags & AVFMT_NOFILE)
+		return 0;
+
+	return avio_open(&this->oc->pb, this->url.c_str(), AVIO_FLAG_WRITE);
+}
+
+void MyFFMPEGSink::close_io()
+{
+	if (this->fmt && !(this->fmt->flags & AVFMT_NOFILE))
+		/* Close the output file. */
+		avio_closep(&this->oc->pb);
+}
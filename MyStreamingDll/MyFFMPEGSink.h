@@ -0,0 +1,125 @@
+#ifndef _MY_FFMPEG_SINK_H_
+#define _MY_FFMPEG_SINK_H_
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+}
+
+#include "KLatencyHistogram.h"
+
+// packets an output may have waiting, about a second of video. beyond that the link has stalled
+#define SINK_QUEUE_PACKETS		32
+
+// send counters shared by the outputs of one encoder, updated from their output threads
+struct MyFFMPEGSendStats{
+	KLatencyHistogram send_hist;				// muxing and sending one packet, pacing included
+	std::atomic<uint64_t> dropped_packets;		// discarded by a full send queue
+	std::atomic<uint64_t> failed_packets;		// the muxer or the network refused them
+
+	MyFFMPEGSendStats() : send_hist(), dropped_packets(0), failed_packets(0) {}
+	void Reset()
+	{
+		send_hist.Reset();
+		dropped_packets = 0;
+		failed_packets = 0;
+	}
+};
+
+// a packet waiting for the output thread, in the time base of the encoder that made it
+struct MySinkPacket{
+	AVPacket *pkt;
+	AVRational time_base;
+};
+
+/*
+one muxer output (RTP destination, recording file, ...) of a shared encoder.
+packets are handed over by reference, a sink never copies the encoded data.
+a sink added while streaming waits for the next keyframe before writing.
+WritePacket only queues the packet, an output thread of the sink muxes and sends it,
+so a stalled socket or disk never holds up the encoder. when the queue overflows it is
+dropped as a whole and the sink resumes at the next keyframe, which it asks the encoder for.
+*/
+class MyFFMPEGSink
+{
+public:
+	MyFFMPEGSink();
+	virtual ~MyFFMPEGSink();
+
+protected:
+	int id;
+	int last_error;
+	std::string url;
+	AVOutputFormat *fmt;
+	AVFormatContext *oc;
+	AVStream *video_st;
+	std::atomic<bool> is_header_written;
+	// the output needs global headers the encoder does not have, the header waits for the first keyframe
+	std::atomic<bool> is_header_deferred;
+	bool wait_keyframe;
+	// counters
+	std::atomic<uint64_t> written_packets;
+	std::atomic<uint64_t> failed_packets;
+	struct MyFFMPEGSendStats *send_stats;
+	// send stage, filled by the encoding thread and emptied by the output thread
+	std::thread *io_thread;
+	std::mutex queue_lock;
+	std::condition_variable queue_cond;
+	std::deque<struct MySinkPacket> queue;
+	bool is_closing;
+	// waiting for a keyframe after the queue overflowed
+	bool is_resyncing;
+	std::atomic<bool> keyframe_wanted;
+
+	// open and close the byte output of the muxer
+	virtual int open_io();
+	virtual void close_io();
+	// mux one packet, on the output thread
+	virtual bool write_packet(AVPacket *pkt, const AVRational *time_base);
+	// take the headers from the keyframe pkt, then write the deferred stream header
+	bool write_deferred_header(const AVPacket *pkt);
+	// output thread
+	void SendPackets();
+	void clear_queue();
+
+public:
+	// whether the encoder must put its headers in extradata for this output
+	static bool NeedsGlobalHeader(const std::string& url, const char* format_name);
+	// the parameter sets (SPS/PPS, VOL, ...) in the keyframe pkt as extradata of codec_ctx, false if none were found
+	static bool ExtractExtradata(AVCodecContext *codec_ctx, const AVPacket *pkt);
+	/*
+	format_name may be NULL to guess the muxer from the url ("rtp://...", "record.mkv", ...).
+	the stream parameters are copied from the opened encoder context. a muxer that needs global headers
+	(mp4, mkv) fed by an encoder with in-band headers gets them from the first keyframe.
+	*/
+	virtual bool Open(int id, const std::string& url, const char* format_name, AVCodecContext *codec_ctx);
+	// queue a reference for the output thread, false if it was dropped
+	virtual bool WritePacket(const AVPacket *pkt, const AVRational *time_base);
+	// sends what is still queued, then writes the trailer
+	virtual void Close();
+	// the streamer swapped in an encoder with other settings, called before its first packet
+	virtual void OnEncoderChanged(AVCodecContext *codec_ctx);
+	// spread large frames over the frame interval, only network outputs pace
+	virtual void SetPacing(bool enable);
+	void SetSendStats(struct MyFFMPEGSendStats *stats);
+	int GetQueueSize();
+	// true once after the queue overflowed, the receiver needs a keyframe to resume
+	bool TakeKeyframeRequest();
+	int GetID();
+	const std::string& GetUrl();
+	uint64_t GetWrittenPackets();
+	uint64_t GetFailedPackets();
+	int GetLastError();
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <thread>
+#include "MyFFMPEGSliceScaler.h"
+
+extern "C"
+{
+#include <libavutil/pixdesc.h>
+}
+
+static int common_divisor(int a, int b)
+{
+	while (b != 0)
+	{
+		int r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+MyFFMPEGSliceScaler::MyFFMPEGSliceScaler()
+	: key(), slices(), slice_count(0), thread_limit(0), built_slice_count(0), pool(), running(0)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		this->src_data[i] = NULL;
+		this->src_linesize[i] = 0;
+		this->dst_data[i] = NULL;
+		this->dst_linesize[i] = 0;
+	}
+}
+
+MyFFMPEGSliceScaler::~MyFFMPEGSliceScaler()
+{
+	Reset();
+}
+
+void MyFFMPEGSliceScaler::SetSliceCount(int slice_count)
+{
+	this->slice_count = std::min(std::max(slice_count, 0), SCALER_MAX_SLICES);
+}
+
+void MyFFMPEGSliceScaler::SetThreadLimit(int thread_limit)
+{
+	this->thread_limit = std::max(thread_limit, 0);
+}
+
+int MyFFMPEGSliceScaler::GetSliceCount()
+{
+	return (int)this->slices.size();
+}
+
+void MyFFMPEGSliceScaler::Reset()
+{
+	this->pool.Stop();
+	free_slices();
+}
+
+void MyFFMPEGSliceScaler::free_slices()
+{
+	for (size_t i = 0; i < this->slices.size(); i++)
+		sws_freeContext(this->slices[i].ctx);
+	this->slices.clear();
+	this->built_slice_count = 0;
+}
+
+int MyFFMPEGSliceScaler::pick_slice_count(int dst_width, int dst_height)
+{
+	int count = this->slice_count;
+	if (count <= 0)
+	{
+		// the encoder has threads of its own, small frames are not worth splitting
+		int cores = (int)std::thread::hardware_concurrency();
+		if (this->thread_limit > 0)
+			cores = std::min(cores, (int)this->thread_limit);
+		int64_t pixels = (int64_t)dst_width * dst_height;
+		count = (int)std::min<int64_t>(std::max(cores, 1), pixels / SCALER_SLICE_PIXELS);
+	}
+
+	// every band keeps at least one aligned block of rows
+	count = std::min(count, dst_height / SCALER_SLICE_ALIGN);
+	return std::min(std::max(count, 1), SCALER_MAX_SLICES);
+}
+
+bool MyFFMPEGSliceScaler::Prepare(int src_width, int src_height, enum AVPixelFormat src_fmt,
+								int dst_width, int dst_height, enum AVPixelFormat dst_fmt, int flags)
+{
+	struct MySwsKey wanted = { src_width, src_height, src_fmt, dst_width, dst_height, dst_fmt, flags };
+	int count = pick_slice_count(dst_width, dst_height);
+
+	if (!this->slices.empty() && count == this->built_slice_count &&
+		this->key.src_width == src_width && this->key.src_height == src_height && this->key.src_fmt == src_fmt &&
+		this->key.dst_width == dst_width && this->key.dst_height == dst_height && this->key.dst_fmt == dst_fmt &&
+		this->key.flags == flags)
+		return true;
+
+	return build(wanted, count);
+}
+
+bool MyFFMPEGSliceScaler::build(const struct MySwsKey& key, int count)
+{
+	free_slices();
+
+	/* a subsampled source needs its bands to start on whole chroma rows too */
+	const AVPixFmtDescriptor *src_desc = av_pix_fmt_desc_get(key.src_fmt);
+	int src_align = src_desc ? 1 << src_desc->log2_chroma_h : 2;
+
+	/*
+	seams go where both heights split at exactly the overall ratio, so every band scales like the whole picture:
+	on multiples of src_unit source and dst_unit output rows, in blocks of step of those to keep the chroma rows whole.
+	heights without such seams (1080 to 1079) are converted in one band.
+	*/
+	int divisor = common_divisor(key.src_height, key.dst_height);
+	int src_unit = key.src_height / divisor;
+	int dst_unit = key.dst_height / divisor;
+	int src_step = src_align / common_divisor(src_align, src_unit);
+	int dst_step = SCALER_SLICE_ALIGN / common_divisor(SCALER_SLICE_ALIGN, dst_unit);
+	int step = src_step / common_divisor(src_step, dst_step) * dst_step;
+	int blocks = divisor / step;
+	int bands = std::max(std::min(count, blocks), 1);
+
+	int dst_y = 0;
+	int src_y = 0;
+	for (int i = 0; i < bands; i++)
+	{
+		int dst_end = key.dst_height;
+		int src_end = key.src_height;
+		if (i < bands - 1)
+		{
+			int units = (int)((int64_t)blocks * (i + 1) / bands) * step;
+			dst_end = units * dst_unit;
+			src_end = units * src_unit;
+		}
+		if (dst_end <= dst_y || src_end <= src_y)
+		{
+			free_slices();
+			return false;
+		}
+
+		struct MyScalerSlice slice;
+		slice.src_y = src_y;
+		slice.src_height = src_end - src_y;
+		slice.dst_y = dst_y;
+		slice.dst_height = dst_end - dst_y;
+		slice.ctx = sws_getContext(key.src_width, slice.src_height, key.src_fmt,
+			key.dst_width, slice.dst_height, key.dst_fmt, key.flags, NULL, NULL, NULL);
+		if (!slice.ctx)
+		{
+			free_slices();
+			return false;
+		}
+		this->slices.push_back(slice);
+
+		src_y = src_end;
+		dst_y = dst_end;
+	}
+
+	/* the calling thread converts the first band */
+	if (bands > 1 && this->pool.GetWorkerCount() != bands - 1)
+		this->pool.Start(bands - 1, false);
+	else if (bands == 1)
+		this->pool.Stop();
+
+	// compared with the next request, not with the bands the heights allowed
+	this->key = key;
+	this->built_slice_count = count;
+	return true;
+}
+
+void MyFFMPEGSliceScaler::offset_planes(const uint8_t *const data[4], const int linesize[4], enum AVPixelFormat fmt,
+										int y, const uint8_t *out[4])
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt);
+	int chroma_shift = desc ? desc->log2_chroma_h : 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		int rows = (i == 1 || i == 2) ? y >> chroma_shift : y;
+		out[i] = data[i] ? data[i] + (ptrdiff_t)rows * linesize[i] : NULL;
+	}
+}
+
+void MyFFMPEGSliceScaler::scale_slice(int index)
+{
+	const struct MyScalerSlice& slice = this->slices[index];
+	const uint8_t *src[4];
+	const uint8_t *dst[4];
+
+	offset_planes(this->src_data, this->src_linesize, this->key.src_fmt, slice.src_y, src);
+	offset_planes((const uint8_t *const *)this->dst_data, this->dst_linesize, this->key.dst_fmt, slice.dst_y, dst);
+
+	sws_scale(slice.ctx, src, this->src_linesize, 0, slice.src_height, (uint8_t *const *)dst, this->dst_linesize);
+}
+
+bool MyFFMPEGSliceScaler::Scale(const uint8_t *const src_data[4], const int src_linesize[4], int src_width, int src_height,
+								enum AVPixelFormat src_fmt, uint8_t *const dst_data[4], const int dst_linesize[4],
+								int dst_width, int dst_height, enum AVPixelFormat dst_fmt, int flags)
+{
+	if (!Prepare(src_width, src_height, src_fmt, dst_width, dst_height, dst_fmt, flags))
+		return false;
+
+	for (int i = 0; i < 4; i++)
+	{
+		this->src_data[i] = src_data[i];
+		this->src_linesize[i] = src_linesize[i];
+		this->dst_data[i] = dst_data[i];
+		this->dst_linesize[i] = dst_linesize[i];
+	}
+
+	int count = (int)this->slices.size();
+	this->done_lock.lock();
+	this->running = count - 1;
+	this->done_lock.unlock();
+
+	for (int i = 1; i < count; i++)
+	{
+		bool is_queued = this->pool.Submit([this, i]() {
+			scale_slice(i);
+			std::lock_guard<std::mutex> lock(this->done_lock);
+			if (--this->running == 0)
+				this->done_cond.notify_one();
+		}, 0, i - 1);
+
+		// without workers the band is converted here
+		if (!is_queued)
+		{
+			scale_slice(i);
+			std::lock_guard<std::mutex> lock(this->done_lock);
+			this->running--;
+		}
+	}
+	scale_slice(0);
+
+	std::unique_lock<std::mutex> lock(this->done_lock);
+	this->done_cond.wait(lock, [this] { return this->running == 0; });
+	return true;
+}
@@ -0,0 +1,103 @@
+#ifndef _MY_FFMPEG_SLICE_SCALER_H_
+#define _MY_FFMPEG_SLICE_SCALER_H_
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include "KWorkerPool.h"
+
+// output pixels a slice should have at least, below that another core costs more than it saves
+#define SCALER_SLICE_PIXELS		(640 * 360)
+#define SCALER_MAX_SLICES		16
+// slices start on multiples of this many output rows, whole chroma rows of every subsampled format
+#define SCALER_SLICE_ALIGN		16
+
+// everything a cached SwsContext was built for
+struct MySwsKey{
+	int src_width;
+	int src_height;
+	enum AVPixelFormat src_fmt;
+	int dst_width;
+	int dst_height;
+	enum AVPixelFormat dst_fmt;
+	int flags;
+};
+
+// one horizontal band of the picture with a context of its own
+struct MyScalerSlice{
+	struct SwsContext *ctx;
+	int src_y;
+	int src_height;
+	int dst_y;
+	int dst_height;
+};
+
+/*
+sws_scale split into horizontal bands that are converted on several cores at once.
+every band has its own SwsContext for its rows, the calling thread converts the first band
+and workers of a private pool the others, so a frame is done when the slowest band is.
+each band filters within its own rows: at the same size only the chroma rows next to a seam
+can differ slightly from one sws_scale, when scaling the seam is at most a filter tap wide.
+the seams keep the vertical ratio of every band exactly that of the whole picture.
+*/
+class MyFFMPEGSliceScaler
+{
+public:
+	MyFFMPEGSliceScaler();
+	~MyFFMPEGSliceScaler();
+
+private:
+	struct MySwsKey key;
+	std::vector<struct MyScalerSlice> slices;
+	// requested slices, 0 picks them from the frame size
+	std::atomic<int> slice_count;
+	// cores the automatic choice may use, 0 all of them
+	std::atomic<int> thread_limit;
+	int built_slice_count;
+	KWorkerPool pool;
+	// planes of the frame being scaled, read by the workers
+	const uint8_t *src_data[4];
+	int src_linesize[4];
+	uint8_t *dst_data[4];
+	int dst_linesize[4];
+	// bands still converted by the workers
+	std::mutex done_lock;
+	std::condition_variable done_cond;
+	int running;
+
+	bool build(const struct MySwsKey& key, int count);
+	void free_slices();
+	int pick_slice_count(int dst_width, int dst_height);
+	void scale_slice(int index);
+	// plane pointers moved down to row y, chroma planes by their subsampled rows
+	static void offset_planes(const uint8_t *const data[4], const int linesize[4], enum AVPixelFormat fmt, int y,
+							const uint8_t *out[4]);
+
+public:
+	// split into slice_count bands, 0 picks from the frame size and the cores. applied on the next Scale
+	void SetSliceCount(int slice_count);
+	// use at most thread_limit cores when the slices are picked automatically, 0 for no limit
+	void SetThreadLimit(int thread_limit);
+	// bands of the current contexts
+	int GetSliceCount();
+	// build the contexts ahead of the first frame
+	bool Prepare(int src_width, int src_height, enum AVPixelFormat src_fmt,
+				int dst_width, int dst_height, enum AVPixelFormat dst_fmt, int flags);
+	// false if the contexts cannot be built for these formats
+	bool Scale(const uint8_t *const src_data[4], const int src_linesize[4], int src_width, int src_height,
+				enum AVPixelFormat src_fmt, uint8_t *const dst_data[4], const int dst_linesize[4],
+				int dst_width, int dst_height, enum AVPixelFormat dst_fmt, int flags);
+	// free the contexts and stop the workers
+	void Reset();
+};
+
+#endif
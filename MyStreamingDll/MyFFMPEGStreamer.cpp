@@ -1,10 +1,21 @@
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include "MyFFMPEGStreamer.h"
 
 MyFFMPEGStreamer::MyFFMPEGStreamer()
 	: last_error(MyFFMPEGStreamerError::NO_FFMPEG_ERROR), 
-	ip("127.0.0.1"), port(8554), codec_id(AV_CODEC_ID_MPEG4),
-	fmt(NULL), oc(NULL), video_st(NULL), video_is_eof(0) //, audio_st(NULL), audio_is_eof(0)
+	ip("127.0.0.1"), port(8554), config(),
+	video_ctx(NULL), video_codec(NULL), sinks(), next_sink_id(0), primary_sink_id(-1), is_paced(true),
+	frame(NULL), frame_count(0), video_is_eof(0), force_keyframe(false), //, audio_st(NULL), audio_is_eof(0)
+	pending_bit_rate(0), current_bit_rate(0), frame_decimation(1), decimation_index(0), timing(),
+	stats_start(0), convert_hist(), overlay_hist(), encode_hist(), write_hist(), latency_hist(), capture_times(), frame_capture_us(0),
+	encoded_frames(0), skipped_frames(0), keyframe_count(0), packet_count(0), byte_count(0), send_stats(),
+	rate_window_start(0), rate_window_frames(0), rate_window_bytes(0), achieved_bit_rate(0), achieved_fps(0),
+	reconfig_thread(NULL), is_building(false), is_config_pending(false), pending_config(), pending_global_header(false),
+	next_ctx(NULL), next_codec(NULL), next_config(), is_next_ready(false), reconfig_count(0), failed_reconfig_count(0),
+	scaler(), sws_flags(STREAM_SWS_FLAGS), overlay()
 {}
 
 MyFFMPEGStreamer::~MyFFMPEGStreamer()
@@ -13,107 +24,460 @@ MyFFMPEGStreamer::~MyFFMPEGStreamer()
 }
 
 bool MyFFMPEGStreamer::Initialize(int img_width, int img_height, int64_t bit_rate, 
-						enum AVCodecID codec_id, std::string ip, int port)
+						enum AVCodecID codec_id, std::string ip, int port, int fps)
 {
-	int ret;
-
-	/* Initialize libavcodec, and register all codecs and formats. */
-	av_register_all();
-	avformat_network_init();
+	MyFFMPEGEncoderConfig config;
+	config.codec_id = codec_id;
+	config.width = img_width;
+	config.height = img_height;
+	config.fps = fps;
+	config.bit_rate = bit_rate;
 
-	/* allocate the output media context */
-	std::string tempUrl("");
-	tempUrl.append("rtp://");
-	tempUrl.append(ip + ":");
-	tempUrl.append(std::to_string(port));
-	//tempUrl.append("/live.sdp");
-	tempUrl.append("/kstream");
-	avformat_alloc_output_context2(&this->oc, NULL, "rtp", tempUrl.c_str());
-	if (!this->oc)
-	{
-		this->last_error = MyFFMPEGStreamerError::CANT_ALLOC_FORMAT_CONTEXT;
-		return false;
-	}
+	return Initialize(config, ip, port);
+}
 
-	// alloc output format
-	this->fmt = oc->oformat;
-	if (!this->fmt)
-	{
-		this->last_error = MyFFMPEGStreamerError::CANT_ALLOC_OUTPUT_FORMAT;
-		return false;
-	}
+bool MyFFMPEGStreamer::Initialize(const MyFFMPEGEncoderConfig& config, std::string ip, int port)
+{
+	static std::once_flag register_once;
 
-	// set codec
-	this->fmt->video_codec = codec_id;
+	// an encoder built for an earlier stream is not swapped into this one
+	stop_reconfig();
 
-	if (fmt->video_codec != AV_CODEC_ID_NONE)
-		this->video_st = add_stream(oc, &video_codec, fmt->video_codec, img_width, img_height, bit_rate);
+	this->config = config;
+	if (this->config.fps <= 0)
+		this->config.fps = STREAM_FPS;
+	this->ip = ip;
+	this->port = port;
+	this->pending_bit_rate = 0;
+	this->current_bit_rate = this->config.bit_rate;
+	this->decimation_index = 0;
+	ResetStats();
+	this->rate_window_start = av_gettime_relative();
+	this->rate_window_frames = 0;
+	this->rate_window_bytes = 0;
+	this->reconfig_count = 0;
+	this->failed_reconfig_count = 0;
+	this->capture_times.clear();
 
-	/* Now that all the parameters are set, we can open the audio and
-	* video codecs and allocate the necessary encode buffers. */
-	if (this->video_st)
-		open_video(this->oc, this->video_codec, this->video_st);
+	/* Initialize libavcodec, and register all codecs and formats, once per process. */
+	std::call_once(register_once, []() {
+		av_register_all();
+		avformat_network_init();
+	});
 
-	av_dump_format(this->oc, 0, tempUrl.c_str(), 1);
-	char errorBuff[80];
+	/* the first destination decides whether the encoder needs global headers */
+	std::string tempUrl = make_rtp_url(ip, port);
 
-	if (!(fmt->flags & AVFMT_NOFILE)) {
-		ret = avio_open(&oc->pb, tempUrl.c_str(), AVIO_FLAG_WRITE);
-		if (ret < 0) {
-			this->last_error = MyFFMPEGStreamerError::CANT_OPEN_RTSP_OUTPUT;
-			fprintf(stderr, "Could not open outfile '%s': %s", tempUrl.c_str(), av_make_error_string(errorBuff, 80, ret));
+	if (this->config.codec_id != AV_CODEC_ID_NONE)
+	{
+		this->video_ctx = open_encoder(this->config, MyFFMPEGSink::NeedsGlobalHeader(tempUrl, "rtp"),
+									&this->video_codec);
+		if (!this->video_ctx)
 			return false;
-		}
 	}
 
-	ret = avformat_write_header(oc, NULL);
-	if (ret < 0) {
-		this->last_error = MyFFMPEGStreamerError::CANT_WRITE_HEADER;
-		fprintf(stderr, "Error occurred when writing header: %s", av_make_error_string(errorBuff, 80, ret));
+	/* Now that the codec is open, allocate the necessary encode buffers. */
+	if (this->video_ctx && !alloc_video_buffers(this->video_ctx))
+	{
+		close_video(&this->video_ctx);
 		return false;
 	}
 
+	/* build the conversion for the expected input size, other sizes rebuild it on demand */
+	this->scaler.Reset();
+	this->scaler.SetThreadLimit(this->config.thread_count);
+	if (this->video_ctx)
+		this->scaler.Prepare(this->config.width, this->config.height, AV_PIX_FMT_BGR24,
+							this->config.width, this->config.height, STREAM_PIX_FMT, this->sws_flags);
+
+	this->primary_sink_id = AddSink(tempUrl, "rtp");
+	if (this->primary_sink_id < 0)
+		return false;
+
 	return true;
 }
 
 void MyFFMPEGStreamer::Deinitialize()
 {
-	/* Write the trailer, if any. The trailer must be written before you
+	/* taken out first, a Reconfigure from another thread finds no encoder from here on */
+	this->encoder_lock.lock();
+	AVCodecContext *c = this->video_ctx;
+	this->video_ctx = NULL;
+	this->encoder_lock.unlock();
+
+	/* an encoder still being opened is not swapped in anymore */
+	stop_reconfig();
+
+	/* frames still inside the encoder go out before the trailers */
+	if (c && !this->video_is_eof)
+		write_video_frame(c, cv::Mat(), AV_PIX_FMT_NONE, 1);
+
+	/* Write the trailers. The trailer must be written before you
 	* close the CodecContexts open when you wrote the header; otherwise
 	* av_write_trailer() may try to use memory that was freed on
 	* av_codec_close(). */
-	if (this->oc)
-		av_write_trailer(this->oc);
+	std::vector<MyFFMPEGSink*> closing;
+	this->sink_lock.lock();
+	closing.swap(this->sinks);
+	this->sink_lock.unlock();
+
+	for (size_t i = 0; i < closing.size(); i++)
+	{
+		closing[i]->Close();
+		delete closing[i];
+	}
 
 	/* Close each codec. */
-	if (this->video_st)
-		close_video(this->video_st);
+	if (c)
+		close_video(&c);
 	//if (audio_st)
 	//	close_audio(this->audio_st);
 
-	if (this->fmt && this->oc)
-		if (!(this->fmt->flags & AVFMT_NOFILE))
-			/* Close the output file. */
-			avio_close(this->oc->pb);
+	this->primary_sink_id = -1;
+	this->scaler.Reset();
+}
+
+bool MyFFMPEGStreamer::StreamImage(const cv::Mat& cv_img, bool is_end, enum AVPixelFormat src_fmt,
+								int64_t capture_us)
+{
+	if (!is_end)
+	{
+		if (src_fmt == AV_PIX_FMT_NONE)
+			src_fmt = get_pix_fmt(cv_img);
+		if (src_fmt == AV_PIX_FMT_NONE)
+			return false;
+		if (src_fmt == AV_PIX_FMT_YUV420P &&
+			(cv_img.type() != CV_8UC1 || !cv_img.isContinuous() || cv_img.rows % 3 != 0 || cv_img.cols % 2 != 0))
+			return false;
+
+		// a reconfigured encoder takes over between two frames
+		if (this->is_next_ready && !swap_encoder())
+			return false;
+	}
+
+	if (this->video_ctx && !this->video_is_eof)
+	{
+		// frame rate step-down keeps the timeline, the skipped slot is simply not encoded
+		int decimation = this->frame_decimation;
+		if (!is_end && decimation > 1 && (this->decimation_index++ % decimation) != 0)
+		{
+			SkipFrame();
+			return true;
+		}
+
+		this->frame_capture_us = is_end ? 0 : capture_us;
+		return write_video_frame(this->video_ctx, cv_img, src_fmt, is_end);
+	}
+	else
+		return false;
+}
+
+void MyFFMPEGStreamer::SkipFrame()
+{
+	memset(&this->timing, 0, sizeof(this->timing));
+	this->skipped_frames++;
+	this->frame_count++;
+}
+
+int MyFFMPEGStreamer::AddSink(const std::string& url, const char* format_name)
+{
+	if (!this->video_ctx)
+		return -1;
+
+	if (MyFFMPEGRTPSink::IsRTP(url, format_name))
+		return add_sink(new MyFFMPEGRTPSink(), url, format_name);
+	return add_sink(new MyFFMPEGSink(), url, format_name);
+}
+
+int MyFFMPEGStreamer::AddSegmentSink(const std::string& directory, int segment_count, size_t segment_size)
+{
+	if (!this->video_ctx)
+		return -1;
+
+	return add_sink(new MyFFMPEGSegmentSink(segment_count, segment_size), directory, "mpegts");
+}
+
+int MyFFMPEGStreamer::AddClipSink(int max_seconds, size_t max_bytes)
+{
+	if (!this->video_ctx)
+		return -1;
+
+	return add_sink(new MyFFMPEGClipSink(max_seconds, max_bytes), std::string(), NULL);
+}
+
+int MyFFMPEGStreamer::add_sink(MyFFMPEGSink *sink, const std::string& url, const char* format_name)
+{
+	// connecting and writing the header may take a while, keep the encoder running meanwhile
+	sink->SetSendStats(&this->send_stats);
+	sink->SetPacing(this->is_paced);
+
+	this->sink_lock.lock();
+	int id = this->next_sink_id++;
+	this->sink_lock.unlock();
+
+	// the parameters are copied from the encoder being used, not one being swapped out.
+	// the sink joins before encoder_lock is released, a later swap tells it about the new encoder
+	this->encoder_lock.lock();
+	bool is_opened = this->video_ctx && sink->Open(id, url, format_name, this->video_ctx);
+	if (is_opened)
+	{
+		this->sink_lock.lock();
+		this->sinks.push_back(sink);
+		this->sink_lock.unlock();
+	}
+	this->encoder_lock.unlock();
+
+	if (!is_opened)
+	{
+		this->last_error = (MyFFMPEGStreamerError)sink->GetLastError();
+		delete sink;
+		return -1;
+	}
+
+	// the new receiver can start decoding right away
+	RequestKeyframe();
+
+	return id;
+}
+
+std::vector<std::string> MyFFMPEGStreamer::GetSegmentPaths(int sink_id)
+{
+	std::lock_guard<std::mutex> lock(this->sink_lock);
+	for (size_t i = 0; i < this->sinks.size(); i++)
+	{
+		if (this->sinks[i]->GetID() != sink_id)
+			continue;
+		MyFFMPEGSegmentSink *segment_sink = dynamic_cast<MyFFMPEGSegmentSink*>(this->sinks[i]);
+		if (segment_sink)
+			return segment_sink->GetSegmentPaths();
+		break;
+	}
+	return std::vector<std::string>();
+}
+
+int MyFFMPEGStreamer::ExportClip(int sink_id, const std::string& path, int before_ms, int after_ms, int64_t trigger_us)
+{
+	std::lock_guard<std::mutex> lock(this->sink_lock);
+	for (size_t i = 0; i < this->sinks.size(); i++)
+	{
+		if (this->sinks[i]->GetID() != sink_id)
+			continue;
+		MyFFMPEGClipSink *clip_sink = dynamic_cast<MyFFMPEGClipSink*>(this->sinks[i]);
+		if (clip_sink)
+			return clip_sink->ExportClip(path, before_ms, after_ms, trigger_us);
+		break;
+	}
+	return -1;
+}
 
-	/* free the stream */
-	if (this->oc)
-		avformat_free_context(this->oc);
+int MyFFMPEGStreamer::AddRTPDestination(const std::string& ip, int port)
+{
+	return AddSink(make_rtp_url(ip, port), "rtp");
+}
 
-	this->oc = NULL;
-	this->fmt = NULL;
-	this->video_st = NULL;
+bool MyFFMPEGStreamer::RemoveSink(int sink_id)
+{
+	MyFFMPEGSink *sink = NULL;
+
+	this->sink_lock.lock();
+	for (size_t i = 0; i < this->sinks.size(); i++)
+	{
+		if (this->sinks[i]->GetID() == sink_id)
+		{
+			sink = this->sinks[i];
+			this->sinks.erase(this->sinks.begin() + i);
+			break;
+		}
+	}
+	this->sink_lock.unlock();
+
+	if (!sink)
+		return false;
+
+	sink->Close();
+	delete sink;
+	return true;
 }
 
-bool MyFFMPEGStreamer::StreamImage(cv::Mat cv_img, bool is_end)
+void MyFFMPEGStreamer::RequestKeyframe()
 {
-	if (this->video_st && !this->video_is_eof)
+	this->force_keyframe = true;
+}
+
+void MyFFMPEGStreamer::SetBitRate(int64_t bit_rate)
+{
+	if (bit_rate > 0)
+		this->pending_bit_rate = bit_rate;
+}
+
+int64_t MyFFMPEGStreamer::GetBitRate()
+{
+	return this->current_bit_rate;
+}
+
+void MyFFMPEGStreamer::SetFrameDecimation(int n)
+{
+	this->frame_decimation = n > 1 ? n : 1;
+}
+
+void MyFFMPEGStreamer::SetPacing(bool enable)
+{
+	this->is_paced = enable;
+
+	std::lock_guard<std::mutex> lock(this->sink_lock);
+	for (size_t i = 0; i < this->sinks.size(); i++)
+		this->sinks[i]->SetPacing(enable);
+}
+
+struct MyFFMPEGFrameTiming MyFFMPEGStreamer::GetLastFrameTiming()
+{
+	return this->timing;
+}
+
+struct KStreamStats MyFFMPEGStreamer::GetStats()
+{
+	struct KStreamStats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	stats.elapsed_us = av_gettime_relative() - this->stats_start;
+	stats.convert = this->convert_hist.GetStats();
+	stats.overlay = this->overlay_hist.GetStats();
+	stats.encode = this->encode_hist.GetStats();
+	stats.write = this->write_hist.GetStats();
+	stats.latency = this->latency_hist.GetStats();
+	stats.encoded_frames = this->encoded_frames;
+	stats.skipped_frames = this->skipped_frames;
+	stats.keyframes = this->keyframe_count;
+	stats.packets = this->packet_count;
+	stats.bytes = this->byte_count;
+	stats.send = this->send_stats.send_hist.GetStats();
+	stats.dropped_packets = this->send_stats.dropped_packets;
+	stats.failed_packets = this->send_stats.failed_packets;
+	stats.target_bit_rate = this->current_bit_rate;
+	stats.achieved_bit_rate = this->achieved_bit_rate;
+	stats.achieved_fps = this->achieved_fps;
+
+	std::lock_guard<std::mutex> lock(this->sink_lock);
+	for (size_t i = 0; i < this->sinks.size(); i++)
+		stats.send_queue_depth = std::max(stats.send_queue_depth, this->sinks[i]->GetQueueSize());
+
+	return stats;
+}
+
+void MyFFMPEGStreamer::ResetStats()
+{
+	this->stats_start = av_gettime_relative();
+	this->convert_hist.Reset();
+	this->overlay_hist.Reset();
+	this->encode_hist.Reset();
+	this->write_hist.Reset();
+	this->latency_hist.Reset();
+	this->encoded_frames = 0;
+	this->skipped_frames = 0;
+	this->keyframe_count = 0;
+	this->packet_count = 0;
+	this->byte_count = 0;
+	this->send_stats.Reset();
+}
+
+int MyFFMPEGStreamer::GetSinkCount()
+{
+	std::lock_guard<std::mutex> lock(this->sink_lock);
+
+	return (int)this->sinks.size();
+}
+
+void MyFFMPEGStreamer::SetOverlay(bool enable, int x, int y)
+{
+	this->overlay.SetEnabled(enable);
+	this->overlay.SetPosition(x, y);
+}
+
+void MyFFMPEGStreamer::SetScalerFlags(int sws_flags)
+{
+	this->sws_flags = sws_flags;
+}
+
+void MyFFMPEGStreamer::SetConvertSlices(int slice_count)
+{
+	this->scaler.SetSliceCount(slice_count);
+}
+
+MyFFMPEGEncoderConfig MyFFMPEGStreamer::GetConfig()
+{
+	// a swap replaces the settings on the encoding thread, a copy is taken under its lock
+	std::lock_guard<std::mutex> lock(this->encoder_lock);
+	return this->config;
+}
+
+bool MyFFMPEGStreamer::Reconfigure(const MyFFMPEGEncoderConfig& config)
+{
+	MyFFMPEGEncoderConfig wanted = config;
+	if (wanted.fps <= 0)
+		wanted.fps = STREAM_FPS;
+
+	std::lock_guard<std::mutex> encoder_guard(this->encoder_lock);
+	if (!this->video_ctx)
+		return false;
+	// the sinks' muxers were set up for this codec, another one needs a new Initialize
+	if (wanted.codec_id != this->config.codec_id)
+		return false;
+
+	std::lock_guard<std::mutex> lock(this->reconfig_lock);
+
+	/* the rate control of the open encoder follows a new bit rate, unless another encoder is on its way */
+	if (!this->is_building && !this->is_next_ready && is_rate_change(this->config, wanted))
 	{
-		write_video_frame(this->oc, this->video_st, cv_img, is_end);
+		SetBitRate(wanted.bit_rate);
+		this->config.bit_rate = wanted.bit_rate;
 		return true;
 	}
-	else
+
+	/* everything else needs an encoder opened for it, the current one keeps encoding meanwhile */
+	this->pending_config = wanted;
+	this->pending_global_header = (this->video_ctx->flags & AV_CODEC_FLAG_GLOBAL_HEADER) != 0;
+	this->is_config_pending = true;
+	if (!this->is_building)
+	{
+		if (this->reconfig_thread)
+		{
+			this->reconfig_thread->join();
+			delete this->reconfig_thread;
+		}
+		this->is_building = true;
+		this->reconfig_thread = new std::thread(&MyFFMPEGStreamer::BuildEncoder, this);
+	}
+
+	return true;
+}
+
+bool MyFFMPEGStreamer::SetDestination(const std::string& ip, int port)
+{
+	if (ip == this->ip && port == this->port && this->primary_sink_id >= 0)
+		return true;
+
+	// the new receiver is connected before the old one is dropped
+	int sink_id = AddRTPDestination(ip, port);
+	if (sink_id < 0)
 		return false;
+
+	int old_id = this->primary_sink_id.exchange(sink_id);
+	if (old_id >= 0)
+		RemoveSink(old_id);
+	this->ip = ip;
+	this->port = port;
+
+	return true;
+}
+
+uint64_t MyFFMPEGStreamer::GetReconfigCount()
+{
+	return this->reconfig_count;
+}
+
+uint64_t MyFFMPEGStreamer::GetFailedReconfigCount()
+{
+	return this->failed_reconfig_count;
 }
 
 int MyFFMPEGStreamer::GetLastError()
@@ -122,39 +486,47 @@ int MyFFMPEGStreamer::GetLastError()
 }
 
 // ffmpeg methods
-int MyFFMPEGStreamer::write_frame(AVFormatContext *fmt_ctx, const AVRational *time_base, AVStream *st, AVPacket *pkt)
+int MyFFMPEGStreamer::write_frame(const AVRational *time_base, AVPacket *pkt)
 {
-	/* rescale output packet timestamp values from codec to stream timebase */
-	pkt->pts = av_rescale_q_rnd(pkt->pts, *time_base, st->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-	pkt->dts = av_rescale_q_rnd(pkt->dts, *time_base, st->time_base, AVRounding(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-	pkt->duration = av_rescale_q(pkt->duration, *time_base, st->time_base);
-	pkt->stream_index = st->index;
+	int ret = 0;
 
-	/* Write the compressed frame to the media file. */
-	return av_interleaved_write_frame(fmt_ctx, pkt);
+	/* every sink queues its own reference to the same encoded data, its output thread sends it */
+	std::lock_guard<std::mutex> lock(this->sink_lock);
+	this->timing.send_queue = 0;
+	for (size_t i = 0; i < this->sinks.size(); i++)
+	{
+		if (!this->sinks[i]->WritePacket(pkt, time_base))
+			ret = -1;
+		// an output that dropped its queue resumes at the next keyframe
+		if (this->sinks[i]->TakeKeyframeRequest())
+			this->force_keyframe = true;
+		this->timing.send_queue = std::max(this->timing.send_queue, this->sinks[i]->GetQueueSize());
+	}
+
+	return ret;
 }
 
-AVStream* MyFFMPEGStreamer::add_stream(AVFormatContext *oc, AVCodec **codec, enum AVCodecID codec_id,
-							int img_width, int img_height, int64_t bit_rate)
+AVCodecContext* MyFFMPEGStreamer::add_stream(AVCodec **codec, const MyFFMPEGEncoderConfig& config, bool global_header)
 {
 	AVCodecContext *c;
-	AVStream *st;
+	enum AVCodecID codec_id = config.codec_id;
 
 	/* find the encoder */
 	*codec = avcodec_find_encoder(codec_id);
 	if (!(*codec)) {
+		this->last_error = MyFFMPEGStreamerError::CANT_FIND_ENCODER;
 		fprintf(stderr, "Could not find encoder for '%s'\n",
 			avcodec_get_name(codec_id));
-		exit(1);
+		return NULL;
 	}
 
-	st = avformat_new_stream(oc, *codec);
-	if (!st) {
-		fprintf(stderr, "Could not allocate stream\n");
-		exit(1);
+	/* the encoder is shared by all sinks, each sink copies its parameters */
+	c = avcodec_alloc_context3(*codec);
+	if (!c) {
+		this->last_error = MyFFMPEGStreamerError::CANT_ALLOC_CODEC_CONTEXT;
+		fprintf(stderr, "Could not allocate codec context\n");
+		return NULL;
 	}
-	st->id = oc->nb_streams - 1;
-	c = st->codec;
 
 	switch ((*codec)->type) {
 	case AVMEDIA_TYPE_AUDIO:
@@ -167,20 +539,22 @@ AVStream* MyFFMPEGStreamer::add_stream(AVFormatContext *oc, AVCodec **codec, enu
 
 	case AVMEDIA_TYPE_VIDEO:
 		c->codec_id = codec_id;
-		c->bit_rate = bit_rate;
+		c->bit_rate = config.bit_rate;
 		//c->bit_rate = 1600000;
 		/* Resolution must be a multiple of two. */
-		c->width = img_width;
-		c->height = img_height;
+		c->width = config.width;
+		c->height = config.height;
 		/* timebase: This is the fundamental unit of time (in seconds) in terms
 		* of which frame timestamps are represented. For fixed-fps content,
 		* timebase should be 1/framerate and timestamp increments should be
 		* identical to 1. */
-		c->time_base.den = STREAM_FPS;
+		c->time_base.den = config.fps;
 		c->time_base.num = 1;
-		c->gop_size = 12; /* emit one intra frame every twelve frames at most */
+		c->gop_size = config.gop_size; /* emit one intra frame every gop_size frames at most */
 		c->pix_fmt = STREAM_PIX_FMT;
-		if (c->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
+		if (config.max_b_frames >= 0)
+			c->max_b_frames = config.max_b_frames;
+		else if (c->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
 			/* just for testing, we also add B frames */
 			c->max_b_frames = 2;
 		}
@@ -197,29 +571,130 @@ AVStream* MyFFMPEGStreamer::add_stream(AVFormatContext *oc, AVCodec **codec, enu
 	}
 
 	/* Some formats want stream headers to be separate. */
-	if (oc->oformat->flags & AVFMT_GLOBALHEADER)
-		c->flags |= CODEC_FLAG_GLOBAL_HEADER;
+	if (global_header)
+		c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
-	return st;
+	return c;
 }
 
-void MyFFMPEGStreamer::open_video(AVFormatContext *oc, AVCodec *codec, AVStream *st)
+void MyFFMPEGStreamer::set_codec_options(AVCodecContext *c, const MyFFMPEGEncoderConfig& config, AVDictionary **options)
+{
+	/* threading */
+	c->thread_count = config.thread_count;
+	if (config.thread_type == MyThreadType::THREAD_TYPE_SLICE)
+		c->thread_type = FF_THREAD_SLICE;
+	else if (config.thread_type == MyThreadType::THREAD_TYPE_FRAME)
+		c->thread_type = FF_THREAD_FRAME;
+
+	/* rate control */
+	switch (config.rate_control) {
+	case MyRateControl::RATE_CONTROL_CBR:
+		c->rc_min_rate = config.bit_rate;
+		c->rc_max_rate = config.bit_rate;
+		c->rc_buffer_size = config.vbv_buffer_size > 0 ? config.vbv_buffer_size : (int)config.bit_rate;
+		if (c->codec_id == AV_CODEC_ID_H264)
+			av_dict_set(options, "nal-hrd", "cbr", 0);
+		break;
+
+	case MyRateControl::RATE_CONTROL_VBR:
+		if (config.max_bit_rate > 0)
+			c->rc_max_rate = config.max_bit_rate;
+		if (config.vbv_buffer_size > 0)
+			c->rc_buffer_size = config.vbv_buffer_size;
+		break;
+
+	case MyRateControl::RATE_CONTROL_CRF:
+		/* quality driven, bit_rate would switch x264 back to ABR */
+		c->bit_rate = 0;
+		av_dict_set_int(options, "crf", config.crf, 0);
+		if (config.max_bit_rate > 0)
+		{
+			c->rc_max_rate = config.max_bit_rate;
+			c->rc_buffer_size = config.vbv_buffer_size > 0 ? config.vbv_buffer_size : (int)config.max_bit_rate;
+		}
+		break;
+
+	default:
+		if (config.vbv_buffer_size > 0)
+			c->rc_buffer_size = config.vbv_buffer_size;
+		break;
+	}
+
+	/* codec private options */
+	if (!config.preset.empty())
+		av_dict_set(options, "preset", config.preset.c_str(), 0);
+	if (!config.tune.empty())
+		av_dict_set(options, "tune", config.tune.c_str(), 0);
+	if (!config.extra_options.empty())
+		av_dict_parse_string(options, config.extra_options.c_str(), "=", ":", 0);
+
+	/* low latency */
+	if (config.intra_refresh)
+	{
+		av_dict_set(options, "intra-refresh", "1", 0);
+		/* RequestKeyframe must give a real IDR even with intra refresh */
+		av_dict_set(options, "forced-idr", "1", 0);
+	}
+	if (config.slice_max_size > 0)
+	{
+		/* keep x264-params given in extra_options */
+		std::string param("slice-max-size=");
+		param.append(std::to_string(config.slice_max_size));
+		if (av_dict_get(*options, "x264-params", NULL, 0))
+			param.insert(0, ":");
+		av_dict_set(options, "x264-params", param.c_str(), AV_DICT_APPEND);
+	}
+}
+
+AVCodecContext* MyFFMPEGStreamer::open_encoder(const MyFFMPEGEncoderConfig& config, bool global_header, AVCodec **codec)
+{
+	AVDictionary *options = NULL;
+
+	AVCodecContext *c = add_stream(codec, config, global_header);
+	if (!c)
+		return NULL;
+
+	set_codec_options(c, config, &options);
+	bool is_opened = open_video(*codec, c, &options);
+	av_dict_free(&options);
+	if (!is_opened)
+		avcodec_free_context(&c);
+
+	return c;
+}
+
+bool MyFFMPEGStreamer::open_video(AVCodec *codec, AVCodecContext *c, AVDictionary **options)
 {
 	int ret;
-	AVCodecContext *c = st->codec;
+	char errorBuff[80];
 
 	/* open the codec */
-	ret = avcodec_open2(c, codec, NULL);
+	ret = avcodec_open2(c, codec, options);
 	if (ret < 0) {
-		fprintf(stderr, "Could not open video codec: ");
-		exit(1);
+		this->last_error = MyFFMPEGStreamerError::CANT_OPEN_ENCODER;
+		fprintf(stderr, "Could not open video codec: %s\n", av_make_error_string(errorBuff, 80, ret));
+		return false;
 	}
 
+	/* options left in the dictionary were not recognized by this codec */
+	AVDictionaryEntry *unused = NULL;
+	while ((unused = av_dict_get(*options, "", unused, AV_DICT_IGNORE_SUFFIX)))
+		fprintf(stderr, "Encoder option '%s' not used by %s\n", unused->key, codec->name);
+
+	return true;
+}
+
+bool MyFFMPEGStreamer::alloc_video_buffers(AVCodecContext *c)
+{
+	int ret;
+	char errorBuff[80];
+
 	/* allocate and init a re-usable frame */
 	this->frame = av_frame_alloc();
 	if (!this->frame) {
+		this->last_error = MyFFMPEGStreamerError::CANT_ALLOC_FRAME;
 		fprintf(stderr, "Could not allocate video frame\n");
-		exit(1);
+		return false;
 	}
 	this->frame->format = c->pix_fmt;
 	this->frame->width = c->width;
@@ -228,119 +703,394 @@ void MyFFMPEGStreamer::open_video(AVFormatContext *oc, AVCodec *codec, AVStream
 	/* Allocate the encoded raw picture. */
 	ret = avpicture_alloc(&this->dst_picture, c->pix_fmt, c->width, c->height);
 	if (ret < 0) {
-		fprintf(stderr, "Could not allocate picture: ");
-		exit(1);
-	}
-	ret = avpicture_alloc(&this->src_picture, AV_PIX_FMT_BGR24, c->width, c->height);
-	if (ret < 0) {
-		fprintf(stderr, "Could not allocate temporary picture:");
-		exit(1);
+		this->last_error = MyFFMPEGStreamerError::CANT_ALLOC_FRAME;
+		fprintf(stderr, "Could not allocate picture: %s\n", av_make_error_string(errorBuff, 80, ret));
+		return false;
 	}
-
 	/* copy data and linesize picture pointers to frame */
 	*((AVPicture *)(this->frame)) = dst_picture;
+
+	return true;
 }
 
-void MyFFMPEGStreamer::write_video_frame(AVFormatContext *oc, AVStream *st, cv::Mat cv_img, int flush)
+bool MyFFMPEGStreamer::write_video_frame(AVCodecContext *c, const cv::Mat& cv_img, enum AVPixelFormat src_fmt, int flush)
 {
 	int ret;
-	static struct SwsContext *sws_ctx;
-	AVCodecContext *c = st->codec;
+	char errorBuff[80];
+	int64_t start_time = av_gettime_relative();
+
+	memset(&this->timing, 0, sizeof(this->timing));
+	this->timing.is_encoded = true;
 
 	if (!flush) {
-		// BGR opencv image to AV_PIX_FMT_YUV420P
-		cv::resize(cv_img, cv_img, cv::Size(c->width, c->height));
-		// Time Stamp
-		std::time_t rawtime;
-		struct std::tm* timeinfo;
-		char timebuf[80];
-
-		SYSTEMTIME time;
-		GetLocalTime(&time);
-		sprintf(timebuf, "%04d:%02d:%02d-%02d:%02d:%02d:%03d",
-				time.wYear, time.wMonth, time.wDay,
-				time.wHour, time.wMinute, time.wSecond, time.wMilliseconds);
-		std::string timestr(timebuf);
-
-		//int milli = curTime.tv_usec / 1000;
-		//std::time(&rawtime);
-		//timeinfo = std::localtime(&rawtime);
-		//std::strftime(timebuf, sizeof(timebuf), "%d-%m-%Y %I:%M:%S", timeinfo);
-		//std::string timestr(timebuf);
-		cv::putText(cv_img, timestr, cv::Point(20, 20), cv::FONT_HERSHEY_SIMPLEX, 0.75, cv::Scalar::all(255), 2);
-
-		if (!sws_ctx) {
-			sws_ctx = sws_getContext(c->width, c->height, AV_PIX_FMT_BGR24,
-				c->width, c->height, c->pix_fmt,
-				SWS_BICUBIC, NULL, NULL, NULL);
-			if (!sws_ctx) {
+		// read straight from the Mat buffer, rows may be padded (ROI)
+		const uint8_t *src_data[4];
+		int src_linesize[4];
+		int src_height = get_src_planes(cv_img, src_fmt, src_data, src_linesize);
+
+		if (src_fmt == c->pix_fmt && cv_img.cols == c->width && src_height == c->height &&
+			!this->overlay.IsEnabled()) {
+			// already in the encoder's format, encode the caller's planes. encoders copy frames they keep.
+			for (int i = 0; i < 4; i++) {
+				this->frame->data[i] = (uint8_t *)src_data[i];
+				this->frame->linesize[i] = src_linesize[i];
+			}
+		}
+		else {
+			*((AVPicture *)(this->frame)) = this->dst_picture;
+
+			// OpenCV image to AV_PIX_FMT_YUV420P, scaled to the encoder size in the same pass
+			if (!this->scaler.Scale(src_data, src_linesize, cv_img.cols, src_height, src_fmt,
+									this->dst_picture.data, this->dst_picture.linesize,
+									c->width, c->height, c->pix_fmt, this->sws_flags)) {
+				this->last_error = MyFFMPEGStreamerError::CANT_INIT_CONVERSION;
 				fprintf(stderr,
 					"Could not initialize the conversion context\n");
-				exit(1);
+				return false;
 			}
 		}
+		this->timing.convert_us = av_gettime_relative() - start_time;
+
+		// Time Stamp, drawn on the luma plane so the caller's image is left untouched
+		this->overlay.Render(this->dst_picture.data[0], this->dst_picture.linesize[0], c->width, c->height);
+		this->timing.overlay_us = av_gettime_relative() - start_time - this->timing.convert_us;
+	}
 
-		avpicture_fill(&this->src_picture, cv_img.data, AV_PIX_FMT_BGR24, c->width, c->height);
+	apply_bit_rate(c);
 
-		sws_scale(sws_ctx,
-			(const uint8_t * const *)(this->src_picture.data), this->src_picture.linesize,
-			0, c->height, this->dst_picture.data, this->dst_picture.linesize);
+	/* hand the image over, a frame threaded encoder keeps several in flight. NULL starts the drain. */
+	int64_t encode_time = av_gettime_relative();
+	if (!flush) {
+		this->frame->pts = this->frame_count;
+		this->frame->pict_type = this->force_keyframe.exchange(false) ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+		// an encoder with delay releases this frame's packet a few calls later
+		if (this->frame_capture_us > 0) {
+			struct MyCaptureTime capture = { this->frame->pts, this->frame_capture_us };
+			if (this->capture_times.size() >= CAPTURE_TIMES_MAX)
+				this->capture_times.pop_front();
+			this->capture_times.push_back(capture);
+		}
+	}
+	ret = avcodec_send_frame(c, flush ? NULL : this->frame);
+	this->timing.encode_us = av_gettime_relative() - encode_time;
+	if (ret < 0) {
+		this->last_error = MyFFMPEGStreamerError::CANT_ENCODE_FRAME;
+		fprintf(stderr, "Error encoding video frame: %s\n", av_make_error_string(errorBuff, 80, ret));
+		return false;
+	}
+
+	/* write whatever is ready, on a flush everything the encoder still holds */
+	ret = receive_packets(c);
+	if (ret == AVERROR_EOF)
+		this->video_is_eof = 1;
+	else if (ret != AVERROR(EAGAIN)) {
+		this->last_error = MyFFMPEGStreamerError::CANT_ENCODE_FRAME;
+		fprintf(stderr, "Error encoding video frame: %s\n", av_make_error_string(errorBuff, 80, ret));
+		return false;
 	}
+	record_stats(flush);
 
-	if (oc->oformat->flags & AVFMT_RAWPICTURE && !flush) {
-		/* Raw video case - directly store the picture in the packet */
-		AVPacket pkt;
-		av_init_packet(&pkt);
+	if (!flush)
+		this->frame_count++;
+	return true;
+}
+
+int MyFFMPEGStreamer::receive_packets(AVCodecContext *c)
+{
+	int ret;
+	AVPacket pkt = { 0 };
+	av_init_packet(&pkt);
 
-		pkt.flags |= AV_PKT_FLAG_KEY;
-		pkt.stream_index = st->index;
-		pkt.data = this->dst_picture.data[0];
-		pkt.size = sizeof(AVPicture);
+	while (true) {
+		int64_t encode_time = av_gettime_relative();
+		ret = avcodec_receive_packet(c, &pkt);
+		int64_t write_time = av_gettime_relative();
+		this->timing.encode_us += write_time - encode_time;
+		// EAGAIN: the encoder needs more frames, EOF: it is drained
+		if (ret < 0)
+			return ret;
 
-		ret = av_interleaved_write_frame(oc, &pkt);
+		this->timing.packet_count++;
+		this->timing.packet_size += pkt.size;
+		if (pkt.flags & AV_PKT_FLAG_KEY)
+			this->timing.is_keyframe = true;
+
+		// a failing sink only counts its own failures, the others keep streaming
+		write_frame(&c->time_base, &pkt);
+		int64_t write_us = av_gettime_relative() - write_time;
+		this->timing.write_us += write_us;
+		record_packet(&pkt, write_us);
+		record_latency(pkt.pts);
+
+		/* give the buffer back, sinks still holding it keep it alive */
+		av_packet_unref(&pkt);
 	}
-	else {
-		AVPacket pkt = { 0 };
-		int got_packet;
-		av_init_packet(&pkt);
+}
 
-		/* encode the image */
-		this->frame->pts = this->frame_count;
-		ret = avcodec_encode_video2(c, &pkt, flush ? NULL : this->frame, &got_packet);
-		if (ret < 0) {
-			fprintf(stderr, "Error encoding video frame:");
-			exit(1);
-		}
-		/* If size is zero, it means the image was buffered. */
+int MyFFMPEGStreamer::get_src_planes(const cv::Mat& cv_img, enum AVPixelFormat src_fmt,
+									const uint8_t *data[4], int linesize[4])
+{
+	memset(data, 0, 4 * sizeof(*data));
+	memset(linesize, 0, 4 * sizeof(*linesize));
+	data[0] = cv_img.data;
+	linesize[0] = (int)cv_img.step;
 
-		if (got_packet) {
-			//cout<<"got Packet"<<endl;
-			ret = write_frame(oc, &c->time_base, st, &pkt);
-		}
-		else {
-			//cout<<"EOF\n";
-			if (flush)
-				this->video_is_eof = 1;
-			ret = 0;
-		}
+	if (src_fmt != AV_PIX_FMT_YUV420P)
+		return cv_img.rows;
+
+	// I420 in one Mat: the luma rows, then the quarter size U and V planes
+	int height = cv_img.rows * 2 / 3;
+	linesize[1] = linesize[2] = linesize[0] / 2;
+	data[1] = data[0] + (size_t)linesize[0] * height;
+	data[2] = data[1] + (size_t)linesize[1] * (height / 2);
+	return height;
+}
+
+enum AVPixelFormat MyFFMPEGStreamer::get_pix_fmt(const cv::Mat& cv_img)
+{
+	switch (cv_img.type()) {
+	case CV_8UC3:
+		return AV_PIX_FMT_BGR24;
+	case CV_8UC4:
+		return AV_PIX_FMT_BGRA;
+	case CV_8UC1:
+		return AV_PIX_FMT_GRAY8;
+	default:
+		return AV_PIX_FMT_NONE;
 	}
+}
 
-	if (ret < 0) {
-		fprintf(stderr, "Error while writing video frame: ");
-		exit(1);
+void MyFFMPEGStreamer::apply_bit_rate(AVCodecContext *c)
+{
+	int64_t bit_rate = this->pending_bit_rate.exchange(0);
+
+	/* constant quality encoders have no bit rate to move */
+	if (bit_rate <= 0 || c->bit_rate <= 0 || bit_rate == c->bit_rate)
+		return;
+
+	/* keep the rate control bounds in proportion */
+	double ratio = (double)bit_rate / c->bit_rate;
+	c->bit_rate = bit_rate;
+	if (c->rc_max_rate > 0)
+		c->rc_max_rate = (int64_t)(c->rc_max_rate * ratio);
+	if (c->rc_min_rate > 0)
+		c->rc_min_rate = (int64_t)(c->rc_min_rate * ratio);
+	if (c->rc_buffer_size > 0)
+		c->rc_buffer_size = (int)(c->rc_buffer_size * ratio);
+
+	this->current_bit_rate = bit_rate;
+}
+
+void MyFFMPEGStreamer::record_stats(int flush)
+{
+	int64_t now = av_gettime_relative();
+
+	if (!flush) {
+		this->encoded_frames++;
+		this->convert_hist.Record(this->timing.convert_us);
+		this->overlay_hist.Record(this->timing.overlay_us);
+		this->encode_hist.Record(this->timing.encode_us);
+		this->rate_window_frames++;
 	}
-	this->frame_count++;
+
+	int64_t window = now - this->rate_window_start;
+	if (window >= 1000000) {
+		this->achieved_bit_rate = (int64_t)(this->rate_window_bytes * 8 * 1000000 / window);
+		this->achieved_fps = this->rate_window_frames * 1000000.0 / window;
+		this->rate_window_start = now;
+		this->rate_window_frames = 0;
+		this->rate_window_bytes = 0;
+	}
+}
+
+void MyFFMPEGStreamer::record_latency(int64_t pts)
+{
+	if (pts == AV_NOPTS_VALUE)
+		return;
+
+	for (size_t i = 0; i < this->capture_times.size(); i++)
+	{
+		if (this->capture_times[i].pts != pts)
+			continue;
+		this->latency_hist.Record(av_gettime_relative() - this->capture_times[i].capture_us);
+		this->capture_times.erase(this->capture_times.begin() + i);
+		return;
+	}
+}
+
+void MyFFMPEGStreamer::record_packet(const AVPacket *pkt, int64_t write_us)
+{
+	this->write_hist.Record(write_us);
+	this->packet_count++;
+	this->byte_count += pkt->size;
+	if (pkt->flags & AV_PKT_FLAG_KEY)
+		this->keyframe_count++;
+	this->rate_window_bytes += pkt->size;
 }
 
-void MyFFMPEGStreamer::close_video(AVStream *st)
+std::string MyFFMPEGStreamer::make_rtp_url(const std::string& ip, int port)
 {
-	avcodec_close(st->codec);
+	std::string tempUrl("");
+	tempUrl.append("rtp://");
+	tempUrl.append(ip + ":");
+	tempUrl.append(std::to_string(port));
+	//tempUrl.append("/live.sdp");
+	tempUrl.append("/kstream");
+
+	return tempUrl;
+}
+
+void MyFFMPEGStreamer::close_video(AVCodecContext **c)
+{
+	avcodec_close(*c);
+	avcodec_free_context(c);
 	//std::cout << "codec" << std::endl;
-	av_free(this->src_picture.data[1]);
-	//std::cout << "src" << std::endl;
 	av_free(this->dst_picture.data[0]);
+	memset(&this->dst_picture, 0, sizeof(this->dst_picture));
 	//std::cout << "dst" << std::endl;
 	av_frame_free(&this->frame);
 	//std::cout << "frame" << std::endl;
 	this->video_is_eof = 0;
-}
\ No newline at end of file
+}
+
+void MyFFMPEGStreamer::BuildEncoder()
+{
+	std::unique_lock<std::mutex> lock(this->reconfig_lock);
+	while (this->is_config_pending)
+	{
+		MyFFMPEGEncoderConfig config = this->pending_config;
+		bool global_header = this->pending_global_header;
+		this->is_config_pending = false;
+		lock.unlock();
+
+		// opening x264 takes tens of milliseconds, the encoding thread does not wait for it
+		AVCodec *codec = NULL;
+		AVCodecContext *c = open_encoder(config, global_header, &codec);
+
+		lock.lock();
+		if (!c)
+		{
+			this->failed_reconfig_count++;
+			continue;
+		}
+		// a newer request arrived meanwhile, or the streamer is shutting down
+		if (this->is_config_pending || !this->is_building)
+		{
+			avcodec_free_context(&c);
+			continue;
+		}
+
+		// an encoder opened before that was never swapped in is replaced
+		if (this->next_ctx)
+			avcodec_free_context(&this->next_ctx);
+		this->next_ctx = c;
+		this->next_codec = codec;
+		this->next_config = config;
+		this->is_next_ready = true;
+	}
+	this->is_building = false;
+}
+
+bool MyFFMPEGStreamer::swap_encoder()
+{
+	this->reconfig_lock.lock();
+	AVCodecContext *c = this->next_ctx;
+	AVCodec *codec = this->next_codec;
+	MyFFMPEGEncoderConfig config = this->next_config;
+	this->next_ctx = NULL;
+	this->is_next_ready = false;
+	this->reconfig_lock.unlock();
+
+	if (!c)
+		return true;
+
+	/* the buffers of the new encoder first, without them the current one simply goes on */
+	AVFrame *old_frame = this->frame;
+	AVPicture old_picture = this->dst_picture;
+	this->frame = NULL;
+	memset(&this->dst_picture, 0, sizeof(this->dst_picture));
+	if (!alloc_video_buffers(c))
+	{
+		av_free(this->dst_picture.data[0]);
+		av_frame_free(&this->frame);
+		this->frame = old_frame;
+		this->dst_picture = old_picture;
+		avcodec_free_context(&c);
+		this->failed_reconfig_count++;
+		return true;
+	}
+
+	/* the frames still inside the old encoder go out first, its last GOP ends before the new one starts */
+	AVCodecContext *old_ctx = this->video_ctx;
+	AVRational old_time_base = old_ctx ? old_ctx->time_base : c->time_base;
+	if (old_ctx && !this->video_is_eof)
+		write_video_frame(old_ctx, cv::Mat(), AV_PIX_FMT_NONE, 1);
+	// what is left never comes out, the new encoder counts in its own time base
+	this->capture_times.clear();
+
+	/* the sinks learn about the new encoder before its first packet */
+	this->encoder_lock.lock();
+	this->video_ctx = c;
+	this->video_codec = codec;
+	this->config = config;
+	this->video_is_eof = 0;
+	this->sink_lock.lock();
+	for (size_t i = 0; i < this->sinks.size(); i++)
+		this->sinks[i]->OnEncoderChanged(c);
+	this->sink_lock.unlock();
+	this->encoder_lock.unlock();
+
+	if (old_ctx)
+	{
+		avcodec_close(old_ctx);
+		avcodec_free_context(&old_ctx);
+	}
+	av_free(old_picture.data[0]);
+	av_frame_free(&old_frame);
+	this->scaler.SetThreadLimit(config.thread_count);
+
+	/* the timeline goes on in the new time base. an encoder that reorders starts its decoding times
+	   has_b_frames frames before its first pts, the gap keeps them after the last packet of the old one */
+	this->frame_count = (int)av_rescale_q(this->frame_count, old_time_base, c->time_base) + std::max(c->has_b_frames, 0);
+	this->current_bit_rate = c->bit_rate > 0 ? c->bit_rate : config.bit_rate;
+	this->force_keyframe = false;
+	this->reconfig_count++;
+
+	return true;
+}
+
+void MyFFMPEGStreamer::stop_reconfig()
+{
+	this->reconfig_lock.lock();
+	this->is_config_pending = false;
+	this->is_building = false;
+	std::thread *thread = this->reconfig_thread;
+	this->reconfig_thread = NULL;
+	this->reconfig_lock.unlock();
+
+	// an encoder being opened is finished, then dropped
+	if (thread)
+	{
+		thread->join();
+		delete thread;
+	}
+
+	this->reconfig_lock.lock();
+	if (this->next_ctx)
+		avcodec_free_context(&this->next_ctx);
+	this->is_next_ready = false;
+	this->reconfig_lock.unlock();
+}
+
+bool MyFFMPEGStreamer::is_rate_change(const MyFFMPEGEncoderConfig& current, const MyFFMPEGEncoderConfig& wanted)
+{
+	return current.codec_id == wanted.codec_id && current.width == wanted.width && current.height == wanted.height &&
+		current.fps == wanted.fps && current.thread_count == wanted.thread_count &&
+		current.thread_type == wanted.thread_type && current.preset == wanted.preset && current.tune == wanted.tune &&
+		current.extra_options == wanted.extra_options && current.gop_size == wanted.gop_size &&
+		current.max_b_frames == wanted.max_b_frames && current.rate_control == wanted.rate_control &&
+		current.crf == wanted.crf && current.max_bit_rate == wanted.max_bit_rate &&
+		current.vbv_buffer_size == wanted.vbv_buffer_size && current.intra_refresh == wanted.intra_refresh &&
+		current.slice_max_size == wanted.slice_max_size;
+}
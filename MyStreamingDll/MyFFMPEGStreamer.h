@@ -1,15 +1,15 @@
 #ifndef _MY_FFMPEG_STREAMER_H_
 #define _MY_FFMPEG_STREAMER_H_
 
-#ifdef KSTREAMINGDLL_EXPORTS
-#define MY_FFMPEG_API __declspec(dllexport)
-#else
-#define MY_FFMPEG_API __declspec(dllimport)
-#endif
+#include "KPlatform.h"
 
-#include <Windows.h>
 #include <string>
 #include <ctime>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 extern "C"
 {
@@ -18,12 +18,23 @@ extern "C"
 #include <libavformat/avio.h>
 #include <libswscale/swscale.h>
 #include <libavutil/time.h>
-#include <libavdevice/avdevice.h>
+#include <libavutil/buffer.h>
 }
 
 #include <opencv2/core/core.hpp> // Basic OpenCV structures (cv::Mat)
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include "KTimestampOverlay.h"
+#include "KLatencyHistogram.h"
+#include "KStreamStats.h"
+#include "MyFFMPEGSink.h"
+#include "MyFFMPEGRTPSink.h"
+#include "MyFFMPEGSegmentSink.h"
+#include "MyFFMPEGClipSink.h"
+#include "MyFFMPEGSliceScaler.h"
+#include "MyFFMPEGEncoderConfig.h"
+
+#ifdef _MSC_VER
 // ffmpeg
 #pragma comment(lib, "avcodec.lib")
 #pragma comment(lib, "avformat.lib")
@@ -38,18 +49,48 @@ extern "C"
 #pragma comment(lib, "opencv_imgproc2413d.lib")
 
 #pragma warning(disable:4996)
+#endif
 
 #define STREAM_FPS		30
 #define STREAM_PIX_FMT	AV_PIX_FMT_YUV420P
+#define STREAM_SWS_FLAGS	SWS_BICUBIC
+// frames whose capture time waits for their packet, beyond any encoder delay
+#define CAPTURE_TIMES_MAX	64
 
 enum MyFFMPEGStreamerError{
 	CANT_ALLOC_FORMAT_CONTEXT = 10, 
 	CANT_ALLOC_OUTPUT_FORMAT = 11, 
 	CANT_OPEN_RTSP_OUTPUT = 12, 
 	CANT_WRITE_HEADER = 13, 
+	CANT_ADD_STREAM = 14, 
+	CANT_FIND_ENCODER = 15,
+	CANT_ALLOC_CODEC_CONTEXT = 16,
+	CANT_OPEN_ENCODER = 17,
+	CANT_ALLOC_FRAME = 18,
+	CANT_INIT_CONVERSION = 19,
+	CANT_ENCODE_FRAME = 20,
 	NO_FFMPEG_ERROR = 100
 };
 
+// capture time of a frame handed to the encoder, matched with its packet by pts
+struct MyCaptureTime{
+	int64_t pts;
+	int64_t capture_us;
+};
+
+// cost of the last StreamImage call, in microseconds
+struct MyFFMPEGFrameTiming{
+	bool is_encoded;	// false if the frame was skipped
+	int64_t convert_us;
+	int64_t overlay_us;
+	int64_t encode_us;
+	int64_t write_us;
+	int packet_count;	// packets the encoder released, 0 while it still holds the frame
+	int packet_size;	// of all of them
+	bool is_keyframe;
+	int send_queue;		// packets waiting in the fullest output queue
+};
+
 class MY_FFMPEG_API MyFFMPEGStreamer
 {
 public:
@@ -57,35 +98,201 @@ public:
 	~MyFFMPEGStreamer();
 
 private:
-	MyFFMPEGStreamerError last_error;
+	std::atomic<MyFFMPEGStreamerError> last_error;
 	// ffmpeg members
 	std::string ip;
 	int port;
-	enum AVCodecID codec_id;
-	AVOutputFormat *fmt;
-	AVFormatContext *oc;
-	AVStream *video_st; //, *audio_st;
+	MyFFMPEGEncoderConfig config;
+	AVCodecContext *video_ctx;
 	AVCodec *video_codec; //, *audio_codec;
+	// held while video_ctx and config are swapped and while a new sink copies its parameters
+	std::mutex encoder_lock;
+	// outputs sharing the encoded packets
+	std::mutex sink_lock;
+	std::vector<MyFFMPEGSink*> sinks;
+	int next_sink_id;
+	// the RTP output of Initialize, moved by SetDestination
+	std::atomic<int> primary_sink_id;
+	std::atomic<bool> is_paced;
 	// stream members
 	AVFrame *frame;
-	AVPicture src_picture, dst_picture;
+	AVPicture dst_picture;
 	int frame_count;
 	int video_is_eof; //, audio_is_eof;
+	std::atomic<bool> force_keyframe;
+	// runtime rate changes, applied by the encoding thread
+	std::atomic<int64_t> pending_bit_rate;
+	std::atomic<int64_t> current_bit_rate;
+	std::atomic<int> frame_decimation;
+	int decimation_index;
+	struct MyFFMPEGFrameTiming timing;
+	// stream statistics, recorded by the encoding thread and read from any thread
+	int64_t stats_start;
+	KLatencyHistogram convert_hist;
+	KLatencyHistogram overlay_hist;
+	KLatencyHistogram encode_hist;
+	KLatencyHistogram write_hist;
+	KLatencyHistogram latency_hist;
+	// frames given a capture time that are still inside the encoder, on the encoding thread
+	std::deque<struct MyCaptureTime> capture_times;
+	int64_t frame_capture_us;
+	std::atomic<uint64_t> encoded_frames;
+	std::atomic<uint64_t> skipped_frames;
+	std::atomic<uint64_t> keyframe_count;
+	std::atomic<uint64_t> packet_count;
+	std::atomic<uint64_t> byte_count;
+	struct MyFFMPEGSendStats send_stats;
+	// achieved rates over windows of about one second
+	int64_t rate_window_start;
+	int rate_window_frames;
+	uint64_t rate_window_bytes;
+	std::atomic<int64_t> achieved_bit_rate;
+	std::atomic<double> achieved_fps;
+	// reconfiguration, the next encoder is opened by reconfig_thread and swapped in by the encoding thread
+	std::mutex reconfig_lock;
+	std::thread *reconfig_thread;
+	bool is_building;
+	bool is_config_pending;
+	MyFFMPEGEncoderConfig pending_config;
+	bool pending_global_header;
+	AVCodecContext *next_ctx;
+	AVCodec *next_codec;
+	MyFFMPEGEncoderConfig next_config;
+	std::atomic<bool> is_next_ready;
+	std::atomic<uint64_t> reconfig_count;
+	std::atomic<uint64_t> failed_reconfig_count;
+	// conversion to the encoder's format, split across cores for large frames
+	MyFFMPEGSliceScaler scaler;
+	std::atomic<int> sws_flags;
+	// time stamp drawn on every frame
+	KTimestampOverlay overlay;
 
 	// ffmpeg methods
-	int write_frame(AVFormatContext *fmt_ctx, const AVRational *time_base, AVStream *st, AVPacket *pkt);
-	AVStream *add_stream(AVFormatContext *oc, AVCodec **codec, enum AVCodecID codec_id,
-						int img_width, int img_height, int64_t bit_rate);
-	void open_video(AVFormatContext *oc, AVCodec *codec, AVStream *st);
-	void write_video_frame(AVFormatContext *oc, AVStream *st, cv::Mat cv_img, int flush);
-	void close_video(AVStream *st);
+	int write_frame(const AVRational *time_base, AVPacket *pkt);
+	AVCodecContext *add_stream(AVCodec **codec, const MyFFMPEGEncoderConfig& config, bool global_header);
+	// open the sink and start feeding it, the sink is deleted on failure
+	int add_sink(MyFFMPEGSink *sink, const std::string& url, const char* format_name);
+	// codec, options and open in one, NULL on failure
+	AVCodecContext *open_encoder(const MyFFMPEGEncoderConfig& config, bool global_header, AVCodec **codec);
+	bool open_video(AVCodec *codec, AVCodecContext *c, AVDictionary **options);
+	// frame and picture for the open encoder c
+	bool alloc_video_buffers(AVCodecContext *c);
+	// reconfig_thread, opens encoders for pending_config until none is pending
+	void BuildEncoder();
+	// on the encoding thread: drain the current encoder, then continue the stream with next_ctx
+	// and tell the sinks. the current encoder stays if the buffers for next_ctx cannot be allocated
+	bool swap_encoder();
+	void stop_reconfig();
+	// only bit_rate differs, which the open encoder can follow, its bounds move in proportion
+	static bool is_rate_change(const MyFFMPEGEncoderConfig& current, const MyFFMPEGEncoderConfig& wanted);
+	void set_codec_options(AVCodecContext *c, const MyFFMPEGEncoderConfig& config, AVDictionary **options);
+	bool write_video_frame(AVCodecContext *c, const cv::Mat& cv_img, enum AVPixelFormat src_fmt, int flush);
+	// write the packets the encoder has ready, returns AVERROR(EAGAIN) or AVERROR_EOF once drained
+	int receive_packets(AVCodecContext *c);
+	enum AVPixelFormat get_pix_fmt(const cv::Mat& cv_img);
+	// plane pointers of an image, returns the picture height
+	int get_src_planes(const cv::Mat& cv_img, enum AVPixelFormat src_fmt, const uint8_t *data[4], int linesize[4]);
+	void close_video(AVCodecContext **c);
+	void apply_bit_rate(AVCodecContext *c);
+	void record_stats(int flush);
+	void record_packet(const AVPacket *pkt, int64_t write_us);
+	// the frame of pts left the encoder, the packets of B-frames come out of pts order
+	void record_latency(int64_t pts);
+	static std::string make_rtp_url(const std::string& ip, int port);
 
 public:
 	bool Initialize(int img_width, int img_height, int64_t bit_rate, 
 					enum AVCodecID codec_id = AV_CODEC_ID_MPEG4,
+					std::string ip = "127.0.0.1", int port = 8554, int fps = STREAM_FPS);
+	bool Initialize(const MyFFMPEGEncoderConfig& config,
 					std::string ip = "127.0.0.1", int port = 8554);
 	void Deinitialize();
-	bool StreamImage(cv::Mat cv_img, bool is_end);
+	/*
+	src_fmt AV_PIX_FMT_NONE takes the format from the Mat type (BGR, BGRA or gray).
+	AV_PIX_FMT_YUV420P takes a packed I420 CV_8UC1 Mat of height * 3 / 2 rows (cv::COLOR_BGR2YUV_I420),
+	at the encoder size and without overlay it is encoded without any conversion.
+	is_end drains the encoder, every frame it still holds is written. false on an error, see GetLastError.
+	capture_us (av_gettime_relative clock) is when the frame was grabbed, the latency statistics measure
+	from it to the moment this frame's packet is handed to the outputs. 0 leaves the frame out of them.
+	*/
+	bool StreamImage(const cv::Mat& cv_img, bool is_end, enum AVPixelFormat src_fmt = AV_PIX_FMT_NONE,
+					int64_t capture_us = 0);
+	// leave out this frame's slot, the timestamps of the next frames keep the timeline
+	void SkipFrame();
+	/*
+	add an output fed by the same encoder, e.g. "rtp://10.0.0.2:8554/kstream" or "record.mkv".
+	format_name may be NULL to guess the muxer from the url. returns the sink id, -1 on failure.
+	mp4 and mkv recordings take their global headers from the first keyframe the sink receives.
+	*/
+	int AddSink(const std::string& url, const char* format_name = NULL);
+	int AddRTPDestination(const std::string& ip, int port);
+	/*
+	record into a ring of memory-mapped MPEG-TS segments in directory, which must exist.
+	the oldest segment is overwritten once the ring is full, see MyFFMPEGSegmentSink.
+	*/
+	int AddSegmentSink(const std::string& directory, int segment_count = SEGMENT_COUNT, size_t segment_size = SEGMENT_SIZE);
+	// segment files of a segment sink, oldest first, empty for other sinks
+	std::vector<std::string> GetSegmentPaths(int sink_id);
+	// keep the last max_seconds of encoded video in memory for ExportClip, see MyFFMPEGClipSink
+	int AddClipSink(int max_seconds = CLIP_RING_SECONDS, size_t max_bytes = CLIP_RING_BYTES);
+	/*
+	write [trigger_us - before_ms, trigger_us + after_ms] of a clip sink to path in the background,
+	starting at a keyframe. trigger_us 0 is now. returns a clip id, -1 on failure.
+	*/
+	int ExportClip(int sink_id, const std::string& path, int before_ms, int after_ms, int64_t trigger_us = 0);
+	bool RemoveSink(int sink_id);
+	// encode the next frame as a keyframe (IDR), e.g. when a receiver lost packets
+	void RequestKeyframe();
+	/*
+	change the target bit rate of the open encoder, applied before the next frame.
+	libx264 reconfigures in place, other encoders follow as far as their rate control allows.
+	*/
+	void SetBitRate(int64_t bit_rate);
+	int64_t GetBitRate();
+	// encode only every n-th frame, skipped frames leave a gap in the timestamps
+	void SetFrameDecimation(int n);
+	// pace the datagrams of RTP outputs, on by default
+	void SetPacing(bool enable);
+	// timing of the last frame, read it from the thread calling StreamImage
+	struct MyFFMPEGFrameTiming GetLastFrameTiming();
+	/*
+	encoder side of the stream statistics since Initialize or ResetStats, safe from any thread.
+	capture and queue are left empty, KStreamer fills them in. latency covers the frames given a capture time.
+	*/
+	struct KStreamStats GetStats();
+	void ResetStats();
+	int GetSinkCount();
+	/*
+	set swscale algorithm (SWS_BICUBIC, SWS_BILINEAR, SWS_FAST_BILINEAR, SWS_POINT, ...).
+	cheaper scalers trade quality for conversion time, the context is rebuilt on the next frame.
+	*/
+	void SetScalerFlags(int sws_flags);
+	/*
+	convert in slice_count horizontal slices on as many cores, 0 picks from the frame size and the cores,
+	no more than the encoder's thread_count if it has one (1 on a KStreamEngine: a single band).
+	pays off once a fast encoder preset leaves the conversion as the slowest stage.
+	*/
+	void SetConvertSlices(int slice_count);
+	// show or move the time stamp, (x, y) is the bottom-left of the text
+	void SetOverlay(bool enable, int x = 20, int y = 20);
+	// a copy of the settings the current encoder was opened with, from any thread
+	MyFFMPEGEncoderConfig GetConfig();
+	/*
+	change the encoder settings while streaming, from any thread.
+	a change of bit_rate alone is applied to the open encoder before the next frame.
+	anything else (size, GOP, preset, ...) opens a new encoder in the background, the encoding thread
+	drains the current one and continues with the new one, whose first frame is a keyframe.
+	the timestamps go on, the sinks stay open: receivers get the new size from the in-band headers.
+	if the new encoder cannot get its buffers the current one keeps streaming, counted as a failed reconfiguration.
+	a newer request replaces one still being opened. false if the streamer is not initialized or
+	codec_id differs, the sinks' muxers only carry the codec they were opened with.
+	*/
+	bool Reconfigure(const MyFFMPEGEncoderConfig& config);
+	// move the RTP output of Initialize to another receiver, the encoder keeps running
+	bool SetDestination(const std::string& ip, int port);
+	// encoders swapped in since Initialize, and reconfigurations that could not open theirs
+	uint64_t GetReconfigCount();
+	uint64_t GetFailedReconfigCount();
 	int GetLastError();
 };
 